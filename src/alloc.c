@@ -0,0 +1,67 @@
+#include <errno.h>
+#include <stddef.h>
+#include "alloc.h"
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *p);
+
+static __thread uint64_t allocations;
+
+void *malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    allocations++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+    allocations++;
+    return __libc_realloc(p, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    allocations++;
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    allocations++;
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **p, size_t alignment, size_t size) {
+    allocations++;
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1))) {
+        return EINVAL;
+    }
+    void *mem = __libc_memalign(alignment, size);
+    if (!mem) {
+        return ENOMEM;
+    }
+    *p = mem;
+    return 0;
+}
+
+void free(void *p) {
+    __libc_free(p);
+}
+
+uint64_t alloc_count(void) {
+    return allocations;
+}
+
+#else
+
+uint64_t alloc_count(void) {
+    return UINT64_MAX;
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef MIDI2HID_ALLOC_H
+#define MIDI2HID_ALLOC_H
+
+#include <stdint.h>
+
+/**
+ * Allocation tracking. alloc.c replaces malloc() and friends of glibc with versions that count the calls of
+ * each thread. It is part of the core library, and only pulled into the programs that ask for the counters,
+ * directly or through the pipeline threads.
+ */
+
+/**
+ * Returns the number of malloc(), calloc(), realloc(), memalign(), aligned_alloc() and posix_memalign() calls of
+ * the calling thread, or UINT64_MAX if allocations can't be tracked on this libc.
+ */
+uint64_t alloc_count(void);
+
+#endif //MIDI2HID_ALLOC_H
@@ -0,0 +1,84 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "backend.h"
+
+/**
+ * Backend that writes the reports to a descriptor: the HID gadget or a file/pipe.
+ */
+struct backend_fd {
+    struct backend base;
+
+    /**
+     * Descriptor the reports are written to. Also the poll descriptor, unless it is a regular file.
+     */
+    int out;
+};
+
+static ssize_t fd_write(struct backend *base, const uint8_t *data, size_t len) {
+    return write(((struct backend_fd *) base)->out, data, len);
+}
+
+static void fd_close(struct backend *base) {
+    close(((struct backend_fd *) base)->out);
+    free(base);
+}
+
+/**
+ * Creates a descriptor backend.
+ * @param poll poll the descriptor, otherwise the backend has no poll descriptor
+ */
+static struct backend *fd_open(const char *name, int fd, int poll, int readable) {
+    struct backend_fd *b = calloc(1, sizeof(struct backend_fd));
+    if (!b) {
+        close(fd);
+        return NULL;
+    }
+    b->out = fd;
+    b->base.name = name;
+    b->base.fd = poll ? fd : -1;
+    b->base.readable = readable;
+    b->base.write = fd_write;
+    b->base.close = fd_close;
+    return &b->base;
+}
+
+struct backend *backend_hidg_open(const char *path) {
+    // non-blocking, so a slow host can't stall the MIDI input. the output stage queues the reports instead.
+    int fd = open(path, O_RDWR | O_NONBLOCK, 0666);
+    if (fd == -1) {
+        perror(path);
+        return NULL;
+    }
+    return fd_open("hidg", fd, 1, 1);
+}
+
+struct backend *backend_file_open(const char *path) {
+    // a pipe blocks the open until there is a reader, after that the writes must not block.
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1 || fcntl(fd, F_SETFL, O_NONBLOCK) == -1) {
+        perror(path);
+        if (fd != -1) {
+            close(fd);
+        }
+        return NULL;
+    }
+    struct stat st;
+    // regular files are always writable, polling them would spin.
+    int regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    return fd_open(regular ? "file" : "pipe", fd, !regular, 0);
+}
+
+struct backend *backend_open(const char *spec, enum report_mode mode) {
+    if (strcmp(spec, "uinput") == 0) {
+        return backend_uinput_open(mode);
+    }
+    if (strncmp(spec, "file:", 5) == 0) {
+        return backend_file_open(spec + 5);
+    }
+    return backend_hidg_open(spec);
+}
@@ -0,0 +1,71 @@
+#ifndef MIDI2HID_BACKEND_H
+#define MIDI2HID_BACKEND_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "report.h"
+
+/**
+ * Output backend, that delivers the reports of the output stage. Writes never block: a backend that can't take
+ * a report right now fails with EAGAIN, and the event loop waits for POLLOUT on its descriptor.
+ */
+struct backend {
+    /**
+     * Name of the backend for log messages.
+     */
+    const char *name;
+
+    /**
+     * Descriptor to poll for POLLOUT after EAGAIN, and for POLLIN if {@code readable}. -1 if there is none.
+     */
+    int fd;
+
+    /**
+     * The host sends output reports (eg. the LED state) that can be read from {@code fd}.
+     */
+    int readable;
+
+    /**
+     * Delivers one report.
+     * @return the length of the report, or -1 with errno set (EAGAIN if the backend is busy).
+     */
+    ssize_t (*write)(struct backend *b, const uint8_t *data, size_t len);
+
+    /**
+     * Closes the backend and frees it.
+     */
+    void (*close)(struct backend *b);
+};
+
+/**
+ * Opens the HID gadget function, eg. /dev/hidg0. The reports go to the USB host unchanged.
+ * @param path the device
+ * @return the backend or NULL
+ */
+struct backend *backend_hidg_open(const char *path);
+
+/**
+ * Creates a uinput device on the local machine, that turns the reports into key (and for the composite layout
+ * button and axis) events of the input subsystem. No USB hop, for running midi2hid on the PC the kit is
+ * plugged into.
+ * @param mode report layout of the reports it receives
+ * @return the backend or NULL
+ */
+struct backend *backend_uinput_open(enum report_mode mode);
+
+/**
+ * Opens a file or a pipe that receives the raw reports, for tests and runs without any device.
+ * @param path the file, created if it doesn't exist
+ * @return the backend or NULL
+ */
+struct backend *backend_file_open(const char *path);
+
+/**
+ * Opens the backend given on the command line: {@code uinput}, {@code file:path}, or else the path of the
+ * HID gadget device.
+ * @return the backend or NULL
+ */
+struct backend *backend_open(const char *spec, enum report_mode mode);
+
+#endif //MIDI2HID_BACKEND_H
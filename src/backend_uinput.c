@@ -0,0 +1,236 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+#include "backend.h"
+
+/**
+ * Input event code of every key ID: the keyboard usages like the kernel's HID driver maps them, the modifiers,
+ * and the gamepad buttons and consumer controls of the composite layout. 0 if the key has no event code.
+ */
+static const uint16_t key_codes[256] = {
+        [0x04] = KEY_A, [0x05] = KEY_B, [0x06] = KEY_C, [0x07] = KEY_D, [0x08] = KEY_E, [0x09] = KEY_F,
+        [0x0a] = KEY_G, [0x0b] = KEY_H, [0x0c] = KEY_I, [0x0d] = KEY_J, [0x0e] = KEY_K, [0x0f] = KEY_L,
+        [0x10] = KEY_M, [0x11] = KEY_N, [0x12] = KEY_O, [0x13] = KEY_P, [0x14] = KEY_Q, [0x15] = KEY_R,
+        [0x16] = KEY_S, [0x17] = KEY_T, [0x18] = KEY_U, [0x19] = KEY_V, [0x1a] = KEY_W, [0x1b] = KEY_X,
+        [0x1c] = KEY_Y, [0x1d] = KEY_Z,
+        [0x1e] = KEY_1, [0x1f] = KEY_2, [0x20] = KEY_3, [0x21] = KEY_4, [0x22] = KEY_5, [0x23] = KEY_6,
+        [0x24] = KEY_7, [0x25] = KEY_8, [0x26] = KEY_9, [0x27] = KEY_0,
+        [0x28] = KEY_ENTER, [0x29] = KEY_ESC, [0x2a] = KEY_BACKSPACE, [0x2b] = KEY_TAB, [0x2c] = KEY_SPACE,
+        [0x2d] = KEY_MINUS, [0x2e] = KEY_EQUAL, [0x2f] = KEY_LEFTBRACE, [0x30] = KEY_RIGHTBRACE,
+        // the kernel maps the non-US # (0x32) to KEY_BACKSLASH as well. it gets no code, so the two keys can't
+        // release each other.
+        [0x31] = KEY_BACKSLASH, [0x33] = KEY_SEMICOLON, [0x34] = KEY_APOSTROPHE,
+        [0x35] = KEY_GRAVE, [0x36] = KEY_COMMA, [0x37] = KEY_DOT, [0x38] = KEY_SLASH, [0x39] = KEY_CAPSLOCK,
+        [0x3a] = KEY_F1, [0x3b] = KEY_F2, [0x3c] = KEY_F3, [0x3d] = KEY_F4, [0x3e] = KEY_F5, [0x3f] = KEY_F6,
+        [0x40] = KEY_F7, [0x41] = KEY_F8, [0x42] = KEY_F9, [0x43] = KEY_F10, [0x44] = KEY_F11, [0x45] = KEY_F12,
+        [0x46] = KEY_SYSRQ, [0x47] = KEY_SCROLLLOCK, [0x48] = KEY_PAUSE, [0x49] = KEY_INSERT, [0x4a] = KEY_HOME,
+        [0x4b] = KEY_PAGEUP, [0x4c] = KEY_DELETE, [0x4d] = KEY_END, [0x4e] = KEY_PAGEDOWN, [0x4f] = KEY_RIGHT,
+        [0x50] = KEY_LEFT, [0x51] = KEY_DOWN, [0x52] = KEY_UP, [0x53] = KEY_NUMLOCK,
+        [0x54] = KEY_KPSLASH, [0x55] = KEY_KPASTERISK, [0x56] = KEY_KPMINUS, [0x57] = KEY_KPPLUS,
+        [0x58] = KEY_KPENTER, [0x59] = KEY_KP1, [0x5a] = KEY_KP2, [0x5b] = KEY_KP3, [0x5c] = KEY_KP4,
+        [0x5d] = KEY_KP5, [0x5e] = KEY_KP6, [0x5f] = KEY_KP7, [0x60] = KEY_KP8, [0x61] = KEY_KP9,
+        [0x62] = KEY_KP0, [0x63] = KEY_KPDOT, [0x64] = KEY_102ND, [0x65] = KEY_COMPOSE, [0x66] = KEY_POWER,
+        [0x67] = KEY_KPEQUAL, [0x68] = KEY_F13, [0x69] = KEY_F14, [0x6a] = KEY_F15, [0x6b] = KEY_F16,
+        [0x6c] = KEY_F17, [0x6d] = KEY_F18, [0x6e] = KEY_F19, [0x6f] = KEY_F20, [0x70] = KEY_F21,
+        [0x71] = KEY_F22, [0x72] = KEY_F23, [0x73] = KEY_F24, [0x74] = KEY_OPEN, [0x75] = KEY_HELP,
+        [0x76] = KEY_PROPS, [0x77] = KEY_FRONT, [0x78] = KEY_STOP, [0x79] = KEY_AGAIN, [0x7a] = KEY_UNDO,
+        [0x7b] = KEY_CUT, [0x7c] = KEY_COPY, [0x7d] = KEY_PASTE, [0x7e] = KEY_FIND, [0x7f] = KEY_MUTE,
+        // gamepad buttons 1-16
+        [0x80] = BTN_TRIGGER_HAPPY1, [0x81] = BTN_TRIGGER_HAPPY2, [0x82] = BTN_TRIGGER_HAPPY3,
+        [0x83] = BTN_TRIGGER_HAPPY4, [0x84] = BTN_TRIGGER_HAPPY5, [0x85] = BTN_TRIGGER_HAPPY6,
+        [0x86] = BTN_TRIGGER_HAPPY7, [0x87] = BTN_TRIGGER_HAPPY8, [0x88] = BTN_TRIGGER_HAPPY9,
+        [0x89] = BTN_TRIGGER_HAPPY10, [0x8a] = BTN_TRIGGER_HAPPY11, [0x8b] = BTN_TRIGGER_HAPPY12,
+        [0x8c] = BTN_TRIGGER_HAPPY13, [0x8d] = BTN_TRIGGER_HAPPY14, [0x8e] = BTN_TRIGGER_HAPPY15,
+        [0x8f] = BTN_TRIGGER_HAPPY16,
+        // consumer controls, in the order of report_consumer_usage()
+        [0xa0] = KEY_MUTE, [0xa1] = KEY_VOLUMEUP, [0xa2] = KEY_VOLUMEDOWN, [0xa3] = KEY_PLAYPAUSE,
+        [0xa4] = KEY_STOPCD, [0xa5] = KEY_NEXTSONG, [0xa6] = KEY_PREVIOUSSONG, [0xa7] = KEY_EJECTCD,
+        [0xa8] = KEY_FASTFORWARD, [0xa9] = KEY_REWIND, [0xaa] = KEY_RECORD, [0xab] = KEY_HOMEPAGE,
+        [0xac] = KEY_BACK, [0xad] = KEY_FORWARD, [0xae] = KEY_CALC, [0xaf] = KEY_COMPUTER,
+        // modifiers
+        [0xe0] = KEY_LEFTCTRL, [0xe1] = KEY_LEFTSHIFT, [0xe2] = KEY_LEFTALT, [0xe3] = KEY_LEFTMETA,
+        [0xe4] = KEY_RIGHTCTRL, [0xe5] = KEY_RIGHTSHIFT, [0xe6] = KEY_RIGHTALT, [0xe7] = KEY_RIGHTMETA,
+};
+
+static const uint16_t axis_codes[GAMEPAD_AXES] = {ABS_X, ABS_Y, ABS_Z, ABS_RZ};
+
+/**
+ * Maximum number of events of one report: every key and axis, and the SYN_REPORT.
+ */
+#define UINPUT_MAX_EVENTS (256 + GAMEPAD_AXES + 1)
+
+struct backend_uinput {
+    struct backend base;
+    enum report_mode mode;
+
+    /**
+     * Keys of the last report of every report ID, to send only the changes.
+     */
+    uint8_t keys[REPORT_IDS + 1][32];
+    uint8_t axes[GAMEPAD_AXES];
+
+    /**
+     * Keys holding each event code. The keyboard's and the consumer control's mute share KEY_MUTE, which is only
+     * released once neither holds it.
+     */
+    uint8_t held[KEY_CNT];
+
+    struct input_event events[UINPUT_MAX_EVENTS];
+};
+
+static void add_event(struct input_event *ev, int *n, uint16_t type, uint16_t code, int32_t value) {
+    memset(&ev[*n], 0, sizeof(ev[*n]));
+    ev[*n].type = type;
+    ev[*n].code = code;
+    ev[*n].value = value;
+    (*n)++;
+}
+
+/**
+ * Takes back the key changes that uinput_write() counted in {@code held} for a report that wasn't written, so that
+ * the output stage can retry it.
+ */
+static void unhold(struct backend_uinput *u, const uint8_t *last, const uint8_t *keys) {
+    for (int i = 0; i < 32; i++) {
+        uint8_t changed = keys[i] ^ last[i];
+        for (int bit = 0; changed; bit++, changed >>= 1) {
+            uint16_t code = key_codes[i * 8 + bit];
+            if (!(changed & 1) || !code) {
+                continue;
+            }
+            if ((keys[i] >> bit) & 1) {
+                u->held[code]--;
+            } else {
+                u->held[code]++;
+            }
+        }
+    }
+}
+
+/**
+ * Turns the differences to the last report with the same ID into input events, and writes them in one go.
+ * The kernel stamps the events when they arrive.
+ */
+static ssize_t uinput_write(struct backend *base, const uint8_t *data, size_t len) {
+    struct backend_uinput *u = (struct backend_uinput *) base;
+    uint8_t keys[32];
+    uint8_t axes[GAMEPAD_AXES];
+    uint8_t *last = u->keys[report_id(u->mode, data)];
+    int n = 0;
+    report_keys(u->mode, data, keys);
+    for (int i = 0; i < 32; i++) {
+        uint8_t changed = keys[i] ^ last[i];
+        for (int bit = 0; changed; bit++, changed >>= 1) {
+            uint16_t code = key_codes[i * 8 + bit];
+            if (!(changed & 1) || !code) {
+                continue;
+            }
+            int down = (keys[i] >> bit) & 1;
+            if (down ? u->held[code]++ == 0 : --u->held[code] == 0) {
+                add_event(u->events, &n, EV_KEY, code, down);
+            }
+        }
+    }
+    int gamepad = report_axes(u->mode, data, axes);
+    if (gamepad) {
+        for (int a = 0; a < GAMEPAD_AXES; a++) {
+            if (axes[a] != u->axes[a]) {
+                add_event(u->events, &n, EV_ABS, axis_codes[a], axes[a]);
+            }
+        }
+    }
+    if (n) {
+        add_event(u->events, &n, EV_SYN, SYN_REPORT, 0);
+        size_t size = sizeof(struct input_event) * (size_t) n;
+        ssize_t ret = write(base->fd, u->events, size);
+        if (ret != (ssize_t) size) {
+            int err = ret < 0 ? errno : EIO;
+            unhold(u, last, keys);
+            errno = err;
+            return -1;
+        }
+    }
+    memcpy(last, keys, sizeof(keys));
+    if (gamepad) {
+        memcpy(u->axes, axes, sizeof(axes));
+    }
+    return (ssize_t) len;
+}
+
+static void uinput_close(struct backend *base) {
+    ioctl(base->fd, UI_DEV_DESTROY);
+    close(base->fd);
+    free(base);
+}
+
+/**
+ * Declares the events of the device and creates it.
+ */
+static int uinput_setup(int fd, enum report_mode mode) {
+    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0 || ioctl(fd, UI_SET_EVBIT, EV_SYN) < 0) {
+        return -1;
+    }
+    for (int key = 0; key < 256; key++) {
+        int composite = key >= REPORT_KEY_BUTTON && key < 0xe0;
+        if (key_codes[key] && (!composite || mode == REPORT_COMPOSITE) && ioctl(fd, UI_SET_KEYBIT, key_codes[key]) < 0) {
+            return -1;
+        }
+    }
+    if (mode == REPORT_COMPOSITE) {
+        if (ioctl(fd, UI_SET_EVBIT, EV_ABS) < 0) {
+            return -1;
+        }
+        for (int a = 0; a < GAMEPAD_AXES; a++) {
+            struct uinput_abs_setup abs;
+            memset(&abs, 0, sizeof(abs));
+            abs.code = axis_codes[a];
+            abs.absinfo.minimum = 0;
+            abs.absinfo.maximum = 127;
+            if (ioctl(fd, UI_SET_ABSBIT, axis_codes[a]) < 0 || ioctl(fd, UI_ABS_SETUP, &abs) < 0) {
+                return -1;
+            }
+        }
+    }
+    struct uinput_setup setup;
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_VIRTUAL;
+    // the ids of the gadget, see scripts/init.sh
+    setup.id.vendor = 0x0525;
+    setup.id.product = 0xa4ac;
+    snprintf(setup.name, sizeof(setup.name), "midi2hid");
+    if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+struct backend *backend_uinput_open(enum report_mode mode) {
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        perror("/dev/uinput");
+        return NULL;
+    }
+    if (uinput_setup(fd, mode)) {
+        perror("uinput");
+        close(fd);
+        return NULL;
+    }
+    struct backend_uinput *u = calloc(1, sizeof(struct backend_uinput));
+    if (!u) {
+        ioctl(fd, UI_DEV_DESTROY);
+        close(fd);
+        return NULL;
+    }
+    u->mode = mode;
+    u->base.name = "uinput";
+    u->base.fd = fd;
+    u->base.readable = 0;
+    u->base.write = uinput_write;
+    u->base.close = uinput_close;
+    return &u->base;
+}
@@ -0,0 +1,299 @@
+/*
+ * Benchmark of the MIDI to HID hot path. Drives synthetic drum workloads through the engine on a
+ * virtual clock, with a sink that only counts the reports, and prints the cost per event.
+ *
+ * With -b, the events that arrive within the same millisecond are handed over as one batch, like the daemon
+ * drains them after a wakeup.
+ *
+ *   midi2hid_bench [-n] [-l] [-b] [-q repeats] [-m profile] [-e events] [-r runs]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "engine.h"
+#include "keymap.h"
+#include "log.h"
+
+/**
+ * Virtual start time of every run.
+ */
+#define BENCH_BASE 1000000000ULL
+
+#define MS 1000000ULL
+#define US 1000ULL
+
+/**
+ * Pad notes of the TD-1, see the built-in profile.
+ */
+static const uint8_t kit[] = {0x24, 0x26, 0x28, 0x30, 0x2d, 0x2b, 0x2e, 0x1a, 0x2a, 0x16, 0x31, 0x37, 0x33, 0x3b};
+#define KIT_SIZE (sizeof(kit) / sizeof(kit[0]))
+
+struct workload {
+    const char *name;
+
+    /**
+     * Generates the events and their times relative to the start.
+     */
+    void (*generate)(struct midi_event *ev, uint64_t *t, int n);
+};
+
+static void note(struct midi_event *ev, uint8_t type, uint8_t channel, uint8_t n, uint8_t value) {
+    ev->type = type;
+    ev->channel = channel;
+    ev->note = n;
+    ev->value = value;
+    ev->device = 0;
+    ev->stamp = 0;
+}
+
+/**
+ * Single snare roll at the given rate. Every hit is followed by its NOTEOFF 5ms later.
+ */
+static void roll(struct midi_event *ev, uint64_t *t, int n, uint64_t period) {
+    for (int i = 0; i < n; i++) {
+        uint64_t hit = (uint64_t) (i / 2) * period;
+        if (i & 1) {
+            note(&ev[i], MIDI_NOTEOFF, 9, 0x26, 0x40);
+            t[i] = hit + 5 * MS;
+        } else {
+            note(&ev[i], MIDI_NOTEON, 9, 0x26, (uint8_t) (0x50 + i % 0x20));
+            t[i] = hit;
+        }
+    }
+}
+
+static void roll32(struct midi_event *ev, uint64_t *t, int n) {
+    roll(ev, t, n, 1000 * MS / 32);
+}
+
+static void roll60(struct midi_event *ev, uint64_t *t, int n) {
+    roll(ev, t, n, 1000 * MS / 60);
+}
+
+/**
+ * Full kit fill: 32nd notes over all pads at 180bpm, with a flam (second hit 2ms later) on every 4th note
+ * and the kick on every beat.
+ */
+static void fill(struct midi_event *ev, uint64_t *t, int n) {
+    const uint64_t step = 60000 * MS / 180 / 8;
+    uint64_t now = 0;
+    for (int i = 0, s = 0; i < n; s++) {
+        now = (uint64_t) s * step;
+        note(&ev[i], MIDI_NOTEON, 9, kit[s % KIT_SIZE], (uint8_t) (0x40 + s % 0x3f));
+        t[i++] = now;
+        if (i < n && s % 4 == 0) {
+            note(&ev[i], MIDI_NOTEON, 9, kit[(s + 3) % KIT_SIZE], 0x60);
+            t[i++] = now + 2 * MS;
+        }
+        if (i < n && s % 8 == 0) {
+            note(&ev[i], MIDI_NOTEON, 9, 0x24, 0x7f);
+            t[i++] = now + 1 * US;
+        }
+    }
+}
+
+/**
+ * Hi-hat pedal flood: CC4 every millisecond, with hi-hat hits on 8th notes at 120bpm.
+ */
+static void hihat(struct midi_event *ev, uint64_t *t, int n) {
+    for (int i = 0; i < n; i++) {
+        t[i] = (uint64_t) i * MS;
+        if (i % 250 == 0) {
+            note(&ev[i], MIDI_NOTEON, 9, (uint8_t) (i % 500 ? 0x2a : 0x2e), 0x50);
+        } else {
+            note(&ev[i], MIDI_CONTROLLER, 9, 4, (uint8_t) ((i / 4) % 128));
+        }
+    }
+}
+
+/**
+ * Note storm on all 16 channels: a NOTEON or NOTEOFF every 100us with pseudo random notes.
+ */
+static void storm(struct midi_event *ev, uint64_t *t, int n) {
+    uint32_t x = 42;
+    for (int i = 0; i < n; i++) {
+        x = x * 1103515245 + 12345;
+        uint8_t r = (uint8_t) (x >> 16);
+        note(&ev[i], (uint8_t) (r & 1 ? MIDI_NOTEON : MIDI_NOTEOFF), (uint8_t) (i % 16),
+             r & 2 ? kit[(x >> 8) % KIT_SIZE] : (uint8_t) (r & 0x7f), (uint8_t) (1 + (x >> 24) % 127));
+        t[i] = (uint64_t) i * 100 * US;
+    }
+}
+
+static const struct workload workloads[] = {
+        {"roll-32hz", roll32},
+        {"roll-60hz", roll60},
+        {"fill",      fill},
+        {"hihat-cc",  hihat},
+        {"storm-16ch", storm},
+};
+
+static int count_report(void *ctx, const uint8_t *data, size_t len) {
+    (void) ctx;
+    (void) data;
+    (void) len;
+    return 0;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Reads the CPU cycle counter, where user space can access it.
+ */
+static inline uint64_t cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Runs the events through a fresh engine, releasing the keys at their deadlines like the daemon does.
+ */
+static void run(struct engine *e, const struct keymap *km, enum report_mode mode, int repeats, struct log *log,
+                const struct midi_event *ev, const uint64_t *t, int n, struct midi_batch *batch) {
+    engine_init(e, mode, km, count_report, NULL, BENCH_BASE);
+    e->maxRepeats = (uint8_t) repeats;
+    e->log = log;
+    for (int i = 0; batch && i < n;) {
+        // everything that arrived within the same millisecond
+        batch->count = 0;
+        uint64_t window = t[i] / MS;
+        for (; i < n && t[i] / MS == window && batch->count < MIDI_BATCH_LEN; i++) {
+            midi_batch_add(batch, &ev[i]);
+        }
+        uint64_t now = BENCH_BASE + t[i - 1];
+        uint64_t next;
+        while ((next = engine_next(e)) != 0 && next <= now) {
+            engine_expire(e, next);
+        }
+        engine_batch(e, batch, 0, now);
+        if (log) {
+            log_kick(log);
+        }
+    }
+    for (int i = 0; !batch && i < n; i++) {
+        uint64_t now = BENCH_BASE + t[i];
+        uint64_t next;
+        while ((next = engine_next(e)) != 0 && next <= now) {
+            engine_expire(e, next);
+        }
+        engine_event(e, &ev[i], now);
+        if (log) {
+            log_kick(log);
+        }
+    }
+    engine_expire(e, UINT64_MAX);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[]) {
+    static struct keymap keymap;
+    static struct engine engine;
+    char *profile = NULL;
+    enum report_mode mode = REPORT_BOOT;
+    int n = 200000;
+    int runs = 7;
+    int repeats = ENGINE_MAX_REPEATS;
+    struct log log;
+    struct log *logp = NULL;
+    static struct midi_batch batch;
+    struct midi_batch *batchp = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "nlbq:m:e:r:")) != -1) {
+        switch (opt) {
+            case 'n':
+                mode = REPORT_NKRO;
+                break;
+            case 'l':
+                logp = &log;
+                break;
+            case 'b':
+                batchp = &batch;
+                break;
+            case 'q':
+                repeats = atoi(optarg);
+                break;
+            case 'm':
+                profile = optarg;
+                break;
+            case 'e':
+                n = atoi(optarg);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n] [-l] [-b] [-q repeats] [-m profile] [-e events] [-r runs]\n", argv[0]);
+                return -1;
+        }
+    }
+    if (n <= 0 || runs <= 0) {
+        return -1;
+    }
+    if (profile ? keymap_load(&keymap, profile) : keymap_load_default(&keymap)) {
+        return 4;
+    }
+    // the formatter can't keep up with the benchmark, so this measures the hot path including lost records.
+    FILE *devnull = NULL;
+    if (logp && (!(devnull = fopen("/dev/null", "w")) || log_init(logp, devnull, LOG_CAPACITY, BENCH_BASE)
+                 || log_start(logp))) {
+        return 1;
+    }
+    struct midi_event *ev = malloc(sizeof(struct midi_event) * (size_t) n);
+    uint64_t *t = malloc(sizeof(uint64_t) * (size_t) n);
+    uint64_t *ns = malloc(sizeof(uint64_t) * (size_t) runs);
+    uint64_t *cy = malloc(sizeof(uint64_t) * (size_t) runs);
+    uint64_t allocs = 0;
+
+    printf("%-11s %9s %12s %12s %9s %9s %9s %9s\n", "workload", "events", "events/s", "reports/s", "dropped",
+           "full", "ns/event", "cyc/event");
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+        workloads[w].generate(ev, t, n);
+        // warm up the caches and the branch predictors
+        run(&engine, &keymap, mode, repeats, logp, ev, t, n, batchp);
+        for (int r = 0; r < runs; r++) {
+            uint64_t a0 = alloc_count();
+            uint64_t c0 = cycles();
+            uint64_t t0 = monotonic_ns();
+            run(&engine, &keymap, mode, repeats, logp, ev, t, n, batchp);
+            ns[r] = monotonic_ns() - t0;
+            cy[r] = cycles() - c0;
+            allocs += alloc_count() - a0;
+        }
+        // the median is robust against the odd preempted run
+        qsort(ns, (size_t) runs, sizeof(uint64_t), compare_u64);
+        qsort(cy, (size_t) runs, sizeof(uint64_t), compare_u64);
+        double sec = ns[runs / 2] / 1e9;
+        const struct engine_stats *s = &engine.stats;
+        printf("%-11s %9llu %12.0f %12.0f %9llu %9llu %9.1f %9.1f\n", workloads[w].name,
+               (unsigned long long) s->events, s->events / sec, s->reports / sec,
+               (unsigned long long) s->droppedPressed, (unsigned long long) s->droppedFull,
+               ns[runs / 2] / (double) s->events, cy[runs / 2] / (double) s->events);
+    }
+    // the hot path must not allocate once the profile is loaded
+    printf("allocations in the hot path: %llu\n", (unsigned long long) allocs);
+    if (logp) {
+        log_close(logp);
+        log_dump_stats(logp, stdout);
+        fclose(devnull);
+    }
+    free(ev);
+    free(t);
+    free(ns);
+    free(cy);
+    return allocs ? 6 : 0;
+}
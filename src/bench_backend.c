@@ -0,0 +1,237 @@
+/*
+ * Compares the latency of the output backends. The reports alternately press and release the key 'a', written
+ * at least one frame apart like the output stage does. Per backend it measures how long the write takes and when
+ * the report was delivered:
+ *   hidg   - the host fetched the report: the gadget is writable again, so this includes the host poll interval.
+ *   uinput - a reader of the evdev node of the virtual keyboard got the events.
+ *   file   - delivered when written.
+ *
+ *   backend_bench [-n|-g] [-c reports] [-F frame-us] backend...
+ *
+ * eg. backend_bench /dev/hidg0 uinput file:/dev/null
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include "backend.h"
+#include "release.h"
+#include "report.h"
+
+/**
+ * Longest wait for a delivery, before the report counts as lost.
+ */
+#define DELIVERY_TIMEOUT_MS 100
+
+struct samples {
+    uint64_t *write;
+    uint64_t *delivery;
+    int count;
+    int lost;
+};
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_row(const char *name, uint64_t *v, int n, int last) {
+    if (!n) {
+        printf("%s %-12s %9s\n", last ? "└──" : "├──", name, "-");
+        return;
+    }
+    qsort(v, (size_t) n, sizeof(uint64_t), compare_u64);
+    printf("%s %-12s %9.1f %9.1f %9.1f %9.1f\n", last ? "└──" : "├──", name, v[n / 2] / 1e3, v[(size_t) (n * 0.99)] / 1e3,
+           v[(size_t) (n * 0.999)] / 1e3, v[n - 1] / 1e3);
+}
+
+/**
+ * Finds the evdev node the uinput backend created, by its name. The newest node wins, in case an older instance
+ * is still running.
+ * @return the descriptor or -1
+ */
+static int open_evdev(void) {
+    int found = -1;
+    // udev creates the node shortly after UI_DEV_CREATE
+    for (int tries = 0; tries < 20 && found < 0; tries++) {
+        DIR *dir = opendir("/dev/input");
+        struct dirent *de;
+        int best = -1;
+        while (dir && (de = readdir(dir)) != NULL) {
+            int n;
+            char path[PATH_MAX], name[64];
+            if (sscanf(de->d_name, "event%d", &n) != 1 || n < best ||
+                snprintf(path, sizeof(path), "/dev/input/%s", de->d_name) >= (int) sizeof(path)) {
+                continue;
+            }
+            int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            if (fd < 0) {
+                continue;
+            }
+            memset(name, 0, sizeof(name));
+            if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name) >= 0 && strcmp(name, "midi2hid") == 0) {
+                if (found >= 0) {
+                    close(found);
+                }
+                found = fd;
+                best = n;
+            } else {
+                close(fd);
+            }
+        }
+        if (dir) {
+            closedir(dir);
+        }
+        if (found < 0) {
+            usleep(50000);
+        }
+    }
+    return found;
+}
+
+/**
+ * Waits until the report is delivered.
+ * @param b the backend
+ * @param evdev reader of the uinput device, or -1
+ * @return 0 if it was delivered, -1 on timeout
+ */
+static int wait_delivery(struct backend *b, int evdev) {
+    if (evdev < 0 && strcmp(b->name, "hidg") != 0) {
+        // files and pipes have the report once it's written
+        return 0;
+    }
+    struct pollfd pfd = {.fd = evdev >= 0 ? evdev : b->fd, .events = evdev >= 0 ? POLLIN : POLLOUT};
+    for (;;) {
+        if (poll(&pfd, 1, DELIVERY_TIMEOUT_MS) <= 0) {
+            return -1;
+        }
+        if (evdev < 0) {
+            return 0;
+        }
+        struct input_event ev;
+        while (read(evdev, &ev, sizeof(ev)) == sizeof(ev)) {
+            if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+                return 0;
+            }
+        }
+    }
+}
+
+static int printUsage(char *bin) {
+    fprintf(stderr, "Usage: %s [-n|-g] [-c reports] [-F frame-us] backend...\n", bin);
+    return -1;
+}
+
+static int measure(const char *spec, enum report_mode mode, uint64_t frame, struct samples *s) {
+    struct backend *b = backend_open(spec, mode);
+    if (!b) {
+        return -1;
+    }
+    int evdev = -1;
+    if (strcmp(b->name, "uinput") == 0 && (evdev = open_evdev()) < 0) {
+        fprintf(stderr, "%s: evdev node not found, measuring the writes only\n", spec);
+    }
+    struct report r;
+    report_init(&r, mode);
+    s->lost = 0;
+    int n = 0;
+    uint64_t next = release_now();
+    for (int i = 0; i < s->count; i++) {
+        if (i % 2 == 0) {
+            report_press(&r, 0x04, 0);
+        } else {
+            report_release(&r, 0x04);
+        }
+        size_t len;
+        const uint8_t *data = report_next(&r, &len);
+        struct timespec ts = {.tv_sec = (time_t) (next / 1000000000ULL), .tv_nsec = (long) (next % 1000000000ULL)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+        }
+        uint64_t start = release_now();
+        ssize_t ret = b->write(b, data, len);
+        uint64_t written = release_now();
+        if (ret != (ssize_t) len) {
+            if (ret < 0 && errno != EAGAIN) {
+                perror(spec);
+                break;
+            }
+            s->lost++;
+        } else {
+            s->write[n] = written - start;
+            if (wait_delivery(b, evdev) == 0) {
+                s->delivery[n] = release_now() - start;
+                n++;
+            } else {
+                s->lost++;
+            }
+        }
+        next = release_now() + frame;
+    }
+    if (evdev >= 0) {
+        close(evdev);
+    }
+    // leave the key released
+    report_release(&r, 0x04);
+    size_t len;
+    const uint8_t *data = report_next(&r, &len);
+    if (data) {
+        b->write(b, data, len);
+    }
+    printf("%s (%s), %d reports, %d lost\n", spec, b->name, n, s->lost);
+    b->close(b);
+    printf("  (us)              p50       p99     p99.9       max\n");
+    print_row("write", s->write, n, 0);
+    print_row("delivery", s->delivery, n, 1);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    enum report_mode mode = REPORT_BOOT;
+    uint64_t frame = 2000000ULL;
+    struct samples s;
+    int opt;
+
+    memset(&s, 0, sizeof(s));
+    s.count = 2000;
+    while ((opt = getopt(argc, argv, "ngc:F:")) != -1) {
+        switch (opt) {
+            case 'n':
+                mode = REPORT_NKRO;
+                break;
+            case 'g':
+                mode = REPORT_COMPOSITE;
+                break;
+            case 'c':
+                s.count = atoi(optarg);
+                break;
+            case 'F':
+                frame = (uint64_t) atoi(optarg) * 1000;
+                break;
+            default:
+                return printUsage(argv[0]);
+        }
+    }
+    if (optind == argc || s.count <= 0) {
+        return printUsage(argv[0]);
+    }
+    s.write = malloc(sizeof(uint64_t) * (size_t) s.count);
+    s.delivery = malloc(sizeof(uint64_t) * (size_t) s.count);
+    int ret = 0;
+    for (int i = optind; i < argc; i++) {
+        if (measure(argv[i], mode, frame, &s)) {
+            ret = 1;
+        }
+    }
+    free(s.write);
+    free(s.delivery);
+    return ret;
+}
@@ -0,0 +1,318 @@
+/*
+ * Compares the per-event cost of the MIDI input backends. The raw backend is fed from a pipe or a pty,
+ * the sequencer backend from a second sequencer client, so no MIDI hardware is needed.
+ * With -w, it plays a hi-hat pedal in motion with MIDI clock and active sensing for the given time instead,
+ * and counts the wakeups of the sequencer backend with and without the event filter.
+ *
+ *   input_bench [-p] [-n events] [-w seconds]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <alsa/asoundlib.h>
+#include "input.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Fills the buffer with a drum pattern: NOTEON/NOTEOFF pairs using running status,
+ * with a MIDI clock byte in the middle of every 16th message and an active sensing byte now and then.
+ * @return the number of bytes
+ */
+static size_t pattern(uint8_t *buf, int events) {
+    static const uint8_t notes[] = {0x24, 0x26, 0x2a, 0x2e, 0x30, 0x2d, 0x31};
+    size_t len = 0;
+    buf[len++] = 0x99;
+    for (int i = 0; i < events; i++) {
+        buf[len++] = notes[i % sizeof(notes)];
+        if (i % 16 == 0) {
+            buf[len++] = 0xf8;
+        }
+        buf[len++] = (uint8_t) (i & 1 ? 0 : 0x40 + i % 0x3f);
+        if (i % 100 == 0) {
+            buf[len++] = 0xfe;
+        }
+    }
+    return len;
+}
+
+/**
+ * Reads the given number of events from the backend.
+ * @return the elapsed time in seconds or a negative value on error.
+ */
+static double consume(struct input *in, int events) {
+    struct pollfd pfds[8];
+    int n = in->poll_descriptors(in, pfds, 8);
+    struct midi_event ev;
+    int count = 0;
+    double t0 = 0;
+    while (count < events) {
+        if (poll(pfds, (nfds_t) n, 5000) <= 0) {
+            fprintf(stderr, "%s: timeout after %d events\n", in->name, count);
+            return -1;
+        }
+        int ret;
+        while ((ret = in->read(in, &ev)) > 0) {
+            if (count++ == 0) {
+                t0 = now();
+            }
+        }
+        if (ret < 0 && count < events) {
+            fprintf(stderr, "%s: error after %d events\n", in->name, count);
+            return -1;
+        }
+    }
+    return now() - t0;
+}
+
+static void report(const char *name, int events, double elapsed) {
+    if (elapsed >= 0) {
+        printf("%-12s %9d events %8.1f ns/event %10.0f events/s\n", name, events, elapsed * 1e9 / events,
+               events / elapsed);
+    }
+}
+
+static void bench_parser(int events, const uint8_t *buf, size_t len) {
+    struct midi_parser p;
+    struct midi_event ev;
+    int count = 0;
+    midi_parser_init(&p);
+    double t0 = now();
+    for (size_t i = 0; i < len; i++) {
+        count += midi_parse(&p, buf[i], &ev);
+    }
+    report("parser", count, now() - t0);
+    if (count != events) {
+        fprintf(stderr, "parser: expected %d events, got %d\n", events, count);
+    }
+}
+
+static void bench_raw(int events, const uint8_t *buf, size_t len, int pty) {
+    int wfd;
+    char dev[64];
+    if (pty) {
+        int master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master < 0 || grantpt(master) || unlockpt(master)) {
+            perror("pty");
+            return;
+        }
+        snprintf(dev, sizeof(dev), "%s", ptsname(master));
+        wfd = master;
+    } else {
+        int fds[2];
+        if (pipe(fds)) {
+            perror("pipe");
+            return;
+        }
+        snprintf(dev, sizeof(dev), "/proc/self/fd/%d", fds[0]);
+        wfd = fds[1];
+    }
+    struct input *in = input_raw_open(dev);
+    if (!in) {
+        return;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        // write in chunks like a USB MIDI device would deliver them
+        for (size_t pos = 0; pos < len;) {
+            size_t n = len - pos < 64 ? len - pos : 64;
+            ssize_t w = write(wfd, buf + pos, n);
+            if (w < 0) {
+                _exit(1);
+            }
+            pos += (size_t) w;
+        }
+        // keep the pty open until the reader is done
+        pause();
+        _exit(0);
+    }
+    double elapsed = consume(in, events);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    report(pty ? "raw (pty)" : "raw (pipe)", events, elapsed);
+    in->close(in);
+    close(wfd);
+}
+
+static void bench_seq(int events) {
+    snd_seq_t *seq;
+    if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_OUTPUT, 0) < 0) {
+        printf("%-12s not available\n", "seq");
+        return;
+    }
+    snd_seq_set_client_name(seq, "midi2hid-bench");
+    int port = snd_seq_create_simple_port(seq, "bench:out", SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+                                          SND_SEQ_PORT_TYPE_APPLICATION);
+    static const char *const patterns[] = {"midi2hid-bench"};
+    struct input *in = input_seq_open(patterns, 1);
+    if (!in) {
+        return;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        snd_seq_event_t ev;
+        for (int i = 0; i < events; i++) {
+            snd_seq_ev_clear(&ev);
+            snd_seq_ev_set_source(&ev, port);
+            snd_seq_ev_set_subs(&ev);
+            snd_seq_ev_set_direct(&ev);
+            snd_seq_ev_set_noteon(&ev, 9, 0x24, i & 1 ? 0 : 0x40);
+            while (snd_seq_event_output_direct(seq, &ev) == -EAGAIN) {
+            }
+        }
+        pause();
+        _exit(0);
+    }
+    double elapsed = consume(in, events);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    report("seq", events, elapsed);
+    in->close(in);
+    snd_seq_close(seq);
+}
+
+/**
+ * Events per second of the pedal scenario: a hi-hat pedal moving up and down, MIDI clock at 120bpm,
+ * active sensing every 300ms and a note every 250ms.
+ */
+#define PEDAL_CC_RATE 250
+#define CLOCK_RATE 48
+
+/**
+ * Plays the pedal scenario on the port until killed.
+ */
+static void play_pedal(snd_seq_t *seq, int port) {
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    snd_seq_event_t ev;
+    for (unsigned ms = 0;; ms++) {
+        snd_seq_ev_clear(&ev);
+        snd_seq_ev_set_source(&ev, port);
+        snd_seq_ev_set_subs(&ev);
+        snd_seq_ev_set_direct(&ev);
+        if (ms % (1000 / PEDAL_CC_RATE) == 0) {
+            // triangle from open to closed and back within a second
+            unsigned phase = ms % 1000;
+            int value = (int) (phase < 500 ? phase * 127 / 500 : (1000 - phase) * 127 / 500);
+            snd_seq_ev_set_controller(&ev, 9, 4, value);
+            snd_seq_event_output_direct(seq, &ev);
+        }
+        if (ms % (1000 / CLOCK_RATE) == 0) {
+            ev.type = SND_SEQ_EVENT_CLOCK;
+            snd_seq_event_output_direct(seq, &ev);
+        }
+        if (ms % 300 == 0) {
+            ev.type = SND_SEQ_EVENT_SENSING;
+            snd_seq_event_output_direct(seq, &ev);
+        }
+        if (ms % 250 == 0) {
+            snd_seq_ev_set_noteon(&ev, 9, 0x2c, 0x40);
+            snd_seq_event_output_direct(seq, &ev);
+        }
+        next.tv_nsec += 1000000;
+        if (next.tv_nsec >= 1000000000) {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+}
+
+/**
+ * Counts the wakeups and the delivered events of the sequencer backend during the pedal scenario.
+ * @param types event filter, or 0 for none
+ */
+static void bench_wakeups(const char *name, unsigned types, int seconds) {
+    snd_seq_t *seq;
+    if (snd_seq_open(&seq, "default", SND_SEQ_OPEN_OUTPUT, 0) < 0) {
+        printf("%-12s not available\n", name);
+        return;
+    }
+    snd_seq_set_client_name(seq, "midi2hid-bench");
+    int port = snd_seq_create_simple_port(seq, "bench:out", SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+                                          SND_SEQ_PORT_TYPE_APPLICATION);
+    static const char *const patterns[] = {"midi2hid-bench"};
+    struct input *in = input_seq_open(patterns, 1);
+    if (!in) {
+        return;
+    }
+    if (types && in->filter(in, types)) {
+        in->close(in);
+        return;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        play_pedal(seq, port);
+        _exit(0);
+    }
+    struct pollfd pfds[8];
+    int n = in->poll_descriptors(in, pfds, 8);
+    struct midi_event ev;
+    unsigned long wakeups = 0;
+    unsigned long events = 0;
+    double t0 = now();
+    double end = t0 + seconds;
+    for (double t = t0; t < end; t = now()) {
+        if (poll(pfds, (nfds_t) n, (int) ((end - t) * 1000) + 1) <= 0) {
+            continue;
+        }
+        wakeups++;
+        while (in->read(in, &ev) > 0) {
+            events++;
+        }
+    }
+    double elapsed = now() - t0;
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    printf("%-12s %8.1f wakeups/s %8.1f events/s\n", name, wakeups / elapsed, events / elapsed);
+    in->close(in);
+    snd_seq_close(seq);
+}
+
+int main(int argc, char *argv[]) {
+    int events = 100000;
+    int pty = 0;
+    int seconds = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "pn:w:")) != -1) {
+        switch (opt) {
+            case 'p':
+                pty = 1;
+                break;
+            case 'n':
+                events = atoi(optarg);
+                break;
+            case 'w':
+                seconds = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-p] [-n events] [-w seconds]\n", argv[0]);
+                return -1;
+        }
+    }
+    if (seconds > 0) {
+        unsigned notes = MIDI_TYPE_BIT(MIDI_NOTEON) | MIDI_TYPE_BIT(MIDI_NOTEOFF);
+        bench_wakeups("unfiltered", 0, seconds);
+        bench_wakeups("notes+cc", notes | MIDI_TYPE_BIT(MIDI_CONTROLLER), seconds);
+        bench_wakeups("notes", notes, seconds);
+        return 0;
+    }
+    uint8_t *buf = malloc((size_t) events * 4 + 1);
+    size_t len = pattern(buf, events);
+
+    bench_parser(events, buf, len);
+    bench_raw(events, buf, len, pty);
+    bench_seq(events);
+    free(buf);
+    return 0;
+}
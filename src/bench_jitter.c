@@ -0,0 +1,222 @@
+/*
+ * Measures the wake-up jitter of the event path in normal and real-time mode under synthetic CPU and IO load.
+ * A thread wakes every millisecond like the release timer does, feeds a hit to the engine and measures how late
+ * it woke up and how long the hit took.
+ *
+ *   jitter_bench [-p priority] [-c cpu] [-d seconds] [-l load-threads]
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "engine.h"
+#include "keymap.h"
+#include "rt.h"
+
+#define PERIOD_NS 1000000ULL
+
+struct load {
+    pthread_t threads[64];
+    int count;
+    int stop;
+    char path[64];
+};
+
+struct jitter {
+    const struct keymap *keymap;
+    int priority;
+    int cpu;
+    int samples;
+
+    /**
+     * Wake up latency of each period in ns.
+     */
+    uint64_t *wake;
+
+    /**
+     * Processing time of each hit in ns.
+     */
+    uint64_t *work;
+    int rt;
+};
+
+static int null_report(void *ctx, const uint8_t *data, size_t len) {
+    (void) ctx;
+    (void) data;
+    (void) len;
+    return 0;
+}
+
+static void *cpu_load(void *arg) {
+    struct load *l = arg;
+    volatile uint64_t x = 1;
+    while (!__atomic_load_n(&l->stop, __ATOMIC_RELAXED)) {
+        for (int i = 0; i < 100000; i++) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        }
+    }
+    return NULL;
+}
+
+static void *io_load(void *arg) {
+    struct load *l = arg;
+    static char buf[64 * 1024];
+    memset(buf, 0x5a, sizeof(buf));
+    int fd = open(l->path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        perror(l->path);
+        return NULL;
+    }
+    while (!__atomic_load_n(&l->stop, __ATOMIC_RELAXED)) {
+        for (int i = 0; i < 16; i++) {
+            if (write(fd, buf, sizeof(buf)) < 0) {
+                break;
+            }
+        }
+        fsync(fd);
+        lseek(fd, 0, SEEK_SET);
+    }
+    close(fd);
+    return NULL;
+}
+
+static void load_start(struct load *l, int threads) {
+    memset(l, 0, sizeof(*l));
+    snprintf(l->path, sizeof(l->path), "/tmp/jitter_bench.%d", (int) getpid());
+    if (threads > 63) {
+        threads = 63;
+    }
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&l->threads[l->count], NULL, cpu_load, l) == 0) {
+            l->count++;
+        }
+    }
+    if (pthread_create(&l->threads[l->count], NULL, io_load, l) == 0) {
+        l->count++;
+    }
+}
+
+static void load_stop(struct load *l) {
+    __atomic_store_n(&l->stop, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < l->count; i++) {
+        pthread_join(l->threads[i], NULL);
+    }
+    unlink(l->path);
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void *event_path(void *arg) {
+    struct jitter *j = arg;
+    struct engine engine;
+    if (j->rt) {
+        if (rt_lock_memory(RT_STACK_PREFAULT) || rt_enter(j->priority, j->cpu)) {
+            fprintf(stderr, "real-time mode not available, measuring with normal scheduling\n");
+        }
+    }
+    uint64_t next = monotonic_ns() + PERIOD_NS;
+    engine_init(&engine, REPORT_BOOT, j->keymap, null_report, NULL, next);
+    struct midi_event ev = {.type = MIDI_NOTEON, .channel = 9, .note = 0x26, .value = 0x60};
+    for (int i = 0; i < j->samples; i++) {
+        struct timespec ts = {.tv_sec = (time_t) (next / 1000000000ULL), .tv_nsec = (long) (next % 1000000000ULL)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+        }
+        uint64_t now = monotonic_ns();
+        engine_expire(&engine, now);
+        engine_event(&engine, &ev, now);
+        j->wake[i] = now - next;
+        j->work[i] = monotonic_ns() - now;
+        next += PERIOD_NS;
+    }
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_row(const char *name, uint64_t *v, int n, int last) {
+    qsort(v, (size_t) n, sizeof(uint64_t), compare_u64);
+    printf("%s %-12s %9.1f %9.1f %9.1f %9.1f\n", last ? "└──" : "├──", name, v[n / 2] / 1e3, v[(size_t) (n * 0.99)] / 1e3,
+           v[(size_t) (n * 0.999)] / 1e3, v[n - 1] / 1e3);
+}
+
+static int measure(struct jitter *j, int threads) {
+    struct load load;
+    pthread_t t;
+    load_start(&load, threads);
+    // the event path runs on its own thread, so the real-time settings don't leak into the next run.
+    int ret = pthread_create(&t, NULL, event_path, j);
+    if (!ret) {
+        pthread_join(t, NULL);
+    }
+    load_stop(&load);
+    if (ret) {
+        perror("pthread_create");
+        return -1;
+    }
+    printf("%s (us)           p50       p99     p99.9       max\n", j->rt ? "Real-time" : "Normal   ");
+    print_row("wake-up", j->wake, j->samples, 0);
+    print_row("hit", j->work, j->samples, 1);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static struct keymap keymap;
+    struct jitter j;
+    int seconds = 10;
+    int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    memset(&j, 0, sizeof(j));
+    j.priority = RT_DEFAULT_PRIORITY;
+    j.cpu = -1;
+    while ((opt = getopt(argc, argv, "p:c:d:l:")) != -1) {
+        switch (opt) {
+            case 'p':
+                j.priority = atoi(optarg);
+                break;
+            case 'c':
+                j.cpu = atoi(optarg);
+                break;
+            case 'd':
+                seconds = atoi(optarg);
+                break;
+            case 'l':
+                threads = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-p priority] [-c cpu] [-d seconds] [-l load-threads]\n", argv[0]);
+                return -1;
+        }
+    }
+    if (seconds <= 0 || keymap_load_default(&keymap)) {
+        return -1;
+    }
+    j.keymap = &keymap;
+    j.samples = seconds * (int) (1000000000ULL / PERIOD_NS);
+    j.wake = malloc(sizeof(uint64_t) * (size_t) j.samples);
+    j.work = malloc(sizeof(uint64_t) * (size_t) j.samples);
+    printf("%d samples per mode, %d CPU load threads and 1 IO load thread\n", j.samples, threads);
+
+    if (measure(&j, threads)) {
+        return 1;
+    }
+    j.rt = 1;
+    if (measure(&j, threads)) {
+        return 1;
+    }
+    free(j.wake);
+    free(j.work);
+    return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Microbenchmark of the note lookup: compiled keymap vs. the former linear mapping scan.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "keymap.h"
+
+#define ITERATIONS 10000000
+
+/**
+ * The former mapping table and lookup, kept here as the baseline.
+ */
+struct mapping_t {
+    const uint8_t note;
+    const char *key;
+    uint8_t hidKey;
+};
+
+static struct mapping_t mapping[] = {
+        {.note = 0x24, .key = "--spacebar"},
+        {.note = 0x2e, .key = "w"},
+        {.note = 0x1a, .key = "w"},
+        {.note = 0x2a, .key = "w"},
+        {.note = 0x16, .key = "w"},
+        {.note = 0x30, .key = "y"},
+        {.note = 0x31, .key = "y"},
+        {.note = 0x37, .key = "y"},
+        {.note = 0x2d, .key = "h"},
+        {.note = 0x2b, .key = "--return"},
+        {.note = 0x33, .key = "y"},
+        {.note = 0x3b, .key = "y"},
+        {.note = 0x26, .key = "s"},
+        {.note = 0x28, .key = "s"},
+        {.key = NULL}
+};
+
+static struct mapping_t *findMap(uint8_t note) {
+    for (int i = 0; mapping[i].key; i++) {
+        if (mapping[i].note == note) {
+            return &mapping[i];
+        }
+    }
+    return NULL;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    static struct keymap km;
+    static uint8_t notes[4096];
+    static uint8_t vels[4096];
+
+    if (argc > 1 ? keymap_load(&km, argv[1]) : keymap_load_default(&km)) {
+        return 1;
+    }
+    for (int i = 0; mapping[i].key; i++) {
+        mapping[i].hidKey = mapKey(mapping[i].key);
+    }
+
+    // mix of mapped pad notes and unmapped notes, like a real kit with some unused pads.
+    srand(42);
+    for (int i = 0; i < 4096; i++) {
+        notes[i] = rand() % 4 ? mapping[rand() % 14].note : (uint8_t) (rand() % 128);
+        vels[i] = (uint8_t) (1 + rand() % 127);
+    }
+
+    unsigned long sum = 0;
+    double t0 = now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        uint8_t v = vels[i & 4095];
+        struct mapping_t *map = findMap(notes[i & 4095]);
+        if (map && v >= DEFAULT_MIN_VELOCITY) {
+            sum += map->hidKey;
+        }
+    }
+    double linear = now() - t0;
+
+    t0 = now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        const struct action *a = keymap_lookup(&km, 9, notes[i & 4095], vels[i & 4095]);
+        if (a) {
+            sum -= a->key;
+        }
+    }
+    double table = now() - t0;
+
+    printf("lookups:        %d\n", ITERATIONS);
+    printf("linear findMap: %6.2f ns/lookup\n", linear * 1e9 / ITERATIONS);
+    printf("keymap table:   %6.2f ns/lookup\n", table * 1e9 / ITERATIONS);
+    printf("checksum:       %lu\n", sum);
+    return sum != 0;
+}
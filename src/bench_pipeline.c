@@ -0,0 +1,366 @@
+/*
+ * Compares the per-kit latency of the single threaded event loop and of pipeline mode, as kits are added. Every
+ * kit is a synthetic MIDI source (a pipe fed by a generator thread) and a HID function whose write blocks for a
+ * while, like a gadget write that waits for the host or a uinput write that wakes up the readers. All kits play
+ * a hit at about the same time, so in the single threaded loop the writes of the kits queue up behind each other,
+ * while in pipeline mode every HID function has its own writer thread.
+ *
+ * The latency is the time from the generator writing the NOTEON to the backend receiving the key press.
+ *
+ *   pipeline_bench [-k kits] [-c hits] [-i interval-ms] [-s write-us] [-F frame-us] [-p priority]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "engine.h"
+#include "input.h"
+#include "keymap.h"
+#include "pipeline.h"
+#include "release.h"
+
+#define MAX_KITS 8
+#define MAX_HITS 10000
+
+#define MS 1000000ULL
+#define US 1000ULL
+
+/**
+ * Time after the last hit until the generator closes the sources, so that every key is released.
+ */
+#define DRAIN_MS 100
+
+/**
+ * MIDI source of a kit: the generator writes events into the pipe.
+ */
+struct synth {
+    struct input in;
+    int fd[2];
+    uint8_t kit;
+};
+
+/**
+ * HID function of a kit, that records when the key presses arrive.
+ */
+struct slow {
+    struct backend b;
+    int kit;
+    int presses;
+};
+
+static struct synth synths[MAX_KITS];
+static struct slow slows[MAX_KITS];
+static struct source sources[MAX_KITS];
+static struct writer writers[MAX_KITS];
+static struct output outs[MAX_KITS];
+static struct engine engines[MAX_KITS];
+static struct keymap keymap;
+
+static uint64_t sent[MAX_KITS][MAX_HITS];
+static uint64_t latency[MAX_KITS * MAX_HITS];
+static int numLatency;
+
+static int kits;
+static int hits = 100;
+static uint64_t interval = 25 * MS;
+static uint64_t writeCost = 250 * US;
+static uint64_t frame = OUTPUT_FRAME_NS;
+static int priority = 0;
+
+static int synth_poll(struct input *in, struct pollfd *pfds, int max) {
+    struct synth *s = (struct synth *) in;
+    if (max < 1) {
+        return 0;
+    }
+    pfds[0].fd = s->fd[0];
+    pfds[0].events = POLLIN;
+    return 1;
+}
+
+static int synth_read(struct input *in, struct midi_event *ev) {
+    struct synth *s = (struct synth *) in;
+    ssize_t n = read(s->fd[0], ev, sizeof(*ev));
+    if (n == sizeof(*ev)) {
+        return 1;
+    }
+    // EOF: the generator is done
+    return n < 0 && errno == EAGAIN ? 0 : -1;
+}
+
+static void synth_close(struct input *in) {
+    close(((struct synth *) in)->fd[0]);
+}
+
+static int synth_open(struct synth *s, uint8_t kit) {
+    memset(s, 0, sizeof(*s));
+    s->in.name = "synth";
+    s->in.poll_descriptors = synth_poll;
+    s->in.read = synth_read;
+    s->in.close = synth_close;
+    s->kit = kit;
+    if (pipe2(s->fd, O_CLOEXEC) < 0 || fcntl(s->fd[0], F_SETFL, O_NONBLOCK) < 0) {
+        perror("pipe");
+        return -1;
+    }
+    return 0;
+}
+
+static void sleep_until(uint64_t t) {
+    struct timespec ts = {.tv_sec = (time_t) (t / 1000000000ULL), .tv_nsec = (long) (t % 1000000000ULL)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static ssize_t slow_write(struct backend *b, const uint8_t *data, size_t len) {
+    struct slow *s = (struct slow *) b;
+    uint64_t now = release_now();
+    // boot layout: the key slots follow the modifiers and the reserved byte
+    if (len > 2 && data[2] && s->presses < hits) {
+        latency[__atomic_fetch_add(&numLatency, 1, __ATOMIC_RELAXED)] = now - sent[s->kit][s->presses++];
+    }
+    sleep_until(now + writeCost);
+    return (ssize_t) len;
+}
+
+static void slow_close(struct backend *b) {
+    (void) b;
+}
+
+/**
+ * Plays the hits on all kits, a few 100us apart, and closes the sources after the last one.
+ */
+static void *generate(void *arg) {
+    (void) arg;
+    uint32_t x = 42;
+    uint64_t start = release_now() + 10 * MS;
+    for (int i = 0; i < hits; i++) {
+        for (int k = 0; k < kits; k++) {
+            x = x * 1103515245 + 12345;
+            sleep_until(start + (uint64_t) i * interval + (x >> 16) % 500 * US);
+            struct midi_event ev = {.type = MIDI_NOTEON, .channel = 9, .note = 0x26, .value = 0x60,
+                                    .device = (uint8_t) k};
+            sent[k][i] = release_now();
+            if (write(synths[k].fd[1], &ev, sizeof(ev)) != sizeof(ev)) {
+                perror("generator");
+            }
+        }
+    }
+    sleep_until(release_now() + DRAIN_MS * MS);
+    for (int k = 0; k < kits; k++) {
+        close(synths[k].fd[1]);
+    }
+    return NULL;
+}
+
+static int submit_report(void *ctx, const uint8_t *data, size_t len) {
+    writer_submit(ctx, data, len);
+    return 0;
+}
+
+static int send_report(void *ctx, const uint8_t *data, size_t len) {
+    return output_submit(ctx, data, len, release_now()) ? 5 : 0;
+}
+
+static void arm(int tfd, uint64_t next) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = (time_t) (next / 1000000000ULL);
+    its.it_value.tv_nsec = (long) (next % 1000000000ULL);
+    timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/**
+ * Runs the event loop like the daemon does, single threaded or in pipeline mode, until the generator is done.
+ * @return 0 on success
+ */
+static int run(int piped) {
+    static struct midi_batch batch;
+    struct pollfd pfds[1 + MAX_KITS];
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tfd < 0) {
+        perror("timerfd");
+        return -1;
+    }
+    numLatency = 0;
+    for (int k = 0; k < kits; k++) {
+        struct slow *s = &slows[k];
+        memset(s, 0, sizeof(*s));
+        s->b.name = "slow";
+        s->b.fd = -1;
+        s->b.write = slow_write;
+        s->b.close = slow_close;
+        s->kit = k;
+        if (synth_open(&synths[k], (uint8_t) k)) {
+            return -1;
+        }
+        if (piped) {
+            if (source_start(&sources[k], &synths[k].in, (uint8_t) k, priority, -1) ||
+                writer_start(&writers[k], &s->b, REPORT_BOOT, frame, NULL, priority, -1)) {
+                return -1;
+            }
+            source_live(&sources[k]);
+            engine_init(&engines[k], REPORT_BOOT, &keymap, submit_report, &writers[k], release_now());
+            pfds[1 + k].fd = sources[k].events.fd;
+        } else {
+            output_init(&outs[k], &s->b, REPORT_BOOT, frame);
+            engine_init(&engines[k], REPORT_BOOT, &keymap, send_report, &outs[k], release_now());
+            pfds[1 + k].fd = synths[k].fd[0];
+        }
+        pfds[1 + k].events = POLLIN;
+    }
+    pfds[0].fd = tfd;
+    pfds[0].events = POLLIN;
+
+    pthread_t generator;
+    if (pthread_create(&generator, NULL, generate, NULL)) {
+        perror("generator");
+        return -1;
+    }
+    uint64_t armed = 0;
+    for (int live = kits; live;) {
+        if (poll(pfds, (nfds_t) (1 + kits), -1) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        for (int k = 0; k < kits; k++) {
+            if (pfds[1 + k].fd < 0) {
+                continue;
+            }
+            if (piped && (pfds[1 + k].revents & POLLIN)) {
+                ring_clear(&sources[k].events);
+            }
+            int ret;
+            while ((ret = piped ? source_drain(&sources[k], &batch) : input_drain(&synths[k].in, &batch)) > 0) {
+                engine_batch(&engines[k], &batch, (uint8_t) k, release_now());
+                if (ret < MIDI_BATCH_LEN) {
+                    break;
+                }
+            }
+            if (ret < 0) {
+                pfds[1 + k].fd = -1;
+                live--;
+            }
+        }
+        if (pfds[0].revents & POLLIN) {
+            uint64_t expirations;
+            if (read(tfd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                uint64_t now = release_now();
+                for (int k = 0; k < kits; k++) {
+                    engine_expire(&engines[k], now);
+                    if (!piped) {
+                        output_flush(&outs[k], now);
+                    }
+                }
+                armed = 0;
+            }
+        }
+        uint64_t next = 0;
+        for (int k = 0; k < kits; k++) {
+            uint64_t due = engine_next(&engines[k]);
+            if (due && (!next || due < next)) {
+                next = due;
+            }
+            if (piped) {
+                ring_kick(&writers[k].reports);
+                continue;
+            }
+            due = output_next(&outs[k]);
+            if (due && (!next || due < next)) {
+                next = due;
+            }
+        }
+        if (next != armed) {
+            arm(tfd, next);
+            armed = next;
+        }
+    }
+    pthread_join(generator, NULL);
+    for (int k = 0; k < kits; k++) {
+        if (piped) {
+            writer_stop(&writers[k]);
+            source_stop(&sources[k]);
+        } else {
+            synths[k].in.close(&synths[k].in);
+        }
+    }
+    close(tfd);
+    return 0;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void print_row(const char *name, int last) {
+    uint64_t *v = latency;
+    int n = numLatency;
+    if (!n) {
+        printf("%s %-12s %9s\n", last ? "└──" : "├──", name, "-");
+        return;
+    }
+    qsort(v, (size_t) n, sizeof(uint64_t), compare_u64);
+    printf("%s %-12s %9.1f %9.1f %9.1f %9d\n", last ? "└──" : "├──", name, v[n / 2] / 1e3,
+           v[(size_t) (n * 0.99)] / 1e3, v[n - 1] / 1e3, hits * kits - n);
+}
+
+int main(int argc, char *argv[]) {
+    int maxKits = 4;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:c:i:s:F:p:")) != -1) {
+        switch (opt) {
+            case 'k':
+                maxKits = atoi(optarg);
+                break;
+            case 'c':
+                hits = atoi(optarg);
+                break;
+            case 'i':
+                interval = (uint64_t) atoi(optarg) * MS;
+                break;
+            case 's':
+                writeCost = (uint64_t) atoi(optarg) * US;
+                break;
+            case 'F':
+                frame = (uint64_t) atoi(optarg) * US;
+                break;
+            case 'p':
+                priority = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-k kits] [-c hits] [-i interval-ms] [-s write-us] [-F frame-us] "
+                                "[-p priority]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (maxKits < 1 || maxKits > MAX_KITS || hits < 1 || hits > MAX_HITS) {
+        fprintf(stderr, "1-%d kits, 1-%d hits\n", MAX_KITS, MAX_HITS);
+        return 1;
+    }
+    if (keymap_load_default(&keymap)) {
+        return 1;
+    }
+    printf("%d hits per kit, every %llums, %lluus per write\n\n", hits, (unsigned long long) (interval / MS),
+           (unsigned long long) (writeCost / US));
+    printf("    %-12s %9s %9s %9s %9s\n", "kits (us)", "median", "p99", "max", "lost");
+    for (kits = 1; kits <= maxKits; kits++) {
+        printf("%d\n", kits);
+        if (run(0)) {
+            return 2;
+        }
+        print_row("single", 0);
+        if (run(1)) {
+            return 2;
+        }
+        print_row("pipeline", 1);
+    }
+    return 0;
+}
@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "boot.h"
+#include "release.h"
+
+static const char *const stepNames[BOOT_STEPS] = {
+        "profiles",
+        "midi input",
+        "hid functions",
+        "usb configured",
+        "midi device",
+};
+
+void boot_init(struct boot *b) {
+    memset(b, 0, sizeof(*b));
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    b->started = release_now();
+    uint64_t boot = (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+    b->offset = boot > b->started ? boot - b->started : 0;
+}
+
+void boot_mark(struct boot *b, enum boot_step step, uint64_t now) {
+    if (!b->done[step]) {
+        b->done[step] = now;
+    }
+}
+
+int boot_ready(const struct boot *b) {
+    for (int i = 0; i < BOOT_STEPS; i++) {
+        if (!b->done[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void boot_dump(const struct boot *b, FILE *out) {
+    fprintf(out, "Boot (ms)          since boot  since start\n");
+    fprintf(out, "├── %-16s %10.1f %12.1f\n", "started", (b->started + b->offset) / 1e6, 0.0);
+    for (int i = 0; i < BOOT_STEPS; i++) {
+        const char *branch = i == BOOT_STEPS - 1 ? "└──" : "├──";
+        if (!b->done[i]) {
+            fprintf(out, "%s %-16s %10s %12s\n", branch, stepNames[i], "-", "-");
+            continue;
+        }
+        fprintf(out, "%s %-16s %10.1f %12.1f\n", branch, stepNames[i], (b->done[i] + b->offset) / 1e6,
+                (b->done[i] - b->started) / 1e6);
+    }
+}
+
+/**
+ * Waits for the descriptors.
+ * @return 1 if {@code fd} is readable, 0 on timeout, -1 if the wait was aborted
+ */
+static int wait_fd(int fd, short events, int cancelFd, int timeout) {
+    struct pollfd pfds[2] = {{.fd = fd, .events = events}, {.fd = cancelFd, .events = POLLIN}};
+    int ret = poll(pfds, 2, timeout);
+    if (ret < 0 && errno != EINTR) {
+        return -1;
+    }
+    if (ret > 0 && pfds[1].revents) {
+        return -1;
+    }
+    return ret > 0 && pfds[0].revents ? 1 : 0;
+}
+
+int boot_wait_path(const char *path, int cancelFd) {
+    if (access(path, F_OK) == 0) {
+        return 0;
+    }
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    if (!slash) {
+        strcpy(dir, ".");
+    } else if (slash == path) {
+        strcpy(dir, "/");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int) (slash - path), path);
+    }
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd >= 0 && inotify_add_watch(fd, dir, IN_CREATE | IN_MOVED_TO | IN_ATTRIB) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    printf("waiting for %s\n", path);
+    // also checked once after the watch was added, the file may have been created in between
+    while (access(path, F_OK) != 0) {
+        int ret = wait_fd(fd, POLLIN, cancelFd, fd < 0 ? 100 : -1);
+        if (ret < 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+        char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        while (ret > 0 && read(fd, events, sizeof(events)) > 0) {
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return 0;
+}
+
+const char *boot_find_udc(char *buf, size_t len) {
+    DIR *dir = opendir(BOOT_UDC_CLASS);
+    struct dirent *de;
+    int found = 0;
+    while (dir && (de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(buf, len, "%s", de->d_name);
+        found++;
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    return found == 1 ? buf : NULL;
+}
+
+int boot_wait_udc(const char *udc, int cancelFd) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s/state", BOOT_UDC_CLASS, udc);
+    int waiting = 0;
+    for (;;) {
+        char state[32] = "";
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            ssize_t n = read(fd, state, sizeof(state) - 1);
+            state[n > 0 ? n : 0] = 0;
+        }
+        if (strncmp(state, "configured", 10) == 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return 0;
+        }
+        if (!waiting++) {
+            printf("waiting for the USB host to configure %s\n", udc);
+        }
+        // sysfs wakes up the readers with POLLPRI when the state changes
+        int ret = wait_fd(fd, POLLPRI, cancelFd, BOOT_UDC_RETRY_MS);
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (ret < 0) {
+            return -1;
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef MIDI2HID_BOOT_H
+#define MIDI2HID_BOOT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Start-up of the daemon on power-up: instead of failing on a gadget or kit that isn't there yet, it compiles the
+ * profiles, waits for the HID functions and the USB host, and goes live the moment everything exists. The time
+ * each step finished is kept for the boot-to-ready breakdown.
+ */
+
+/**
+ * Class directory of the USB device controllers, which the gadget is bound to.
+ */
+#define BOOT_UDC_CLASS "/sys/class/udc"
+
+/**
+ * How often the state of a UDC is read again while it doesn't notify, in ms.
+ */
+#define BOOT_UDC_RETRY_MS 100
+
+enum boot_step {
+    BOOT_PROFILES = 0,
+    BOOT_INPUT,
+    BOOT_HID,
+    BOOT_UDC,
+    BOOT_MIDI,
+    BOOT_STEPS
+};
+
+struct boot {
+    /**
+     * CLOCK_BOOTTIME minus CLOCK_MONOTONIC, to print the times since power-up.
+     */
+    uint64_t offset;
+
+    /**
+     * CLOCK_MONOTONIC time the daemon started.
+     */
+    uint64_t started;
+
+    /**
+     * CLOCK_MONOTONIC time each step finished, or 0.
+     */
+    uint64_t done[BOOT_STEPS];
+};
+
+/**
+ * Starts the breakdown.
+ */
+void boot_init(struct boot *b);
+
+/**
+ * Records that the step finished now, unless it already did.
+ */
+void boot_mark(struct boot *b, enum boot_step step, uint64_t now);
+
+/**
+ * @return 1 if every step finished
+ */
+int boot_ready(const struct boot *b);
+
+/**
+ * Prints when each step finished, since power-up and since the start of the daemon.
+ */
+void boot_dump(const struct boot *b, FILE *out);
+
+/**
+ * Waits until the file exists, eg. the node of a HID function that devtmpfs creates once the gadget is set up.
+ * The directory is watched with inotify, or checked every 100ms if it can't be watched.
+ * @param path the file
+ * @param cancelFd descriptor that aborts the wait when it becomes readable, or -1
+ * @return 0 once the file exists, -1 if the wait was aborted
+ */
+int boot_wait_path(const char *path, int cancelFd);
+
+/**
+ * Returns the UDC if there is exactly one, which is the one the gadget is bound to.
+ * @param buf receives the name
+ * @return {@code buf}, or NULL if there is no UDC or several
+ */
+const char *boot_find_udc(char *buf, size_t len);
+
+/**
+ * Waits until the USB host configured the device, ie. the state of the UDC is "configured". The kernel notifies
+ * readers of the state attribute on a change; the state is also read again every BOOT_UDC_RETRY_MS, in case the
+ * UDC isn't there yet.
+ * @param udc name of the UDC, see BOOT_UDC_CLASS
+ * @param cancelFd descriptor that aborts the wait when it becomes readable, or -1
+ * @return 0 once configured, -1 if the wait was aborted
+ */
+int boot_wait_udc(const char *udc, int cancelFd);
+
+#endif //MIDI2HID_BOOT_H
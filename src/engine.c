@@ -0,0 +1,625 @@
+#include <stdio.h>
+#include <string.h>
+#include "engine.h"
+#include "latency.h"
+
+void engine_init(struct engine *e, enum report_mode mode, const struct keymap *km, engine_sink send, void *ctx,
+                 uint64_t now) {
+    memset(e, 0, sizeof(*e));
+    e->keymap = km;
+    e->send = send;
+    e->ctx = ctx;
+    e->maxRepeats = ENGINE_MAX_REPEATS;
+    e->repeatGap = ENGINE_REPEAT_GAP_NS;
+    memset(e->cc, 0xff, sizeof(e->cc));
+    report_init(&e->report, mode);
+    release_init(&e->wheel, now);
+    release_init(&e->macroWheel, now);
+    release_init(&e->chordWheel, now);
+}
+
+/**
+ * Sends every report that changed, keyboard first.
+ */
+static int send_report(struct engine *e) {
+    const uint8_t *data;
+    size_t len;
+    int ret = 0;
+    while ((data = report_next(&e->report, &len))) {
+        e->stats.reports++;
+        if (e->log) {
+            log_write(e->log, LOG_SEND, e->now, 0, 0, 0, data, len);
+        }
+        int err = e->send(e->ctx, data, len);
+        if (err) {
+            ret = err;
+        }
+    }
+    return ret;
+}
+
+/**
+ * Processes a MIDI event.
+ * @param ev the event
+ * @return the note of a NOTEON event or -1. Note 0 is a note like any other.
+ */
+static int midi_process(const struct engine *e, const struct midi_event *ev) {
+    if (e->log) {
+        enum log_type type = ev->type == MIDI_NOTEON ? LOG_NOTEON
+                : ev->type == MIDI_NOTEOFF ? LOG_NOTEOFF
+                : ev->type == MIDI_CONTROLLER ? LOG_CONTROL
+                : LOG_UNKNOWN;
+        log_write(e->log, type, e->now, ev->channel, ev->note, ev->value, NULL, 0);
+    }
+    if (ev->type == MIDI_NOTEON && ev->value) {
+        return ev->note & 0x7f;
+    }
+    return -1;
+}
+
+/**
+ * Returns the note of a NOTEOFF event. A NOTEON with zero velocity counts as NOTEOFF, too.
+ * @param ev the event
+ * @return the note or -1.
+ */
+static int midi_note_off(const struct midi_event *ev) {
+    if (ev->type == MIDI_NOTEOFF || (ev->type == MIDI_NOTEON && ev->value == 0)) {
+        return ev->note & 0x7f;
+    }
+    return -1;
+}
+
+/**
+ * Finds the action for the given note. This is a single table load unless the note has velocity layers.
+ */
+static inline const struct action *findMap(const struct engine *e, uint8_t channel, uint8_t note, uint8_t velocity) {
+    return keymap_lookup(e->keymap, channel, note, velocity);
+}
+
+/**
+ * Queues a hit on a key that is still pressed (or waits for its re-press). The first one releases the key
+ * right away, the press follows after the repeat gap.
+ */
+static int retrigger(struct engine *e, const struct action *map, uint8_t mods, uint8_t channel, uint64_t hold,
+                     uint64_t now) {
+    struct engine_repeat *r = &e->repeat[map->key];
+    if (r->queued >= e->maxRepeats) {
+        e->stats.droppedPressed++;
+        if (e->log) {
+            log_write(e->log, LOG_PRESSED, now, channel, map->key, 0, NULL, 0);
+        }
+        return 0;
+    }
+    e->stats.repeats++;
+    r->mods = mods;
+    r->hold = hold;
+    r->noteOff = 0;
+    r->queued++;
+    if (e->log) {
+        log_write(e->log, LOG_REPEAT, now, channel, map->key, r->queued, NULL, 0);
+    }
+    if (r->waiting || r->queued > 1) {
+        // a press is scheduled already, this one follows it
+        return 0;
+    }
+    r->waiting = 1;
+    report_release(&e->report, map->key);
+    release_schedule(&e->wheel, map->key, now + e->repeatGap);
+    return send_report(e);
+}
+
+/**
+ * Runs the steps of a macro until it waits or ends. Every change is sent as a report of its own, so the host sees
+ * each step even if the steps don't wait in between.
+ * @param slot index of the runner
+ */
+static int run_macro(struct engine *e, int slot, uint64_t now) {
+    struct engine_macro *m = &e->macros[slot];
+    int ret = 0;
+    for (;;) {
+        const struct macro_step *step = &e->keymap->steps[m->pc++];
+        int changed;
+        switch (step->op) {
+            case MACRO_PRESS:
+                changed = report_press(&e->report, step->key, (uint8_t) step->arg);
+                break;
+            case MACRO_RELEASE:
+                changed = report_release(&e->report, step->key);
+                break;
+            case MACRO_WAIT:
+                release_schedule(&e->macroWheel, (uint8_t) slot, now + step->arg * RELEASE_TICK_NS);
+                return ret;
+            default:
+                m->macro = 0;
+                return ret;
+        }
+        if (changed) {
+            int err = send_report(e);
+            if (err) {
+                ret = err;
+            }
+        }
+    }
+}
+
+/**
+ * Starts a macro on a free runner. A macro that is still running isn't started again, its keys would collide.
+ * @param macro 1-based index of the macro
+ */
+static int start_macro(struct engine *e, uint8_t macro, uint8_t channel, uint64_t now) {
+    int slot = -1;
+    for (int i = 0; i < ENGINE_MACROS; i++) {
+        if (e->macros[i].macro == macro) {
+            slot = -1;
+            break;
+        }
+        if (slot < 0 && !e->macros[i].macro) {
+            slot = i;
+        }
+    }
+    if (slot < 0) {
+        e->stats.droppedMacros++;
+        if (e->log) {
+            log_write(e->log, LOG_PRESSED, now, channel, macro, 0, NULL, 0);
+        }
+        return 0;
+    }
+    e->stats.macros++;
+    e->macros[slot].macro = macro;
+    e->macros[slot].pc = e->keymap->macros[macro - 1].first;
+    return run_macro(e, slot, now);
+}
+
+/**
+ * Hands the key of a band that a channel leaves over to another channel that is still in the band, so that the
+ * key stays down until the last channel leaves.
+ * @return 1 if another channel holds the key now
+ */
+static int band_handover(struct engine *e, uint8_t channel, int index) {
+    for (int ch = 0; ch < KEYMAP_CHANNELS; ch++) {
+        if (ch != channel && (e->bands[ch][index] & ENGINE_BAND_IN)) {
+            e->bands[ch][index] |= ENGINE_BAND_PRESSED;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Updates the bands of a controller. A value within the range of the last evaluation can't change any band,
+ * so the pedal stream mostly costs a single comparison.
+ */
+static int control(struct engine *e, const struct midi_event *ev) {
+    uint8_t channel = ev->channel & 0x0f;
+    uint8_t value = ev->value & 0x7f;
+    struct engine_cc *s = &e->cc[channel][ev->note & 0x7f];
+    if (value >= s->lo && value <= s->hi) {
+        return 0;
+    }
+    const struct controller *c = &e->keymap->controllers[channel][ev->note & 0x7f];
+    uint8_t lo = 0;
+    uint8_t hi = 127;
+    int changed = 0;
+    if (c->count) {
+        e->stats.crossings++;
+    }
+    for (int i = 0; i < c->count; i++) {
+        int index = c->first - 1 + i;
+        const struct band *b = &e->keymap->bands[index];
+        uint8_t *state = &e->bands[channel][index];
+        int rising = b->down > b->up;
+        if (!(*state & ENGINE_BAND_IN) && (rising ? value >= b->down : value <= b->down)) {
+            // a key that is held by a note already stays with the note
+            *state = (uint8_t) (ENGINE_BAND_IN | (report_press(&e->report, b->key, b->mods) ? ENGINE_BAND_PRESSED : 0));
+            changed |= *state & ENGINE_BAND_PRESSED;
+        } else if ((*state & ENGINE_BAND_IN) && (rising ? value <= b->up : value >= b->up)) {
+            if ((*state & ENGINE_BAND_PRESSED) && !band_handover(e, channel, index)) {
+                changed |= report_release(&e->report, b->key);
+            }
+            *state = 0;
+        }
+        // the values that keep this band in its state
+        uint8_t in = *state & ENGINE_BAND_IN;
+        uint8_t blo = rising ? (in ? b->up + 1 : 0) : (in ? 0 : b->down + 1);
+        uint8_t bhi = rising ? (in ? 127 : b->down - 1) : (in ? b->up - 1 : 127);
+        lo = blo > lo ? blo : lo;
+        hi = bhi < hi ? bhi : hi;
+    }
+    s->lo = lo;
+    s->hi = hi;
+    return changed ? send_report(e) : 0;
+}
+
+/**
+ * Presses the key of a hit, or starts its macro.
+ * @param map the action of the hit, or NULL if the note isn't mapped
+ * @param trace latency trace of the hit, or NULL
+ */
+static int hit(struct engine *e, const struct action *map, uint8_t channel, uint8_t note, uint8_t velocity,
+               uint64_t now, struct lat_trace *trace) {
+    if (!map) {
+        e->stats.unmapped++;
+        if (e->log) {
+            log_write(e->log, LOG_UNMAPPED, now, channel, note, 0, NULL, 0);
+        }
+        return 0;
+    }
+    if (e->log) {
+        log_write(e->log, LOG_MAPPED, now, channel, note, map->key, &map->mods, 1);
+    }
+    if (map->release == RELEASE_MACRO) {
+        return start_macro(e, map->key, channel, now);
+    }
+    uint64_t hold = keymap_hold(map, velocity, e->minHold) * RELEASE_TICK_NS;
+    if (map->release == RELEASE_NOTEOFF) {
+        e->noteOffKey[channel][note & 0x7f] = map->key;
+    }
+    // gamepad axes take the velocity of the hit
+    uint8_t mods = report_is_axis(map->key) ? velocity : map->mods;
+    if (report_contains(&e->report, map->key) || e->repeat[map->key].waiting) {
+        return retrigger(e, map, mods, channel, hold, now);
+    }
+    if (!report_press(&e->report, map->key, mods)) {
+        e->stats.droppedFull++;
+        if (e->log) {
+            log_write(e->log, LOG_FULL, now, channel, map->key, 0, NULL, 0);
+        }
+        return 0;
+    }
+    int ret = send_report(e);
+    if (e->trace && trace) {
+        trace->output = release_now();
+        trace->channel = channel;
+        trace->note = note;
+        trace->velocity = velocity;
+        trace->key = map->key;
+        lat_hit(trace);
+    }
+    release_schedule(&e->wheel, map->key, now + hold);
+    return ret;
+}
+
+/**
+ * Adds a hit to the window of recent hits and checks the chords of the note. Only the chords the note is part of
+ * are looked at, and each costs a mask test unless all its notes were hit recently.
+ * @return the completed chord or NULL
+ */
+static const struct chord *match_chord(struct engine *e, uint8_t note, uint8_t velocity, uint64_t now) {
+    const struct keymap *km = e->keymap;
+    uint64_t window = km->chordWindow * RELEASE_TICK_NS;
+    e->recent[note / 64] |= 1ULL << (note % 64);
+    e->hitTime[note] = now;
+    e->hitVelocity[note] = velocity;
+    for (uint64_t chords = km->noteChords[note]; chords; chords &= chords - 1) {
+        const struct chord *c = &km->chords[__builtin_ctzll(chords)];
+        if ((e->recent[0] & c->mask[0]) != c->mask[0] || (e->recent[1] & c->mask[1]) != c->mask[1]) {
+            continue;
+        }
+        int complete = 1;
+        for (int i = 0; i < c->count; i++) {
+            uint8_t n = c->notes[i];
+            uint64_t age = now - e->hitTime[n];
+            if (age > window) {
+                // slid out of every chord window
+                e->recent[n / 64] &= ~(1ULL << (n % 64));
+            }
+            if (age > c->window * RELEASE_TICK_NS || e->hitVelocity[n] < c->minVelocity) {
+                complete = 0;
+            }
+        }
+        if (complete) {
+            // the hits are used up, so a third hit doesn't complete the chord again
+            for (int i = 0; i < c->count; i++) {
+                e->recent[c->notes[i] / 64] &= ~(1ULL << (c->notes[i] % 64));
+            }
+            return c;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Handles a hit on a note that is part of a chord. If it completes a chord, the chord key is pressed: a replacing
+ * chord drops the held back hits of its notes, otherwise the note presses its own key, too. A note of a
+ * replacing chord is held back until its chords can't complete anymore.
+ */
+static int chord_hit(struct engine *e, const struct action *map, uint8_t channel, uint8_t note, uint8_t velocity,
+                     uint64_t now, struct lat_trace *trace) {
+    const struct chord *c = match_chord(e, note, velocity, now);
+    if (c) {
+        e->stats.chords++;
+        int ret = 0;
+        if (c->replace) {
+            for (int i = 0; i < c->count; i++) {
+                e->deferred[c->notes[i]].map = NULL;
+                release_cancel(&e->chordWheel, c->notes[i]);
+            }
+        } else {
+            ret = hit(e, map, channel, note, velocity, now, NULL);
+        }
+        struct action chord = {.key = c->key, .mods = c->mods, .minVelocity = c->minVelocity,
+                .release = RELEASE_FIXED, .hold = c->hold};
+        int err = hit(e, &chord, channel, note, velocity, now, trace);
+        return err ? err : ret;
+    }
+    uint16_t delay = e->keymap->chordDelay[note];
+    if (!delay || !map) {
+        return hit(e, map, channel, note, velocity, now, trace);
+    }
+    struct engine_deferred *d = &e->deferred[note];
+    int ret = 0;
+    if (d->map) {
+        // the note was hit again within the window, the older hit goes out first
+        ret = hit(e, d->map, d->channel, note, d->velocity, now, NULL);
+    }
+    e->stats.deferred++;
+    d->map = map;
+    d->channel = channel;
+    d->velocity = velocity;
+    d->noteOff = 0;
+    release_schedule(&e->chordWheel, note, now + delay * RELEASE_TICK_NS);
+    return ret;
+}
+
+/**
+ * Presses a held back hit, whose chords didn't complete in time.
+ */
+static int expire_deferred(struct engine *e, uint8_t note, uint64_t now) {
+    struct engine_deferred *d = &e->deferred[note];
+    const struct action *map = d->map;
+    if (!map) {
+        return 0;
+    }
+    d->map = NULL;
+    int ret = hit(e, map, d->channel, note, d->velocity, now, NULL);
+    if (d->noteOff && map->release == RELEASE_NOTEOFF && e->noteOffKey[d->channel][note] == map->key) {
+        // the NOTEOFF came while the hit was held back, so only hold it for a frame
+        e->noteOffKey[d->channel][note] = 0;
+        release_schedule(&e->wheel, map->key, now + e->repeatGap);
+    }
+    return ret;
+}
+
+/**
+ * Checks whether a hit is crosstalk of a recent hit on another pad of the same channel: softer than the ratio of
+ * their rule, and within its window. Every pad learns the level of these candidates, dropped or not, and once it
+ * did, a candidate above that level is kept however hard the source was hit. Only the last
+ * ENGINE_CROSSTALK_HITS hits on sources are looked at, so the check costs the same for every profile.
+ * @return 1 if the hit is dropped
+ */
+static int crosstalk(struct engine *e, uint8_t channel, uint8_t note, uint8_t velocity, uint64_t now) {
+    const struct keymap *km = e->keymap;
+    uint64_t bit = 1ULL << (note % 64);
+    int source = -1;
+    for (int i = 0; i < ENGINE_CROSSTALK_HITS && source < 0 && (km->crosstalkVictims[note / 64] & bit); i++) {
+        const struct engine_hit *h = &e->sourceHits[i];
+        uint8_t rule = km->crosstalkRule[h->note][note];
+        if (!rule || !h->velocity || h->channel != channel) {
+            continue;
+        }
+        const struct crosstalk *c = &km->crosstalk[rule - 1];
+        if (now - h->time > c->window * RELEASE_TICK_NS) {
+            continue;
+        }
+        if (velocity * 100u < (unsigned) c->ratio * h->velocity) {
+            source = h->note;
+        }
+    }
+    if (source >= 0) {
+        struct engine_floor *f = &e->floors[note];
+        int32_t v = velocity << 8;
+        int above = f->count >= ENGINE_FLOOR_LEARN && v > f->mean + ENGINE_FLOOR_DEVS * f->dev;
+        // moving averages over about the last 8 candidates, whether the floor drops them or not. real hits above
+        // the ratio stay out, with them the floor of a pad that flams with the kick would end up at 127. the
+        // deviation follows a loud ghost note within a few candidates but forgets it only over about 32, otherwise
+        // a run of soft ghosts pulls the floor below the next loud one.
+        int32_t d = v > f->mean ? v - f->mean : f->mean - v;
+        f->mean = f->count ? f->mean + (v - f->mean) / 8 : v;
+        f->dev += d > f->dev ? (d - f->dev) / 4 : (d - f->dev) / 32;
+        f->count++;
+        if (above) {
+            e->stats.aboveFloor++;
+        } else {
+            e->stats.crosstalk++;
+            if (e->log) {
+                log_write(e->log, LOG_CROSSTALK, now, channel, note, (uint8_t) source, NULL, 0);
+            }
+            return 1;
+        }
+    }
+    if (km->crosstalkSources[note / 64] & bit) {
+        struct engine_hit *h = &e->sourceHits[e->sourceHead++ % ENGINE_CROSSTALK_HITS];
+        h->time = now;
+        h->channel = channel;
+        h->note = note;
+        h->velocity = velocity;
+    }
+    return 0;
+}
+
+/**
+ * Handles an event.
+ * @param map the action of a hit, looked up by the caller, or NULL
+ */
+static int handle(struct engine *e, const struct midi_event *ev, const struct action *map, uint64_t now) {
+    struct lat_trace trace;
+    trace.kernel = ev->stamp;
+    trace.input = now;
+    e->now = now;
+    e->stats.events++;
+    int hitNote = midi_process(e, ev);
+    int off = midi_note_off(ev);
+    uint8_t channel = ev->channel & 0x0f;
+    if (off >= 0) {
+        if (e->deferred[off].map) {
+            e->deferred[off].noteOff = 1;
+        }
+        uint8_t key = e->noteOffKey[channel][off];
+        e->noteOffKey[channel][off] = 0;
+        if (key && (e->repeat[key].queued || e->repeat[key].waiting)) {
+            // let the queued repeats play out, but don't hold the last one
+            e->repeat[key].noteOff = 1;
+            return 0;
+        }
+        if (key && report_release(&e->report, key)) {
+            release_cancel(&e->wheel, key);
+            return send_report(e);
+        }
+        return 0;
+    }
+    if (ev->type == MIDI_CONTROLLER) {
+        return control(e, ev);
+    }
+    if (hitNote < 0) {
+        return 0;
+    }
+    uint8_t note = (uint8_t) hitNote;
+    e->stats.hits++;
+    if (e->keymap->numCrosstalk && crosstalk(e, channel, note, ev->value, now)) {
+        return 0;
+    }
+    if (e->trace) {
+        trace.map = release_now();
+    }
+    if (e->keymap->noteChords[note]) {
+        return chord_hit(e, map, channel, note, ev->value, now, &trace);
+    }
+    return hit(e, map, channel, note, ev->value, now, &trace);
+}
+
+/**
+ * Handles the deadline of a key: the re-press of a retrigger, or its release.
+ * @return 1 if the report changed
+ */
+static int expire_key(struct engine *e, uint8_t key, uint64_t now) {
+    struct engine_repeat *r = &e->repeat[key];
+    if (r->waiting) {
+        r->waiting = 0;
+        r->queued--;
+        if (!report_press(&e->report, key, r->mods)) {
+            e->stats.droppedFull += r->queued + 1u;
+            r->queued = 0;
+            return 0;
+        }
+        // queued repeats only stay down for one gap, the last one gets the hold time of its hit.
+        release_schedule(&e->wheel, key, now + (r->queued || r->noteOff ? e->repeatGap : r->hold));
+        return 1;
+    }
+    if (!report_release(&e->report, key)) {
+        return 0;
+    }
+    if (r->queued) {
+        r->waiting = 1;
+        release_schedule(&e->wheel, key, now + e->repeatGap);
+    }
+    return 1;
+}
+
+/**
+ * Looks up the action of a hit, or returns NULL for anything else.
+ */
+static inline const struct action *lookup(const struct engine *e, uint8_t type, uint8_t channel, uint8_t note,
+                                          uint8_t value) {
+    return type == MIDI_NOTEON && value ? findMap(e, channel & 0x0f, note, value) : NULL;
+}
+
+int engine_event(struct engine *e, const struct midi_event *ev, uint64_t now) {
+    return handle(e, ev, lookup(e, ev->type, ev->channel, ev->note, ev->value), now);
+}
+
+int engine_batch(struct engine *e, const struct midi_batch *b, uint8_t device, uint64_t now) {
+    const struct action *maps[MIDI_BATCH_LEN];
+    // look up all hits first: a tight loop over the note fields, without the branches of the event handling
+    for (int i = 0; i < b->count; i++) {
+        maps[i] = b->device[i] == device ? lookup(e, b->type[i], b->channel[i], b->note[i], b->value[i]) : NULL;
+    }
+    int ret = 0;
+    for (int i = 0; i < b->count; i++) {
+        if (b->device[i] != device) {
+            continue;
+        }
+        struct midi_event ev;
+        midi_batch_get(b, i, &ev);
+        int err = handle(e, &ev, maps[i], now);
+        if (err) {
+            ret = err;
+        }
+    }
+    return ret;
+}
+
+int engine_expire(struct engine *e, uint64_t now) {
+    uint8_t due[RELEASE_KEYS];
+    e->now = now;
+    int n = release_expire(&e->wheel, now, due, RELEASE_KEYS);
+    int changed = 0;
+    for (int i = 0; i < n; i++) {
+        changed |= expire_key(e, due[i], now);
+    }
+    int ret = changed ? send_report(e) : 0;
+    n = release_expire(&e->chordWheel, now, due, KEYMAP_NOTES);
+    for (int i = 0; i < n; i++) {
+        int err = expire_deferred(e, due[i], now);
+        if (err) {
+            ret = err;
+        }
+    }
+    // the macros after the keys, so a macro that presses a key the wheel just released gets a report of its own
+    n = release_expire(&e->macroWheel, now, due, ENGINE_MACROS);
+    for (int i = 0; i < n; i++) {
+        int err = run_macro(e, due[i], now);
+        if (err) {
+            ret = err;
+        }
+    }
+    return ret;
+}
+
+int engine_release_all(struct engine *e) {
+    int held = 0;
+    for (int key = 0; key < 256; key++) {
+        held |= report_release(&e->report, (uint8_t) key);
+        // also cancels the re-press of waiting retriggers
+        release_cancel(&e->wheel, (uint8_t) key);
+    }
+    memset(e->noteOffKey, 0, sizeof(e->noteOffKey));
+    memset(e->repeat, 0, sizeof(e->repeat));
+    memset(e->cc, 0xff, sizeof(e->cc));
+    memset(e->bands, 0, sizeof(e->bands));
+    for (int i = 0; i < ENGINE_MACROS; i++) {
+        release_cancel(&e->macroWheel, (uint8_t) i);
+    }
+    memset(e->macros, 0, sizeof(e->macros));
+    for (int note = 0; note < KEYMAP_NOTES; note++) {
+        release_cancel(&e->chordWheel, (uint8_t) note);
+    }
+    memset(e->deferred, 0, sizeof(e->deferred));
+    memset(e->recent, 0, sizeof(e->recent));
+    return held ? send_report(e) : 0;
+}
+
+int engine_set_keymap(struct engine *e, const struct keymap *km) {
+    // keys pressed under the old profile might not exist in the new one, so release them all.
+    int ret = engine_release_all(e);
+    e->keymap = km;
+    return ret;
+}
+
+void engine_dump_stats(const struct engine *e, FILE *out) {
+    fprintf(out, "Engine\n");
+    fprintf(out, "├── events:  %llu\n", (unsigned long long) e->stats.events);
+    fprintf(out, "├── hits:    %llu\n", (unsigned long long) e->stats.hits);
+    fprintf(out, "├── reports: %llu\n", (unsigned long long) e->stats.reports);
+    fprintf(out, "├── repeats: %llu\n", (unsigned long long) e->stats.repeats);
+    fprintf(out, "├── dropped: %llu pressed, %llu full\n", (unsigned long long) e->stats.droppedPressed,
+            (unsigned long long) e->stats.droppedFull);
+    fprintf(out, "├── unmapped: %llu\n", (unsigned long long) e->stats.unmapped);
+    fprintf(out, "├── crossings: %llu\n", (unsigned long long) e->stats.crossings);
+    fprintf(out, "├── macros:  %llu, %llu dropped\n", (unsigned long long) e->stats.macros,
+            (unsigned long long) e->stats.droppedMacros);
+    fprintf(out, "├── chords:  %llu, %llu hits held back\n", (unsigned long long) e->stats.chords,
+            (unsigned long long) e->stats.deferred);
+    fprintf(out, "└── crosstalk: %llu ghost notes, %llu kept above the noise floor\n",
+            (unsigned long long) e->stats.crosstalk, (unsigned long long) e->stats.aboveFloor);
+    fflush(out);
+}
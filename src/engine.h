@@ -0,0 +1,380 @@
+#ifndef MIDI2HID_ENGINE_H
+#define MIDI2HID_ENGINE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "keymap.h"
+#include "log.h"
+#include "midi.h"
+#include "release.h"
+#include "report.h"
+
+/**
+ * Receives the reports built by the engine.
+ * @param ctx sink context
+ * @param data the report
+ * @param len length of the report
+ * @return 0 on success
+ */
+typedef int (*engine_sink)(void *ctx, const uint8_t *data, size_t len);
+
+/**
+ * Default number of hits on a pressed key that are queued for a retrigger.
+ */
+#define ENGINE_MAX_REPEATS 4
+
+/**
+ * Default time a retriggered key stays released, and a queued repeat stays pressed. One USB frame, so the
+ * host sees every state.
+ */
+#define ENGINE_REPEAT_GAP_NS 1000000ULL
+
+/**
+ * Number of macros that can run at the same time.
+ */
+#define ENGINE_MACROS 32
+
+/**
+ * Number of recent hits on crosstalk sources that a hit is checked against.
+ */
+#define ENGINE_CROSSTALK_HITS 8
+
+/**
+ * Crosstalk candidates a pad has to see before its noise floor is used, and the width of the floor in mean
+ * deviations above the mean.
+ */
+#define ENGINE_FLOOR_LEARN 16
+#define ENGINE_FLOOR_DEVS 4
+
+/**
+ * Counters of the engine.
+ */
+struct engine_stats {
+    uint64_t events;
+    uint64_t hits;
+    uint64_t reports;
+
+    /**
+     * Hits on a pressed key, that were queued for a retrigger.
+     */
+    uint64_t repeats;
+
+    /**
+     * Hits that were mapped, but dropped because their key had too many queued repeats.
+     */
+    uint64_t droppedPressed;
+
+    /**
+     * Hits that were dropped because the report had no free slot.
+     */
+    uint64_t droppedFull;
+
+    /**
+     * Hits without a mapping or below the velocity threshold.
+     */
+    uint64_t unmapped;
+
+    /**
+     * Controller values that left the range of the last evaluation, so that their bands were checked.
+     */
+    uint64_t crossings;
+
+    /**
+     * Macros started, and hits on macros dropped because the macro was still running or no runner was free.
+     */
+    uint64_t macros;
+    uint64_t droppedMacros;
+
+    /**
+     * Completed chords, and hits that were held back because they might complete a replacing chord.
+     */
+    uint64_t chords;
+    uint64_t deferred;
+
+    /**
+     * Ghost notes dropped as crosstalk, and hits below the ratio of a crosstalk rule that were kept because they
+     * were louder than the noise floor of their pad.
+     */
+    uint64_t crosstalk;
+    uint64_t aboveFloor;
+};
+
+/**
+ * Range of controller values within which none of the bands of the controller changes its state.
+ * lo > hi forces the next value to be evaluated.
+ */
+struct engine_cc {
+    uint8_t lo;
+    uint8_t hi;
+};
+
+/**
+ * State of a controller band.
+ */
+#define ENGINE_BAND_IN 1
+#define ENGINE_BAND_PRESSED 2
+
+/**
+ * Retrigger state of a key that was hit again while it was still pressed. The key is released right away and
+ * pressed again after the repeat gap, once for every queued hit.
+ */
+struct engine_repeat {
+    /**
+     * Hits still to be pressed.
+     */
+    uint8_t queued;
+
+    /**
+     * The key is released and the wheel deadline is its next press.
+     */
+    uint8_t waiting;
+
+    /**
+     * The NOTEOFF of a NOTEOFF policy key arrived during the repeats, so the last press is short.
+     */
+    uint8_t noteOff;
+
+    uint8_t mods;
+
+    /**
+     * Hold time of the last hit in ns.
+     */
+    uint64_t hold;
+};
+
+/**
+ * A running macro.
+ */
+struct engine_macro {
+    /**
+     * Index of the next step in {@code keymap.steps}.
+     */
+    uint16_t pc;
+
+    /**
+     * 1-based index of the macro in {@code keymap.macros}, or 0 if the runner is free.
+     */
+    uint8_t macro;
+};
+
+/**
+ * Hit of a note that is held back while a replacing chord of the note can still complete.
+ */
+struct engine_deferred {
+    /**
+     * Action of the hit, or NULL if nothing is held back.
+     */
+    const struct action *map;
+    uint8_t channel;
+    uint8_t velocity;
+
+    /**
+     * The NOTEOFF of the note arrived while the hit was held back.
+     */
+    uint8_t noteOff;
+};
+
+/**
+ * Recent hit on a pad that is the source of a crosstalk rule. Like the actions, it is told apart by channel and
+ * note: a source only shakes the pads of its own kit.
+ */
+struct engine_hit {
+    uint64_t time;
+    uint8_t channel;
+    uint8_t note;
+
+    /**
+     * Velocity of the hit, or 0 if the slot is unused.
+     */
+    uint8_t velocity;
+};
+
+/**
+ * Noise floor of a pad: the moving mean and mean deviation of the velocities of its crosstalk candidates (hits
+ * within the window of a source and below the ratio), in 1/256. It learns from every candidate, not only from the
+ * ones it drops. The deviation rises faster than it decays, so the floor stays above the loudest recent ghosts.
+ */
+struct engine_floor {
+    int32_t mean;
+    int32_t dev;
+    uint32_t count;
+};
+
+/**
+ * The MIDI to HID core: maps events, builds the reports and schedules the key releases.
+ * It doesn't do any I/O by itself, so it can be driven by the daemon, the replay tool or a benchmark.
+ * All times are CLOCK_MONOTONIC nanoseconds, or any other monotonic time base the driver chooses.
+ */
+struct engine {
+    /**
+     * Active mapping profile.
+     */
+    const struct keymap *keymap;
+
+    struct report report;
+    struct release_wheel wheel;
+
+    /**
+     * Keys pressed by notes that wait for their NOTEOFF.
+     */
+    uint8_t noteOffKey[KEYMAP_CHANNELS][KEYMAP_NOTES];
+
+    struct engine_repeat repeat[256];
+
+    struct engine_cc cc[KEYMAP_CHANNELS][KEYMAP_CONTROLLERS];
+
+    /**
+     * ENGINE_BAND_* bits of every band of the keymap, per channel: a wildcard channel band is stored once in the
+     * keymap, but every channel's controller enters and leaves it on its own, like the ranges in {@code cc}.
+     */
+    uint8_t bands[KEYMAP_CHANNELS][KEYMAP_MAX_BANDS];
+
+    /**
+     * Running macros, and the deadlines of those that wait. The wheel is indexed by runner.
+     */
+    struct engine_macro macros[ENGINE_MACROS];
+    struct release_wheel macroWheel;
+
+    /**
+     * Sliding window of recent hits for the chords: the bitset of the notes, and the time and velocity of the last
+     * hit of every note. Bits of hits that left the window are cleared when a chord looks at them.
+     */
+    uint64_t recent[2];
+    uint64_t hitTime[KEYMAP_NOTES];
+    uint8_t hitVelocity[KEYMAP_NOTES];
+
+    /**
+     * Held back hits, and their deadlines. The wheel is indexed by note.
+     */
+    struct engine_deferred deferred[KEYMAP_NOTES];
+    struct release_wheel chordWheel;
+
+    /**
+     * Ring of the last hits on crosstalk sources, and the noise floor of every pad. The floors are learned over
+     * the whole session and survive a profile reload.
+     */
+    struct engine_hit sourceHits[ENGINE_CROSSTALK_HITS];
+    uint8_t sourceHead;
+    struct engine_floor floors[KEYMAP_NOTES];
+
+    /**
+     * Maximum queued repeats per key, 0 drops hits on pressed keys.
+     */
+    uint8_t maxRepeats;
+    uint64_t repeatGap;
+
+    /**
+     * Shortest hold time in ms that the host registers, from its measured poll interval, or 0 if it isn't known.
+     * See keymap_hold().
+     */
+    unsigned int minHold;
+
+    engine_sink send;
+    void *ctx;
+
+    struct engine_stats stats;
+
+    /**
+     * Log of every event and report, or NULL.
+     */
+    struct log *log;
+
+    /**
+     * Time of the last event or expiry, for the log.
+     */
+    uint64_t now;
+
+    /**
+     * Record the latency of every hit. Only useful when the engine runs on the real clock.
+     */
+    int trace;
+};
+
+/**
+ * Initializes the engine.
+ * @param e the engine
+ * @param mode report layout
+ * @param km mapping profile
+ * @param send report sink
+ * @param ctx sink context
+ * @param now current time
+ */
+void engine_init(struct engine *e, enum report_mode mode, const struct keymap *km, engine_sink send, void *ctx,
+                 uint64_t now);
+
+/**
+ * Processes one MIDI event.
+ * @param e the engine
+ * @param ev the event
+ * @param now time the event was read
+ * @return 0 on success, or the error of the sink.
+ */
+int engine_event(struct engine *e, const struct midi_event *ev, uint64_t now);
+
+/**
+ * Processes the events of one device in a batch, in order. The hits are looked up in one pass over the batch
+ * before the events are handled.
+ * @param e the engine
+ * @param b the batch
+ * @param device index of the device of the engine, events of other devices are skipped
+ * @param now time the batch was read
+ * @return 0 on success, or the error of the sink.
+ */
+int engine_batch(struct engine *e, const struct midi_batch *b, uint8_t device, uint64_t now);
+
+/**
+ * Releases all keys that are due, presses the held back hits whose chords didn't complete, and continues the
+ * macros whose wait is over.
+ * @param e the engine
+ * @param now current time
+ * @return 0 on success, or the error of the sink.
+ */
+int engine_expire(struct engine *e, uint64_t now);
+
+/**
+ * Releases all pressed keys at once and stops all macros.
+ * @return 0 on success, or the error of the sink.
+ */
+int engine_release_all(struct engine *e);
+
+/**
+ * Switches to a new mapping profile. Keys pressed under the old profile are released.
+ * @return 0 on success, or the error of the sink.
+ */
+int engine_set_keymap(struct engine *e, const struct keymap *km);
+
+/**
+ * Prints the counters of the engine.
+ */
+void engine_dump_stats(const struct engine *e, FILE *out);
+
+/**
+ * Returns the noise floor of a pad: the velocity up to which a hit within a crosstalk window is dropped, or 0 while
+ * the pad is still learning.
+ */
+static inline uint8_t engine_floor(const struct engine *e, uint8_t note) {
+    const struct engine_floor *f = &e->floors[note & 0x7f];
+    if (f->count < ENGINE_FLOOR_LEARN) {
+        return 0;
+    }
+    int32_t floor = (f->mean + ENGINE_FLOOR_DEVS * f->dev) >> 8;
+    return (uint8_t) (floor > 127 ? 127 : floor);
+}
+
+/**
+ * Returns the time when engine_expire() should be called next, or 0 if no key is pressed, no hit is held back and
+ * no macro waits.
+ */
+static inline uint64_t engine_next(const struct engine *e) {
+    const struct release_wheel *wheels[] = {&e->wheel, &e->chordWheel, &e->macroWheel};
+    uint64_t next = 0;
+    for (int i = 0; i < 3; i++) {
+        uint64_t due = release_next(wheels[i]);
+        if (due && (!next || due < next)) {
+            next = due;
+        }
+    }
+    return next;
+}
+
+#endif //MIDI2HID_ENGINE_H
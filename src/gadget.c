@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "boot.h"
+#include "gadget.h"
+
+/**
+ * Largest attribute that is read back, the report descriptor.
+ */
+#define ATTR_MAX REPORT_DESC_MAX_LEN
+
+void gadget_init(struct gadget *g, enum report_mode mode) {
+    memset(g, 0, sizeof(*g));
+    g->root = GADGET_ROOT;
+    g->udcClass = BOOT_UDC_CLASS;
+    g->name = GADGET_NAME;
+    g->function = GADGET_FUNCTION;
+    g->bind = 1;
+    g->mode = mode;
+}
+
+/**
+ * Formats the path of a file of the gadget.
+ * @param buf receives the path, PATH_MAX bytes
+ * @return {@code buf}, or NULL with errno ENAMETOOLONG if the path doesn't fit. The helpers below fail on a NULL
+ * path, so a truncated path is never created, written or removed.
+ */
+static const char *path_of(char *buf, const struct gadget *g, const char *fmt, ...) {
+    char rel[PATH_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(rel, sizeof(rel), fmt, ap);
+    va_end(ap);
+    if (len < 0 || len >= (int) sizeof(rel) ||
+        snprintf(buf, PATH_MAX, "%s/usb_gadget/%s%s%s", g->root, g->name, *rel ? "/" : "", rel) >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    return buf;
+}
+
+/**
+ * Checks the result of path_of().
+ * @return 0 if there is a path, -1 after printing the error
+ */
+static int check_path(const char *path) {
+    if (!path) {
+        perror("gadget");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Creates the directory.
+ * @return 1 if it was created, 0 if it existed, -1 on error
+ */
+static int make_dir(const char *path) {
+    if (check_path(path)) {
+        return -1;
+    }
+    if (mkdir(path, 0755) == 0) {
+        return 1;
+    }
+    if (errno == EEXIST) {
+        return 0;
+    }
+    perror(path);
+    return -1;
+}
+
+/**
+ * Removes the directory. In configfs, rmdir removes the attributes with it; in a plain directory tree the files
+ * and subdirectories are removed first.
+ */
+static int remove_dir(const char *path) {
+    if (check_path(path)) {
+        return -1;
+    }
+    if (rmdir(path) == 0 || errno == ENOENT) {
+        return 0;
+    }
+    if (errno != ENOTEMPTY) {
+        perror(path);
+        return -1;
+    }
+    DIR *dir = opendir(path);
+    struct dirent *de;
+    while (dir && (de = readdir(dir)) != NULL) {
+        char child[PATH_MAX];
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+            continue;
+        }
+        if (snprintf(child, sizeof(child), "%s/%s", path, de->d_name) >= (int) sizeof(child)) {
+            continue;
+        }
+        if (de->d_type == DT_DIR) {
+            remove_dir(child);
+        } else {
+            unlink(child);
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    if (rmdir(path) < 0) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+static int write_attr(const char *path, const void *data, size_t len) {
+    if (!path) {
+        return -1;
+    }
+    // configfs can't create files, so O_CREAT only matters for a plain directory tree
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = write(fd, data, len);
+    // a plain file may still hold a longer value. configfs attributes take a write as a whole.
+    if (n == (ssize_t) len && ftruncate(fd, (off_t) len) < 0) {
+        perror(path);
+    }
+    close(fd);
+    return n == (ssize_t) len ? 0 : -1;
+}
+
+static int write_str(const char *path, const char *fmt, ...) {
+    char value[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(value, sizeof(value), fmt, ap);
+    va_end(ap);
+    if (write_attr(path, value, (size_t) len)) {
+        perror(path ? path : "gadget");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Reads an attribute.
+ * @return the length, or -1 if it can't be read
+ */
+static ssize_t read_attr(const char *path, void *buf, size_t max) {
+    if (!path) {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, max);
+    close(fd);
+    return n;
+}
+
+/**
+ * Reads a text attribute, without the trailing newline.
+ */
+static const char *read_str(const char *path, char *buf, size_t max) {
+    ssize_t n = read_attr(path, buf, max - 1);
+    buf[n > 0 ? n : 0] = 0;
+    buf[strcspn(buf, "\n")] = 0;
+    return buf;
+}
+
+int gadget_interval(const char *speed) {
+    if (!speed || strcmp(speed, "full-speed") == 0 || strcmp(speed, "low-speed") == 0) {
+        return 1;
+    }
+    // 2^(4-1) microframes of 125us
+    return 4;
+}
+
+/**
+ * Settings of the HID function for the report layout.
+ */
+struct function {
+    uint8_t desc[REPORT_DESC_MAX_LEN];
+    size_t descLen;
+    int length;
+    int protocol;
+    int interval;
+};
+
+/**
+ * @return 1 if the function in configfs has the given settings
+ */
+static int function_matches(const struct gadget *g, const struct function *f) {
+    char path[PATH_MAX], value[32];
+    uint8_t desc[ATTR_MAX];
+    ssize_t n = read_attr(path_of(path, g, "functions/%s/report_desc", g->function), desc, sizeof(desc));
+    if (n != (ssize_t) f->descLen || memcmp(desc, f->desc, f->descLen) != 0) {
+        return 0;
+    }
+    if (atoi(read_str(path_of(path, g, "functions/%s/report_length", g->function), value, sizeof(value))) !=
+        f->length) {
+        return 0;
+    }
+    if (atoi(read_str(path_of(path, g, "functions/%s/protocol", g->function), value, sizeof(value))) != f->protocol ||
+        atoi(read_str(path_of(path, g, "functions/%s/subclass", g->function), value, sizeof(value))) != f->protocol) {
+        return 0;
+    }
+    read_str(path_of(path, g, "functions/%s/interval", g->function), value, sizeof(value));
+    // a kernel without the attribute has nothing to compare
+    return !*value || atoi(value) == f->interval;
+}
+
+static int write_function(const struct gadget *g, const struct function *f) {
+    char path[PATH_MAX];
+    if (write_str(path_of(path, g, "functions/%s/protocol", g->function), "%d\n", f->protocol) ||
+        write_str(path_of(path, g, "functions/%s/subclass", g->function), "%d\n", f->protocol) ||
+        write_str(path_of(path, g, "functions/%s/report_length", g->function), "%d\n", f->length)) {
+        return -1;
+    }
+    if (write_attr(path_of(path, g, "functions/%s/report_desc", g->function), f->desc, f->descLen)) {
+        perror(path);
+        return -1;
+    }
+    // added in Linux 6.9, older kernels poll every 10 frames at full and every 8 microframes at high speed
+    if (write_str(path_of(path, g, "functions/%s/interval", g->function), "%d\n", f->interval)) {
+        fprintf(stderr, "gadget: the kernel can't set the polling interval\n");
+    }
+    return 0;
+}
+
+/**
+ * Returns the UDC the gadget is bound to.
+ * @return the name, empty if unbound
+ */
+static const char *bound_udc(const struct gadget *g, char *buf, size_t len) {
+    char path[PATH_MAX];
+    return read_str(path_of(path, g, "UDC"), buf, len);
+}
+
+static int bind_udc(const struct gadget *g, const char *udc) {
+    char path[PATH_MAX];
+    return write_str(path_of(path, g, "UDC"), "%s\n", udc);
+}
+
+/**
+ * Returns the UDC to bind to: the configured one, or the only one there is.
+ */
+static const char *find_udc(const struct gadget *g, char *buf, size_t len) {
+    if (g->udc) {
+        return g->udc;
+    }
+    DIR *dir = opendir(g->udcClass);
+    struct dirent *de;
+    int found = 0;
+    while (dir && (de = readdir(dir)) != NULL) {
+        if (de->d_name[0] != '.') {
+            snprintf(buf, len, "%s", de->d_name);
+            found++;
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    return found == 1 ? buf : NULL;
+}
+
+int gadget_setup(const struct gadget *g) {
+    char path[PATH_MAX], link[PATH_MAX], udcBuf[256], bound[256], speed[32];
+    struct function f;
+    memset(&f, 0, sizeof(f));
+    if (!(f.descLen = report_descriptor(g->mode, f.desc))) {
+        fprintf(stderr, "gadget: descriptor longer than %d bytes\n", REPORT_DESC_MAX_LEN);
+        return -1;
+    }
+    f.length = (int) report_max_len(g->mode);
+    // only the 8 byte layout is boot protocol compatible.
+    f.protocol = g->mode == REPORT_BOOT;
+    const char *udc = find_udc(g, udcBuf, sizeof(udcBuf));
+    if (udc) {
+        snprintf(path, sizeof(path), "%s/%s/maximum_speed", g->udcClass, udc);
+        read_str(path, speed, sizeof(speed));
+    }
+    f.interval = gadget_interval(udc && *speed ? speed : NULL);
+    if (g->bind && !udc) {
+        fprintf(stderr, "gadget: no UDC in %s, or several\n", g->udcClass);
+        return -1;
+    }
+
+    if (snprintf(path, sizeof(path), "%s/usb_gadget", g->root) >= (int) sizeof(path)) {
+        errno = ENAMETOOLONG;
+        perror(g->root);
+        return -1;
+    }
+    if (make_dir(path) < 0) {
+        fprintf(stderr, "gadget: is libcomposite loaded?\n");
+        return -1;
+    }
+    int created = make_dir(path_of(path, g, ""));
+    if (created < 0) {
+        return -1;
+    }
+    // the groups exist in configfs, not in a plain tree
+    make_dir(path_of(path, g, "functions"));
+    make_dir(path_of(path, g, "configs"));
+    make_dir(path_of(path, g, "strings"));
+    if (created) {
+        if (write_str(path_of(path, g, "idVendor"), "0x%04x\n", GADGET_VENDOR) ||
+            write_str(path_of(path, g, "idProduct"), "0x%04x\n", GADGET_PRODUCT) ||
+            write_str(path_of(path, g, "bcdUSB"), "0x0200\n") ||
+            make_dir(path_of(path, g, "strings/0x409")) < 0 ||
+            write_str(path_of(path, g, "strings/0x409/manufacturer"), "midi2hid\n") ||
+            write_str(path_of(path, g, "strings/0x409/product"), "MIDIKeyboard\n")) {
+            return -1;
+        }
+    }
+    int config = make_dir(path_of(path, g, "configs/%s", GADGET_CONFIG));
+    if (config < 0) {
+        return -1;
+    }
+    if (config) {
+        if (make_dir(path_of(path, g, "configs/%s/strings", GADGET_CONFIG)) < 0 ||
+            make_dir(path_of(path, g, "configs/%s/strings/0x409", GADGET_CONFIG)) < 0 ||
+            write_str(path_of(path, g, "configs/%s/strings/0x409/configuration", GADGET_CONFIG), "Conf 1\n") ||
+            write_str(path_of(path, g, "configs/%s/MaxPower", GADGET_CONFIG), "120\n")) {
+            return -1;
+        }
+    }
+
+    if (check_path(path_of(link, g, "configs/%s/%s", GADGET_CONFIG, g->function))) {
+        return -1;
+    }
+    int fresh = make_dir(path_of(path, g, "functions/%s", g->function));
+    if (fresh < 0) {
+        return -1;
+    }
+    bound_udc(g, bound, sizeof(bound));
+    if (fresh || !function_matches(g, &f)) {
+        // the kernel locks the settings of a function while it's part of a bound configuration
+        if (*bound && bind_udc(g, "")) {
+            return -1;
+        }
+        *bound = 0;
+        if (unlink(link) < 0 && errno != ENOENT) {
+            perror(link);
+            return -1;
+        }
+        if (write_function(g, &f)) {
+            return -1;
+        }
+        printf("gadget: %s/%s set up, %d byte reports, bInterval %d\n", g->name, g->function, f.length,
+               f.interval);
+    }
+    // configfs resolves the target when the link is made, so it has to be absolute
+    if (check_path(path_of(path, g, "functions/%s", g->function)) ||
+        (symlink(path, link) < 0 && errno != EEXIST)) {
+        perror(link);
+        return -1;
+    }
+    if (g->bind && !*bound) {
+        if (bind_udc(g, udc)) {
+            return -1;
+        }
+        printf("gadget: %s bound to %s\n", g->name, udc);
+    }
+    return 0;
+}
+
+/**
+ * @return 1 if the directory has entries
+ */
+static int has_entries(const char *path) {
+    DIR *dir = opendir(path);
+    struct dirent *de;
+    int entries = 0;
+    while (dir && (de = readdir(dir)) != NULL) {
+        if (de->d_name[0] != '.') {
+            entries = 1;
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    return entries;
+}
+
+int gadget_teardown(const struct gadget *g) {
+    char path[PATH_MAX], bound[256];
+    if (check_path(path_of(path, g, ""))) {
+        return -1;
+    }
+    if (access(path, F_OK) < 0) {
+        return 0;
+    }
+    bound_udc(g, bound, sizeof(bound));
+    if (*bound && bind_udc(g, "")) {
+        return -1;
+    }
+    if (check_path(path_of(path, g, "configs/%s/%s", GADGET_CONFIG, g->function)) ||
+        (unlink(path) < 0 && errno != ENOENT)) {
+        perror(path);
+        return -1;
+    }
+    if (remove_dir(path_of(path, g, "functions/%s", g->function))) {
+        return -1;
+    }
+    // the board's gadget keeps its other functions, and the host gets them back
+    if (check_path(path_of(path, g, "functions"))) {
+        return -1;
+    }
+    if (has_entries(path)) {
+        if (*bound && bind_udc(g, bound)) {
+            return -1;
+        }
+        printf("gadget: %s/%s removed\n", g->name, g->function);
+        return 0;
+    }
+    if (remove_dir(path_of(path, g, "configs/%s/strings/0x409", GADGET_CONFIG)) ||
+        remove_dir(path_of(path, g, "configs/%s", GADGET_CONFIG)) ||
+        remove_dir(path_of(path, g, "strings/0x409")) ||
+        remove_dir(path_of(path, g, ""))) {
+        return -1;
+    }
+    printf("gadget: %s removed\n", g->name);
+    return 0;
+}
+
+int gadget_node(const struct gadget *g, char *buf, size_t len) {
+    char path[PATH_MAX], dev[32];
+    int major, minor;
+    if (sscanf(read_str(path_of(path, g, "functions/%s/dev", g->function), dev, sizeof(dev)), "%d:%d", &major,
+               &minor) != 2) {
+        return -1;
+    }
+    snprintf(buf, len, "/dev/hidg%d", minor);
+    return 0;
+}
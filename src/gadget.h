@@ -0,0 +1,99 @@
+#ifndef MIDI2HID_GADGET_H
+#define MIDI2HID_GADGET_H
+
+#include <stddef.h>
+#include "report.h"
+
+/**
+ * Sets up the HID function of the USB gadget in configfs, from the same report layout the daemon writes. The
+ * setup is idempotent: it creates what is missing, reuses an existing gadget (eg. g_multi of the board's own
+ * script) and only rewrites the function if its settings differ, which needs the gadget unbound for a moment.
+ * All paths are relative to {@code root} and {@code udcClass}, so the setup can run against a temporary tree.
+ */
+
+/**
+ * Mount point of configfs.
+ */
+#define GADGET_ROOT "/sys/kernel/config"
+
+#define GADGET_NAME "midi2hid"
+#define GADGET_FUNCTION "hid.usb0"
+#define GADGET_CONFIG "c.1"
+
+/**
+ * Vendor and product of a gadget created from scratch, the IDs of the kernel's HID gadget example like the
+ * uinput backend uses.
+ */
+#define GADGET_VENDOR 0x0525
+#define GADGET_PRODUCT 0xa4ac
+
+struct gadget {
+    /**
+     * configfs mount point, GADGET_ROOT
+     */
+    const char *root;
+
+    /**
+     * Class directory of the UDCs, BOOT_UDC_CLASS
+     */
+    const char *udcClass;
+
+    /**
+     * Name of the gadget below usb_gadget, eg. g_multi to add the function to the board's gadget.
+     */
+    const char *name;
+
+    /**
+     * Name of the function below functions, GADGET_FUNCTION
+     */
+    const char *function;
+
+    /**
+     * UDC to bind to, or NULL for the only UDC of udcClass.
+     */
+    const char *udc;
+
+    /**
+     * Bind the gadget to the UDC. Off if a script binds it after adding more functions.
+     */
+    int bind;
+
+    enum report_mode mode;
+};
+
+/**
+ * Initializes the gadget with the defaults.
+ * @param g the gadget
+ * @param mode report layout of the function
+ */
+void gadget_init(struct gadget *g, enum report_mode mode);
+
+/**
+ * Creates or updates the gadget, its configuration and the HID function, and binds it to the UDC. The function
+ * gets the report descriptor and length of the layout, and a polling interval of 1ms, if the kernel allows to
+ * set it.
+ * @return 0 on success, -1 on error
+ */
+int gadget_setup(const struct gadget *g);
+
+/**
+ * Removes the HID function. A gadget without other functions is removed as well, one with other functions is
+ * bound to its UDC again.
+ * @return 0 on success, -1 on error
+ */
+int gadget_teardown(const struct gadget *g);
+
+/**
+ * Returns the device node of the function, eg. /dev/hidg0, from the device number the kernel assigned to it.
+ * @return 0 on success, -1 if the function has no device (yet)
+ */
+int gadget_node(const struct gadget *g, char *buf, size_t len);
+
+/**
+ * Returns the bInterval of 1ms at the maximum speed of the UDC: in frames at full speed, as exponent of
+ * 125us microframes at high speed and above.
+ * @param speed maximum_speed of the UDC, eg. "high-speed", or NULL if unknown
+ */
+int gadget_interval(const char *speed);
+
+#endif //MIDI2HID_GADGET_H
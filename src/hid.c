@@ -0,0 +1,134 @@
+#include <string.h>
+#include "hid.h"
+
+/**
+ * Short item tags, including the item type.
+ */
+#define ITEM_USAGE_PAGE 0x04
+#define ITEM_LOGICAL_MIN 0x14
+#define ITEM_LOGICAL_MAX 0x24
+#define ITEM_REPORT_SIZE 0x74
+#define ITEM_REPORT_ID 0x84
+#define ITEM_REPORT_COUNT 0x94
+#define ITEM_USAGE 0x08
+#define ITEM_USAGE_MIN 0x18
+#define ITEM_USAGE_MAX 0x28
+#define ITEM_COLLECTION 0xa0
+#define ITEM_END_COLLECTION 0xc0
+
+#define COLLECTION_APPLICATION 0x01
+
+/**
+ * Global items that are emitted only when their value changes.
+ */
+enum global {
+    GLOBAL_PAGE = 0,
+    GLOBAL_MIN,
+    GLOBAL_MAX,
+    GLOBAL_SIZE,
+    GLOBAL_COUNT,
+    GLOBALS
+};
+
+static const uint8_t global_tags[GLOBALS] = {
+        ITEM_USAGE_PAGE, ITEM_LOGICAL_MIN, ITEM_LOGICAL_MAX, ITEM_REPORT_SIZE, ITEM_REPORT_COUNT
+};
+
+struct writer {
+    uint8_t *desc;
+    size_t len;
+    size_t max;
+    int overflow;
+
+    int32_t globals[GLOBALS];
+    uint8_t known[GLOBALS];
+};
+
+static void put(struct writer *w, uint8_t tag, uint32_t value, int bytes) {
+    if (w->len + 1 + bytes > w->max) {
+        w->overflow = 1;
+        return;
+    }
+    w->desc[w->len++] = (uint8_t) (tag | (bytes == 4 ? 3 : bytes));
+    for (int i = 0; i < bytes; i++) {
+        w->desc[w->len++] = (uint8_t) (value >> (8 * i));
+    }
+}
+
+/**
+ * Writes an item with an unsigned value in the shortest form.
+ */
+static void put_unsigned(struct writer *w, uint8_t tag, uint32_t value) {
+    put(w, tag, value, value <= 0xff ? 1 : value <= 0xffff ? 2 : 4);
+}
+
+/**
+ * Writes an item with a signed value in the shortest form. The host sign extends logical values.
+ */
+static void put_signed(struct writer *w, uint8_t tag, int32_t value) {
+    int bytes = value >= -128 && value <= 127 ? 1 : value >= -32768 && value <= 32767 ? 2 : 4;
+    put(w, tag, (uint32_t) value, bytes);
+}
+
+static void put_global(struct writer *w, enum global g, int32_t value) {
+    if (w->known[g] && w->globals[g] == value) {
+        return;
+    }
+    if (g == GLOBAL_MIN || g == GLOBAL_MAX) {
+        put_signed(w, global_tags[g], value);
+    } else {
+        put_unsigned(w, global_tags[g], (uint32_t) value);
+    }
+    w->globals[g] = value;
+    w->known[g] = 1;
+}
+
+static void put_field(struct writer *w, const struct hid_field *f) {
+    if (!(f->flags & HID_CONSTANT)) {
+        put_global(w, GLOBAL_PAGE, f->page);
+        if (f->usages[0]) {
+            for (int i = 0; i < HID_MAX_USAGES && f->usages[i]; i++) {
+                put_unsigned(w, ITEM_USAGE, f->usages[i]);
+            }
+        } else {
+            put_unsigned(w, ITEM_USAGE_MIN, f->usageMin);
+            put_unsigned(w, ITEM_USAGE_MAX, f->usageMax);
+        }
+        put_global(w, GLOBAL_MIN, f->logicalMin);
+        put_global(w, GLOBAL_MAX, f->logicalMax);
+    }
+    put_global(w, GLOBAL_SIZE, f->size);
+    put_global(w, GLOBAL_COUNT, f->count);
+    put_unsigned(w, f->main, f->flags);
+}
+
+size_t hid_descriptor(const struct hid_report_def *defs, int count, uint8_t *desc, size_t max) {
+    struct writer w;
+    memset(&w, 0, sizeof(w));
+    w.desc = desc;
+    w.max = max;
+    for (int i = 0; i < count; i++) {
+        const struct hid_report_def *def = &defs[i];
+        put_global(&w, GLOBAL_PAGE, def->page);
+        put_unsigned(&w, ITEM_USAGE, def->usage);
+        put_unsigned(&w, ITEM_COLLECTION, COLLECTION_APPLICATION);
+        if (def->id) {
+            put_unsigned(&w, ITEM_REPORT_ID, def->id);
+        }
+        for (int j = 0; j < def->count; j++) {
+            put_field(&w, &def->fields[j]);
+        }
+        put(&w, ITEM_END_COLLECTION, 0, 0);
+    }
+    return w.overflow ? 0 : w.len;
+}
+
+unsigned hid_field_offset(const struct hid_report_def *def, int field, uint8_t main) {
+    unsigned bits = def->id ? 8 : 0;
+    for (int i = 0; i < field; i++) {
+        if (def->fields[i].main == main) {
+            bits += (unsigned) def->fields[i].size * def->fields[i].count;
+        }
+    }
+    return bits;
+}
@@ -0,0 +1,93 @@
+#ifndef MIDI2HID_HID_H
+#define MIDI2HID_HID_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Main item of a field.
+ */
+#define HID_INPUT 0x80
+#define HID_OUTPUT 0x90
+
+/**
+ * Data bits of a main item.
+ */
+#define HID_DATA 0x00
+#define HID_CONSTANT 0x01
+#define HID_ARRAY 0x00
+#define HID_VARIABLE 0x02
+
+/**
+ * Usage pages.
+ */
+#define HID_PAGE_DESKTOP 0x01
+#define HID_PAGE_KEYBOARD 0x07
+#define HID_PAGE_LED 0x08
+#define HID_PAGE_BUTTON 0x09
+#define HID_PAGE_CONSUMER 0x0c
+
+/**
+ * Maximum number of explicit usages of a field.
+ */
+#define HID_MAX_USAGES 8
+
+/**
+ * One field of a report: count values of size bits each. The usages are either the range usageMin-usageMax,
+ * or the explicit list when usages[0] is set. Padding has no usage page.
+ */
+struct hid_field {
+    uint8_t main;
+    uint8_t flags;
+    uint16_t page;
+    uint16_t usageMin;
+    uint16_t usageMax;
+    uint16_t usages[HID_MAX_USAGES];
+    int32_t logicalMin;
+    int32_t logicalMax;
+    uint8_t size;
+    uint8_t count;
+};
+
+/**
+ * A report as an application collection with its fields, in the order they appear in the report.
+ */
+struct hid_report_def {
+    /**
+     * Report ID, or 0 if the device has a single report without ID.
+     */
+    uint8_t id;
+
+    uint16_t page;
+    uint16_t usage;
+
+    const struct hid_field *fields;
+    int count;
+};
+
+/**
+ * Generates the report descriptor of the given reports.
+ * @param defs the reports
+ * @param count number of reports
+ * @param desc receives the descriptor
+ * @param max size of desc
+ * @return the length of the descriptor, or 0 if it doesn't fit.
+ */
+size_t hid_descriptor(const struct hid_report_def *defs, int count, uint8_t *desc, size_t max);
+
+/**
+ * Returns the position of a field in the report in bits, counting the report ID byte.
+ * @param def the report
+ * @param field index of the field, or def->count for the length of the report
+ * @param main HID_INPUT or HID_OUTPUT
+ */
+unsigned hid_field_offset(const struct hid_report_def *def, int field, uint8_t main);
+
+/**
+ * Returns the length of the input or output report in bytes, including the report ID.
+ */
+static inline size_t hid_report_len(const struct hid_report_def *def, uint8_t main) {
+    return (hid_field_offset(def, def->count, main) + 7) / 8;
+}
+
+#endif //MIDI2HID_HID_H
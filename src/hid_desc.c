@@ -0,0 +1,56 @@
+/*
+ * Prints the HID gadget settings that match the report layout of midi2hid, so that the gadget setup and
+ * the daemon share the same definition. eg:
+ *
+ *   hid_desc -n desc > functions/hid.usb0/report_desc
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "report.h"
+
+int printUsage(char *bin) {
+    fprintf(stderr, "Usage: %s [-n|-g] desc|length|protocol|subclass\n", bin);
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    enum report_mode mode = REPORT_BOOT;
+    int opt;
+    while ((opt = getopt(argc, argv, "ng")) != -1) {
+        switch (opt) {
+            case 'n':
+                mode = REPORT_NKRO;
+                break;
+            case 'g':
+                mode = REPORT_COMPOSITE;
+                break;
+            default:
+                return printUsage(argv[0]);
+        }
+    }
+    if (optind >= argc) {
+        return printUsage(argv[0]);
+    }
+    const char *what = argv[optind];
+    if (strcmp(what, "desc") == 0) {
+        uint8_t desc[REPORT_DESC_MAX_LEN];
+        size_t len = report_descriptor(mode, desc);
+        if (!len) {
+            fprintf(stderr, "desc: descriptor longer than %d bytes\n", REPORT_DESC_MAX_LEN);
+            return 1;
+        }
+        if (fwrite(desc, 1, len, stdout) != len) {
+            perror("desc");
+            return 1;
+        }
+    } else if (strcmp(what, "length") == 0) {
+        printf("%zu\n", report_max_len(mode));
+    } else if (strcmp(what, "protocol") == 0 || strcmp(what, "subclass") == 0) {
+        // only the 8 byte layout is boot protocol compatible.
+        printf("%d\n", mode == REPORT_BOOT);
+    } else {
+        return printUsage(argv[0]);
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include "hostpoll.h"
+#include "release.h"
+
+void hostpoll_init(struct hostpoll *hp) {
+    memset(hp, 0, sizeof(*hp));
+}
+
+/**
+ * Waits until the function is writable, ie. the host fetched the pending report.
+ * @return 1 if writable, 0 on timeout, HOSTPOLL_CANCELLED if the wait was aborted, -1 on error
+ */
+static int wait_writable(int fd, int cancelFd) {
+    struct pollfd pfds[2] = {{.fd = fd, .events = POLLOUT}, {.fd = cancelFd, .events = POLLIN}};
+    for (;;) {
+        int ret = poll(pfds, 2, HOSTPOLL_TIMEOUT_MS);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret < 0) {
+            perror("poll");
+            return -1;
+        }
+        if (ret > 0 && pfds[1].revents) {
+            return HOSTPOLL_CANCELLED;
+        }
+        return ret > 0 && (pfds[0].revents & POLLOUT) ? 1 : 0;
+    }
+}
+
+int hostpoll_probe(struct hostpoll *hp, struct backend *b, enum report_mode mode, int count, int cancelFd) {
+    struct report r;
+    report_init(&r, mode);
+    uint32_t before = hp->count;
+    // a report of an earlier run may still be pending, so the first write can wait as well
+    int waited = 0;
+    for (int i = 0; i < count;) {
+        ssize_t ret = b->write(b, r.data, r.len);
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            int writable = wait_writable(b->fd, cancelFd);
+            if (writable <= 0) {
+                return writable;
+            }
+            waited = 1;
+            continue;
+        }
+        if (ret != (ssize_t) r.len) {
+            perror(b->name);
+            return -1;
+        }
+        hostpoll_written(hp, release_now(), waited);
+        waited = 0;
+        i++;
+    }
+    return (int) (hp->count - before);
+}
+
+int hostpoll_estimate(const struct hostpoll *hp, struct hostpoll_estimate *est) {
+    memset(est, 0, sizeof(*est));
+    uint32_t count = hp->count;
+    int n = count < HOSTPOLL_SAMPLES ? (int) count : HOSTPOLL_SAMPLES;
+    if (n < HOSTPOLL_MIN_SAMPLES) {
+        return 0;
+    }
+    uint32_t sorted[HOSTPOLL_SAMPLES];
+    for (int i = 0; i < n; i++) {
+        uint32_t s = hp->samples[i];
+        int j = i;
+        for (; j > 0 && sorted[j - 1] > s; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = s;
+    }
+    est->interval = sorted[n / 2];
+    est->samples = n;
+    for (int i = 0; i < n; i++) {
+        if (sorted[i] > est->interval * 3 / 2) {
+            est->missed++;
+        }
+    }
+    // a writer that wakes up late, but still in time for the next poll, makes one interval longer and the next one
+    // shorter. that's the writer's latency, not the host's: the outer 5% on either side are left out.
+    for (int i = n / 20; i < n - n / 20; i++) {
+        uint64_t dev = sorted[i] > est->interval ? sorted[i] - est->interval : est->interval - sorted[i];
+        if (dev > est->jitter && dev <= est->interval / 2) {
+            est->jitter = dev;
+        }
+    }
+    return n;
+}
+
+unsigned int hostpoll_hold(const struct hostpoll_estimate *est, int polls) {
+    if (!est->interval) {
+        return 0;
+    }
+    uint64_t hold = (uint64_t) polls * est->interval + est->jitter;
+    return (unsigned int) ((hold + RELEASE_TICK_NS - 1) / RELEASE_TICK_NS);
+}
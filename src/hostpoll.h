@@ -0,0 +1,127 @@
+#ifndef MIDI2HID_HOSTPOLL_H
+#define MIDI2HID_HOSTPOLL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "backend.h"
+#include "report.h"
+
+/**
+ * Poll interval of the USB host, measured on the HID function: a write to the gadget is pending until the host
+ * fetched the report with its next poll, and the function is writable again right after. If the next report is
+ * written the moment the function becomes writable, the host fetches it one poll later, so the time between two
+ * such writes is one poll interval (or several, if the writer woke up too late for the next poll).
+ */
+
+/**
+ * Intervals kept for the estimate, the newest replace the oldest.
+ */
+#define HOSTPOLL_SAMPLES 64
+
+/**
+ * Intervals needed before there is an estimate.
+ */
+#define HOSTPOLL_MIN_SAMPLES 8
+
+/**
+ * Reports the start-up probe writes back-to-back.
+ */
+#define HOSTPOLL_PROBES 64
+
+/**
+ * Longest wait for the host to fetch a report of the probe, before the host counts as not polling, in ms.
+ */
+#define HOSTPOLL_TIMEOUT_MS 100
+
+/**
+ * Default number of polls a key stays pressed for, if the mapping doesn't specify a hold time.
+ */
+#define HOSTPOLL_HOLD_POLLS 2
+
+/**
+ * Returned by hostpoll_probe() when the cancel descriptor aborted the probe.
+ */
+#define HOSTPOLL_CANCELLED (-2)
+
+struct hostpoll {
+    /**
+     * Measured intervals in ns, HOSTPOLL_SAMPLES at most.
+     */
+    uint32_t samples[HOSTPOLL_SAMPLES];
+
+    /**
+     * Intervals measured so far, the next one goes to {@code samples[count % HOSTPOLL_SAMPLES]}.
+     */
+    uint32_t count;
+
+    /**
+     * Time of the last write that went out the moment the host fetched the previous report, or 0.
+     */
+    uint64_t last;
+};
+
+struct hostpoll_estimate {
+    /**
+     * Median interval in ns, or 0 if there are less than HOSTPOLL_MIN_SAMPLES.
+     */
+    uint64_t interval;
+
+    /**
+     * Deviation from the median in ns that 90% of the intervals stay within, not counting the ones that are
+     * more than half an interval off.
+     */
+    uint64_t jitter;
+
+    /**
+     * Intervals that spanned more than one poll, because the writer came too late for the next one.
+     */
+    int missed;
+
+    int samples;
+};
+
+void hostpoll_init(struct hostpoll *hp);
+
+/**
+ * Adds a report written to the HID function.
+ * @param hp the measurement
+ * @param now time of the write
+ * @param waited 1 if the report waited for the function to become writable, ie. it is written as the host fetched
+ * the previous one
+ */
+static inline void hostpoll_written(struct hostpoll *hp, uint64_t now, int waited) {
+    if (waited && hp->last) {
+        uint64_t interval = now - hp->last;
+        hp->samples[hp->count % HOSTPOLL_SAMPLES] = (uint32_t) (interval > UINT32_MAX ? UINT32_MAX : interval);
+        hp->count++;
+    }
+    hp->last = waited ? now : 0;
+}
+
+/**
+ * Measures the poll interval before going live: writes the empty report of the layout {@code count} times, each
+ * as soon as the host fetched the one before. The host sees no key change.
+ * @param hp the measurement
+ * @param b the HID function, which must not have other writers during the probe
+ * @param mode report layout
+ * @param count number of reports, eg. HOSTPOLL_PROBES
+ * @param cancelFd descriptor that aborts the probe when it becomes readable, or -1
+ * @return the number of intervals measured, 0 if the host doesn't poll, HOSTPOLL_CANCELLED if the probe was aborted,
+ * or -1 if writing to or polling the function failed
+ */
+int hostpoll_probe(struct hostpoll *hp, struct backend *b, enum report_mode mode, int count, int cancelFd);
+
+/**
+ * Estimates the poll interval and its jitter from the last HOSTPOLL_SAMPLES intervals.
+ * @return the number of intervals the estimate is based on, 0 if there is no estimate yet
+ */
+int hostpoll_estimate(const struct hostpoll *hp, struct hostpoll_estimate *est);
+
+/**
+ * Returns the shortest hold time that the host registers for {@code polls} polls: the poll interval times the
+ * number of polls plus the jitter, rounded up to whole ms.
+ * @return the hold time in ms, or 0 if there is no estimate
+ */
+unsigned int hostpoll_hold(const struct hostpoll_estimate *est, int polls);
+
+#endif //MIDI2HID_HOSTPOLL_H
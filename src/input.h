@@ -0,0 +1,95 @@
+#ifndef MIDI2HID_INPUT_H
+#define MIDI2HID_INPUT_H
+
+#include <poll.h>
+#include "midi.h"
+
+/**
+ * MIDI input backend. The event loop polls the descriptors of the backend and then reads
+ * events until the backend reports that it is drained.
+ */
+struct input {
+    /**
+     * Name of the backend for log messages.
+     */
+    const char *name;
+
+    /**
+     * CLOCK_MONOTONIC time the first MIDI device was connected, or 0 while there is none. The sequencer sets it
+     * from its discovery thread.
+     */
+    uint64_t connected;
+
+    /**
+     * eventfd that the backend signals when it sets {@code connected}, or -1. Set by the owner, so that it doesn't
+     * have to poll for the first device.
+     */
+    int connectFd;
+
+    /**
+     * Fills in the poll descriptors of the backend.
+     * @return the number of descriptors, at most {@code max}.
+     */
+    int (*poll_descriptors)(struct input *in, struct pollfd *pfds, int max);
+
+    /**
+     * Reads the next event without blocking.
+     * @return 1 if {@code ev} was filled, 0 if the input is drained, -1 on error.
+     */
+    int (*read)(struct input *in, struct midi_event *ev);
+
+    /**
+     * Restricts the delivered events to the given types, so that the others don't even wake up the event loop.
+     * NULL if the backend can't filter.
+     * @param types set of MIDI_TYPE_BIT()
+     * @return 0 on success, -1 on error.
+     */
+    int (*filter)(struct input *in, unsigned types);
+
+    /**
+     * Discards the events that are pending, without delivering them. NULL if the backend has nothing to discard.
+     */
+    void (*drop)(struct input *in);
+
+    /**
+     * Closes the backend and frees it.
+     */
+    void (*close)(struct input *in);
+};
+
+/**
+ * Drains the input into the batch: reads events without blocking until the input has no more or the batch is
+ * full. Both backends read their descriptor in large chunks, so this costs one syscall per chunk, not per event.
+ * @param in the input
+ * @param b the batch, its previous events are discarded
+ * @return the number of events, or -1 on error. A full batch means that more events may be pending.
+ */
+static inline int input_drain(struct input *in, struct midi_batch *b) {
+    struct midi_event ev;
+    int ret = 0;
+    b->count = 0;
+    while (b->count < MIDI_BATCH_LEN && (ret = in->read(in, &ev)) > 0) {
+        midi_batch_add(b, &ev);
+    }
+    return ret < 0 && !b->count ? -1 : b->count;
+}
+
+/**
+ * Opens the ALSA sequencer backend. The readable ports of every client whose name matches one of the
+ * patterns are subscribed at startup, and a discovery thread that follows the System Announce port (0:1)
+ * subscribes devices that are plugged in later. Events carry the index of the matching pattern.
+ * @param patterns fnmatch() patterns of the client names, {@code *} matches any device
+ * @param count number of patterns
+ * @return the backend or NULL
+ */
+struct input *input_seq_open(const char *const *patterns, int count);
+
+/**
+ * Opens the raw MIDI backend, which parses the MIDI byte stream itself. Device names starting
+ * with {@code hw:} are opened as ALSA rawmidi devices, everything else as file, pipe or serial tty.
+ * @param dev the device
+ * @return the backend or NULL
+ */
+struct input *input_raw_open(const char *dev);
+
+#endif //MIDI2HID_INPUT_H
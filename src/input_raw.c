@@ -0,0 +1,159 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <alsa/asoundlib.h>
+#include "input.h"
+#include "release.h"
+
+#define RAW_BUF_LEN 256
+
+/**
+ * Raw MIDI backend. Reads the byte stream of a rawmidi device or a file descriptor and parses it.
+ */
+struct input_raw {
+    struct input base;
+
+    /**
+     * ALSA rawmidi handle, or NULL if reading from {@code fd}.
+     */
+    snd_rawmidi_t *rawmidi;
+    int fd;
+
+    struct midi_parser parser;
+    uint8_t buf[RAW_BUF_LEN];
+    size_t pos;
+    size_t len;
+};
+
+static int raw_poll_descriptors(struct input *base, struct pollfd *pfds, int max) {
+    struct input_raw *in = (struct input_raw *) base;
+    if (in->rawmidi) {
+        return snd_rawmidi_poll_descriptors(in->rawmidi, pfds, (unsigned int) max);
+    }
+    if (max < 1) {
+        return 0;
+    }
+    pfds[0].fd = in->fd;
+    pfds[0].events = POLLIN;
+    return 1;
+}
+
+/**
+ * Refills the buffer.
+ * @return the number of bytes read, 0 if nothing is pending, -1 on error or end of file.
+ */
+static ssize_t raw_fill(struct input_raw *in) {
+    ssize_t n;
+    if (in->rawmidi) {
+        n = snd_rawmidi_read(in->rawmidi, in->buf, RAW_BUF_LEN);
+        if (n == -EAGAIN) {
+            return 0;
+        }
+        if (n < 0) {
+            fprintf(stderr, "rawmidi: %s\n", snd_strerror((int) n));
+            return -1;
+        }
+    } else {
+        n = read(in->fd, in->buf, RAW_BUF_LEN);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                return 0;
+            }
+            perror("raw");
+            return -1;
+        }
+        if (n == 0) {
+            return -1;
+        }
+    }
+    in->pos = 0;
+    in->len = (size_t) n;
+    return n;
+}
+
+static int raw_read(struct input *base, struct midi_event *ev) {
+    struct input_raw *in = (struct input_raw *) base;
+    while (1) {
+        while (in->pos < in->len) {
+            if (midi_parse(&in->parser, in->buf[in->pos++], ev)) {
+                return 1;
+            }
+        }
+        ssize_t n = raw_fill(in);
+        if (n <= 0) {
+            return (int) n;
+        }
+    }
+}
+
+/**
+ * Reads and discards what the device or pipe received so far. The parser starts over, so it waits for the next
+ * status byte instead of applying the running status of a discarded message. A regular file has nothing stale to
+ * discard, it is played from the start.
+ */
+static void raw_drop(struct input *base) {
+    struct input_raw *in = (struct input_raw *) base;
+    struct stat st;
+    if (!in->rawmidi && fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        return;
+    }
+    while (raw_fill(in) > 0) {
+    }
+    in->pos = 0;
+    in->len = 0;
+    midi_parser_init(&in->parser);
+}
+
+static void raw_close(struct input *base) {
+    struct input_raw *in = (struct input_raw *) base;
+    if (in->rawmidi) {
+        snd_rawmidi_close(in->rawmidi);
+    } else {
+        close(in->fd);
+    }
+    free(in);
+}
+
+struct input *input_raw_open(const char *dev) {
+    struct input_raw *in = calloc(1, sizeof(struct input_raw));
+    if (!in) {
+        return NULL;
+    }
+    in->base.name = "raw";
+    in->base.poll_descriptors = raw_poll_descriptors;
+    in->base.read = raw_read;
+    in->base.drop = raw_drop;
+    in->base.close = raw_close;
+    in->base.connectFd = -1;
+    in->fd = -1;
+    midi_parser_init(&in->parser);
+
+    if (strncmp(dev, "hw:", 3) == 0) {
+        int err = snd_rawmidi_open(&in->rawmidi, NULL, dev, SND_RAWMIDI_NONBLOCK);
+        if (err < 0) {
+            fprintf(stderr, "%s: %s\n", dev, snd_strerror(err));
+            free(in);
+            return NULL;
+        }
+    } else {
+        if ((in->fd = open(dev, O_RDONLY | O_NONBLOCK | O_NOCTTY)) < 0) {
+            perror(dev);
+            free(in);
+            return NULL;
+        }
+        // serial ports need raw mode, otherwise the tty layer eats or rewrites bytes.
+        struct termios tio;
+        if (isatty(in->fd) && tcgetattr(in->fd, &tio) == 0) {
+            cfmakeraw(&tio);
+            tcsetattr(in->fd, TCSANOW, &tio);
+        }
+    }
+    printf("Reading raw MIDI from %s\n", dev);
+    in->base.connected = release_now();
+    return &in->base;
+}
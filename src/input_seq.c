@@ -0,0 +1,381 @@
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <alsa/asoundlib.h>
+#include "input.h"
+
+#define CHK(stmt, msg) if((stmt) < 0) {puts("ERROR: "#msg); exit(1);}
+
+/**
+ * ALSA sequencer backend.
+ */
+struct input_seq {
+    struct input base;
+    snd_seq_t *seq_handle;
+    int in_port;
+    int in_client_id;
+
+    /**
+     * Queue that timestamps the incoming events.
+     */
+    int queue;
+
+    /**
+     * CLOCK_MONOTONIC time when the queue was started, in nanoseconds.
+     */
+    uint64_t queueStart;
+
+    /**
+     * Device index of every sequencer client, or MIDI_NO_DEVICE. Written by the discovery thread,
+     * read by the event loop.
+     */
+    uint8_t deviceOf[256];
+
+    /**
+     * Client name patterns of the devices.
+     */
+    const char *const *patterns;
+    int numPatterns;
+
+    /**
+     * Second sequencer client, that receives the announcements and makes the subscriptions. The event loop
+     * never talks to the sequencer about anything but events.
+     */
+    snd_seq_t *discovery;
+    int discoveryPort;
+    int stopFd;
+    pthread_t thread;
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void midi_open(struct input_seq *in) {
+    // duplex, because starting the timestamp queue sends an event to the system client.
+    CHK(snd_seq_open(&in->seq_handle, "default", SND_SEQ_OPEN_DUPLEX, 0), "Could not open sequencer");
+    CHK(snd_seq_set_client_name(in->seq_handle, "midi2hid"), "Could not set client name");
+    CHK(in->in_port = snd_seq_create_simple_port(in->seq_handle, "listen:in",
+                                                 SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+                                                 SND_SEQ_PORT_TYPE_APPLICATION),
+        "Could not open port");
+    CHK(in->queue = snd_seq_alloc_named_queue(in->seq_handle, "midi2hid"), "Could not allocate queue");
+    CHK(snd_seq_start_queue(in->seq_handle, in->queue, NULL), "Could not start queue");
+    CHK(snd_seq_drain_output(in->seq_handle), "Could not start queue");
+    in->queueStart = monotonic_ns();
+    CHK(snd_seq_nonblock(in->seq_handle, 1), "Could not set non-blocking mode");
+    in->in_client_id = snd_seq_client_id(in->seq_handle);
+    printf("Started client on %d:%d\n", in->in_client_id, in->in_port);
+}
+
+/**
+ * Returns the device whose pattern matches the client, or MIDI_NO_DEVICE.
+ */
+static uint8_t match_client(const struct input_seq *in, int client, const char *name) {
+    if (client == SND_SEQ_CLIENT_SYSTEM || client == in->in_client_id || client == snd_seq_client_id(in->discovery)) {
+        return MIDI_NO_DEVICE;
+    }
+    for (int i = 0; i < in->numPatterns; i++) {
+        // the catch-all pattern doesn't want the loopback ports
+        if (strcmp(in->patterns[i], "*") == 0 && strcmp(name, "Midi Through") == 0) {
+            continue;
+        }
+        if (fnmatch(in->patterns[i], name, 0) == 0) {
+            return (uint8_t) i;
+        }
+    }
+    return MIDI_NO_DEVICE;
+}
+
+/**
+ * Subscribes our input port to the given port of a device, stamping the events with the real time of our queue.
+ * Made by the discovery client on behalf of the event client.
+ */
+static void midi_capture(struct input_seq *in, int client, int port) {
+    snd_seq_addr_t sender, dest;
+    snd_seq_port_subscribe_t *subs;
+    sender.client = (__uint8_t) client;
+    sender.port = (__uint8_t) port;
+    dest.client = (__uint8_t) in->in_client_id;
+    dest.port = (__uint8_t) in->in_port;
+    snd_seq_port_subscribe_alloca(&subs);
+    snd_seq_port_subscribe_set_sender(subs, &sender);
+    snd_seq_port_subscribe_set_dest(subs, &dest);
+    snd_seq_port_subscribe_set_queue(subs, in->queue);
+    snd_seq_port_subscribe_set_time_update(subs, 1);
+    snd_seq_port_subscribe_set_time_real(subs, 1);
+    if (snd_seq_subscribe_port(in->discovery, subs) < 0) {
+        fprintf(stderr, "Could not subscribe to %d:%d.\n", client, port);
+    } else {
+        printf("Subscribed to %d:%d\n", client, port);
+        if (!__atomic_load_n(&in->base.connected, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&in->base.connected, monotonic_ns(), __ATOMIC_RELEASE);
+            int fd = __atomic_load_n(&in->base.connectFd, __ATOMIC_ACQUIRE);
+            uint64_t one = 1;
+            if (fd >= 0 && write(fd, &one, sizeof(one)) < 0) {
+                perror("eventfd");
+            }
+        }
+    }
+}
+
+/**
+ * Subscribes to the port if it is a readable port of a configured device.
+ */
+static void discover_port(struct input_seq *in, int client, int port) {
+    snd_seq_client_info_t *cinfo;
+    snd_seq_port_info_t *pinfo;
+    snd_seq_client_info_alloca(&cinfo);
+    snd_seq_port_info_alloca(&pinfo);
+    if (snd_seq_get_any_client_info(in->discovery, client, cinfo) < 0
+            || snd_seq_get_any_port_info(in->discovery, client, port, pinfo) < 0) {
+        return;
+    }
+    unsigned int caps = snd_seq_port_info_get_capability(pinfo);
+    if ((caps & (SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ)) != (SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ)
+            || (caps & SND_SEQ_PORT_CAP_NO_EXPORT)) {
+        return;
+    }
+    const char *name = snd_seq_client_info_get_name(cinfo);
+    uint8_t device = match_client(in, client, name);
+    if (device == MIDI_NO_DEVICE) {
+        return;
+    }
+    printf("device %d: %s (%d:%d)\n", device, name, client, port);
+    // mapped before the subscription, so the first event already finds its device.
+    __atomic_store_n(&in->deviceOf[client], device, __ATOMIC_RELAXED);
+    midi_capture(in, client, port);
+}
+
+/**
+ * Subscribes to all matching ports that exist already.
+ */
+static void discover_all(struct input_seq *in) {
+    snd_seq_client_info_t *cinfo;
+    snd_seq_port_info_t *pinfo;
+    snd_seq_client_info_alloca(&cinfo);
+    snd_seq_port_info_alloca(&pinfo);
+    snd_seq_client_info_set_client(cinfo, -1);
+    while (snd_seq_query_next_client(in->discovery, cinfo) >= 0) {
+        int client = snd_seq_client_info_get_client(cinfo);
+        snd_seq_port_info_set_client(pinfo, client);
+        snd_seq_port_info_set_port(pinfo, -1);
+        while (snd_seq_query_next_port(in->discovery, pinfo) >= 0) {
+            discover_port(in, client, snd_seq_port_info_get_port(pinfo));
+        }
+    }
+}
+
+/**
+ * Follows the System Announce port: subscribes to new ports of matching clients and forgets clients that are gone.
+ * The kernel removes the subscriptions of a vanished port by itself.
+ */
+static void *discovery_thread(void *arg) {
+    struct input_seq *in = arg;
+    struct pollfd pfds[9];
+    pfds[0].fd = in->stopFd;
+    pfds[0].events = POLLIN;
+    int n = snd_seq_poll_descriptors(in->discovery, &pfds[1], 8, POLLIN);
+    while (1) {
+        if (poll(pfds, (nfds_t) (n + 1), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("discovery");
+            return NULL;
+        }
+        if (pfds[0].revents & POLLIN) {
+            return NULL;
+        }
+        snd_seq_event_t *ev;
+        while (snd_seq_event_input(in->discovery, &ev) >= 0) {
+            switch (ev->type) {
+                case SND_SEQ_EVENT_PORT_START:
+                    discover_port(in, ev->data.addr.client, ev->data.addr.port);
+                    break;
+                case SND_SEQ_EVENT_CLIENT_EXIT:
+                    if (in->deviceOf[ev->data.addr.client] != MIDI_NO_DEVICE) {
+                        printf("device %d: client %d is gone\n", in->deviceOf[ev->data.addr.client],
+                               ev->data.addr.client);
+                        __atomic_store_n(&in->deviceOf[ev->data.addr.client], MIDI_NO_DEVICE, __ATOMIC_RELAXED);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+/**
+ * Opens the discovery client, subscribes it to the System Announce port and scans the existing clients.
+ */
+static int discovery_open(struct input_seq *in) {
+    memset(in->deviceOf, MIDI_NO_DEVICE, sizeof(in->deviceOf));
+    if (snd_seq_open(&in->discovery, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK) < 0) {
+        fprintf(stderr, "Could not open discovery client\n");
+        return -1;
+    }
+    snd_seq_set_client_name(in->discovery, "midi2hid-discovery");
+    if ((in->discoveryPort = snd_seq_create_simple_port(in->discovery, "announce:in",
+                                                        SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_NO_EXPORT,
+                                                        SND_SEQ_PORT_TYPE_APPLICATION)) < 0
+            || snd_seq_connect_from(in->discovery, in->discoveryPort, SND_SEQ_CLIENT_SYSTEM,
+                                    SND_SEQ_PORT_SYSTEM_ANNOUNCE) < 0) {
+        fprintf(stderr, "Could not subscribe to the System Announce port\n");
+        return -1;
+    }
+    // the initial scan happens before the event loop runs, so devices that are already there don't miss any event.
+    discover_all(in);
+    if ((in->stopFd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        perror("eventfd");
+        return -1;
+    }
+    if (pthread_create(&in->thread, NULL, discovery_thread, in) != 0) {
+        perror("pthread_create");
+        return -1;
+    }
+    return 0;
+}
+
+static int seq_poll_descriptors(struct input *base, struct pollfd *pfds, int max) {
+    struct input_seq *in = (struct input_seq *) base;
+    return snd_seq_poll_descriptors(in->seq_handle, pfds, (unsigned int) max, POLLIN);
+}
+
+/**
+ * Reads the next event from the sequencer. The sequencer is opened in non-blocking mode, so this
+ * returns 0 as soon as the input is drained.
+ */
+static int seq_read(struct input *base, struct midi_event *ev) {
+    struct input_seq *in = (struct input_seq *) base;
+    snd_seq_event_t *sev = NULL;
+    int ret = snd_seq_event_input(in->seq_handle, &sev);
+    if (ret == -EAGAIN) {
+        return 0;
+    }
+    if (ret < 0) {
+        // -ENOSPC means the kernel queue overran. the events are lost, but we can continue.
+        if (ret != -ENOSPC) {
+            fprintf(stderr, "seq: %s\n", snd_strerror(ret));
+            return -1;
+        }
+        return 0;
+    }
+    switch (sev->type) {
+        case SND_SEQ_EVENT_NOTEON:
+        case SND_SEQ_EVENT_NOTEOFF:
+            ev->type = sev->type == SND_SEQ_EVENT_NOTEON ? MIDI_NOTEON : MIDI_NOTEOFF;
+            ev->channel = sev->data.note.channel & 0x0f;
+            ev->note = sev->data.note.note & 0x7f;
+            ev->value = sev->data.note.velocity & 0x7f;
+            break;
+        case SND_SEQ_EVENT_CONTROLLER:
+            ev->type = MIDI_CONTROLLER;
+            ev->channel = sev->data.control.channel & 0x0f;
+            ev->note = (uint8_t) (sev->data.control.param & 0x7f);
+            ev->value = (uint8_t) (sev->data.control.value & 0x7f);
+            break;
+        default:
+            ev->type = MIDI_OTHER;
+            ev->channel = 0;
+            ev->note = 0;
+            ev->value = 0;
+            break;
+    }
+    ev->device = __atomic_load_n(&in->deviceOf[sev->source.client], __ATOMIC_RELAXED);
+    // the subscription asks the queue to stamp every event with its real time.
+    if ((sev->flags & SND_SEQ_TIME_STAMP_MASK) == SND_SEQ_TIME_STAMP_REAL && sev->queue == in->queue) {
+        ev->stamp = in->queueStart + (uint64_t) sev->time.time.tv_sec * 1000000000ULL + sev->time.time.tv_nsec;
+    } else {
+        ev->stamp = 0;
+    }
+    return 1;
+}
+
+/**
+ * Sets the event filter of the event client. The kernel drops the other events before they are queued for us,
+ * so clock, active sensing and unmapped controllers never cause a wakeup.
+ */
+static int seq_filter(struct input *base, unsigned types) {
+    static const struct {
+        uint8_t midi;
+        snd_seq_event_type_t seq;
+    } map[] = {
+            {MIDI_NOTEOFF, SND_SEQ_EVENT_NOTEOFF},
+            {MIDI_NOTEON, SND_SEQ_EVENT_NOTEON},
+            {MIDI_KEYPRESS, SND_SEQ_EVENT_KEYPRESS},
+            {MIDI_CONTROLLER, SND_SEQ_EVENT_CONTROLLER},
+            {MIDI_PGMCHANGE, SND_SEQ_EVENT_PGMCHANGE},
+            {MIDI_CHANPRESS, SND_SEQ_EVENT_CHANPRESS},
+            {MIDI_PITCHBEND, SND_SEQ_EVENT_PITCHBEND},
+    };
+    struct input_seq *in = (struct input_seq *) base;
+    snd_seq_client_info_t *info;
+    snd_seq_client_info_alloca(&info);
+    if (snd_seq_get_client_info(in->seq_handle, info) < 0) {
+        return -1;
+    }
+    snd_seq_client_info_event_filter_clear(info);
+    for (unsigned i = 0; i < sizeof(map) / sizeof(map[0]); i++) {
+        if (types & MIDI_TYPE_BIT(map[i].midi)) {
+            snd_seq_client_info_event_filter_add(info, map[i].seq);
+        }
+    }
+    int ret = snd_seq_set_client_info(in->seq_handle, info);
+    if (ret < 0) {
+        fprintf(stderr, "seq: could not set the event filter: %s\n", snd_strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Drops the events in our input buffer and the ones the kernel queued for us.
+ */
+static void seq_drop(struct input *base) {
+    struct input_seq *in = (struct input_seq *) base;
+    int ret = snd_seq_drop_input(in->seq_handle);
+    if (ret < 0) {
+        fprintf(stderr, "seq: could not drop the input: %s\n", snd_strerror(ret));
+    }
+}
+
+static void seq_close(struct input *base) {
+    struct input_seq *in = (struct input_seq *) base;
+    uint64_t val = 1;
+    if (write(in->stopFd, &val, sizeof(val)) == sizeof(val)) {
+        pthread_join(in->thread, NULL);
+    }
+    snd_seq_close(in->discovery);
+    snd_seq_close(in->seq_handle);
+    free(in);
+}
+
+struct input *input_seq_open(const char *const *patterns, int count) {
+    struct input_seq *in = calloc(1, sizeof(struct input_seq));
+    if (!in) {
+        return NULL;
+    }
+    in->base.name = "seq";
+    in->base.poll_descriptors = seq_poll_descriptors;
+    in->base.read = seq_read;
+    in->base.filter = seq_filter;
+    in->base.drop = seq_drop;
+    in->base.close = seq_close;
+    in->base.connectFd = -1;
+    in->patterns = patterns;
+    in->numPatterns = count;
+    midi_open(in);
+    if (discovery_open(in)) {
+        snd_seq_close(in->seq_handle);
+        free(in);
+        return NULL;
+    }
+    return &in->base;
+}
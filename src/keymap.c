@@ -0,0 +1,924 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "keymap.h"
+#include "report.h"
+
+/**
+ * Maximum number of lines in a profile.
+ */
+#define MAX_ENTRIES 2048
+
+struct options {
+    const char *opt;
+    uint8_t val;
+};
+
+// keyboard modifiers
+static struct options kmod[] = {
+        {.opt = "--left-ctrl", .val = 0x01},
+        {.opt = "--right-ctrl", .val = 0x10},
+        {.opt = "--left-shift", .val = 0x02},
+        {.opt = "--right-shift", .val = 0x20},
+        {.opt = "--left-alt", .val = 0x04},
+        {.opt = "--right-alt", .val = 0x40},
+        {.opt = "--left-meta", .val = 0x08},
+        {.opt = "--right-meta", .val = 0x80},
+        {.opt = NULL}
+};
+
+static struct options kval[] = {
+        {.opt = "--return", .val = 0x28},
+        {.opt = "--esc", .val = 0x29},
+        {.opt = "--bckspc", .val = 0x2a},
+        {.opt = "--tab", .val = 0x2b},
+        {.opt = "--spacebar", .val = 0x2c},
+        {.opt = "--caps-lock", .val = 0x39},
+        {.opt = "--f1", .val = 0x3a},
+        {.opt = "--f2", .val = 0x3b},
+        {.opt = "--f3", .val = 0x3c},
+        {.opt = "--f4", .val = 0x3d},
+        {.opt = "--f5", .val = 0x3e},
+        {.opt = "--f6", .val = 0x3f},
+        {.opt = "--f7", .val = 0x40},
+        {.opt = "--f8", .val = 0x41},
+        {.opt = "--f9", .val = 0x42},
+        {.opt = "--f10", .val = 0x43},
+        {.opt = "--f11", .val = 0x44},
+        {.opt = "--f12", .val = 0x45},
+        {.opt = "--insert", .val = 0x49},
+        {.opt = "--home", .val = 0x4a},
+        {.opt = "--pageup", .val = 0x4b},
+        {.opt = "--del", .val = 0x4c},
+        {.opt = "--end", .val = 0x4d},
+        {.opt = "--pagedown", .val = 0x4e},
+        {.opt = "--right", .val = 0x4f},
+        {.opt = "--left", .val = 0x50},
+        {.opt = "--down", .val = 0x51},
+        {.opt = "--kp-enter", .val = 0x58},
+        {.opt = "--up", .val = 0x52},
+        {.opt = "--num-lock", .val = 0x53},
+        // composite layout (-g): gamepad buttons and axes, consumer controls. see report.h
+        {.opt = "--button1", .val = 0x80},
+        {.opt = "--button2", .val = 0x81},
+        {.opt = "--button3", .val = 0x82},
+        {.opt = "--button4", .val = 0x83},
+        {.opt = "--button5", .val = 0x84},
+        {.opt = "--button6", .val = 0x85},
+        {.opt = "--button7", .val = 0x86},
+        {.opt = "--button8", .val = 0x87},
+        {.opt = "--button9", .val = 0x88},
+        {.opt = "--button10", .val = 0x89},
+        {.opt = "--button11", .val = 0x8a},
+        {.opt = "--button12", .val = 0x8b},
+        {.opt = "--button13", .val = 0x8c},
+        {.opt = "--button14", .val = 0x8d},
+        {.opt = "--button15", .val = 0x8e},
+        {.opt = "--button16", .val = 0x8f},
+        {.opt = "--axis-x", .val = 0x90},
+        {.opt = "--axis-y", .val = 0x91},
+        {.opt = "--axis-z", .val = 0x92},
+        {.opt = "--axis-rz", .val = 0x93},
+        {.opt = "--mute", .val = 0xa0},
+        {.opt = "--vol-up", .val = 0xa1},
+        {.opt = "--vol-down", .val = 0xa2},
+        {.opt = "--play-pause", .val = 0xa3},
+        {.opt = "--stop", .val = 0xa4},
+        {.opt = "--next-track", .val = 0xa5},
+        {.opt = "--prev-track", .val = 0xa6},
+        {.opt = "--eject", .val = 0xa7},
+        {.opt = "--fast-forward", .val = 0xa8},
+        {.opt = "--rewind", .val = 0xa9},
+        {.opt = "--record", .val = 0xaa},
+        {.opt = "--ac-home", .val = 0xab},
+        {.opt = "--ac-back", .val = 0xac},
+        {.opt = "--ac-forward", .val = 0xad},
+        {.opt = "--calculator", .val = 0xae},
+        {.opt = "--browser", .val = 0xaf},
+        {.opt = NULL}
+};
+
+static const char *release_names[] = {"fixed", "velocity", "noteoff", "macro"};
+
+/**
+ * Built-in profile for the Roland TD-1, used when no profile file is given.
+ * |----------------|--------|
+ * | Pad            | Note   |
+ * +----------------+--------+
+ * | Kick           | `0x24` |
+ * | Snare Head     | `0x26` |
+ * | Snare Rim      | `0x28` |
+ * | Tom 1          | `0x30` |
+ * | Tom 2          | `0x2d` |
+ * | Tom 3          | `0x2b` |
+ * | HH Open Bow    | `0x2e` |
+ * | HH Open Edge   | `0x1a` |
+ * | HH Closed Bow  | `0x2a` |
+ * | HH Closed Edge | `0x16` |
+ * | HH foot closed | `0x2c` |
+ * | Crash 1 (Bow)  | `0x31` |
+ * | Crash 1 (Edge) | `0x37` |
+ * | Crash 2 (Bow)  | `0x00` |
+ * | Crash 2 (Edge) | `0x00` |
+ * | Ride  2 (Bow)  | `0x33` |
+ * | Ride  2 (Edge) | `0x3b` |
+ */
+static const char *default_profile =
+        "0x24 --spacebar  # kick\n"
+        "0x2e w           # high hat (yellow)\n"
+        "0x1a w           # high hat (yellow)\n"
+        "0x2a w           # high hat (yellow)\n"
+        "0x16 w           # high hat (yellow)\n"
+        "0x30 y           # blue tom\n"
+        "0x31 y           # crash (orange?)\n"
+        "0x37 y           # crash (orange?)\n"
+        "0x2d h           # green tom\n"
+        "0x2b --return    # 3rd tom\n"
+        "0x33 y           # ride (orange?)\n"
+        "0x3b y           # ride (orange?)\n"
+        "0x26 s           # snare (red)\n"
+        "0x28 s           # snare (red)\n";
+
+/**
+ * Parsed profile line.
+ */
+struct entry {
+    /**
+     * MIDI channel (0-15) or -1 for all channels.
+     */
+    int channel;
+
+    uint8_t note;
+
+    struct action action;
+
+    /**
+     * Name of the macro of a note entry that runs a macro, or empty.
+     */
+    char macro[KEYMAP_MACRO_NAME];
+
+    /**
+     * Controller of a band entry, or -1 for a note entry.
+     */
+    int controller;
+
+    struct band band;
+};
+
+/**
+ * Finds the option in the given list.
+ * @param opts Options list
+ * @param tok Token to find
+ * @return the value of the option or 0.
+ */
+static uint8_t findOption(const struct options *opts, const char *tok) {
+    for (int i = 0; opts[i].opt != NULL; i++) {
+        if (strcmp(tok, opts[i].opt) == 0) {
+            return opts[i].val;
+        }
+    }
+    return 0;
+}
+
+uint8_t mapKey(const char *key) {
+    unsigned char val = findOption(kval, key);
+    if (val) {
+        return val;
+    }
+    const char t = key[0];
+    if (key[1] == 0) {
+        if (t >= 'a' && t <= 'z') {
+            return (unsigned char) (t - ('a' - 0x04));
+        } else if (t >= '1' && t <= '9') {
+            return (unsigned char) (t - ('1' - 0x1e));
+        } else if (t == '0') {
+            return (unsigned char) (0x27);
+        }
+    }
+    fprintf(stderr, "unknown option: %s\n", key);
+    return 0;
+}
+
+int keymap_parse_key(const char *spec, uint8_t *key, uint8_t *mods) {
+    char buf[64];
+    if (strlen(spec) >= sizeof(buf)) {
+        return -1;
+    }
+    strcpy(buf, spec);
+    *key = 0;
+    *mods = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, "+", &save); tok; tok = strtok_r(NULL, "+", &save)) {
+        uint8_t mod = findOption(kmod, tok);
+        if (mod) {
+            *mods |= mod;
+        } else if (*key) {
+            fprintf(stderr, "more than one key in: %s\n", spec);
+            return -1;
+        } else if (!(*key = mapKey(tok))) {
+            return -1;
+        }
+    }
+    return *key ? 0 : -1;
+}
+
+/**
+ * Parses a number in the range [min, max].
+ * @return 0 on success, -1 on error.
+ */
+static int parse_num(const char *s, long min, long max, long *val) {
+    char *end;
+    *val = strtol(s, &end, 0);
+    return *s && !*end && *val >= min && *val <= max ? 0 : -1;
+}
+
+/**
+ * Parses the key and the thresholds of a controller band.
+ */
+static int parse_band(struct entry *e, char **save) {
+    char *tok;
+    long val;
+    if (!(tok = strtok_r(NULL, " \t\r\n", save))) {
+        fprintf(stderr, "missing key\n");
+        return -1;
+    }
+    if (keymap_parse_key(tok, &e->band.key, &e->band.mods)) {
+        fprintf(stderr, "invalid key: %s\n", tok);
+        return -1;
+    }
+    // an axis takes the velocity of a hit, a controller band has none
+    if (report_is_axis(e->band.key)) {
+        fprintf(stderr, "an axis can't be held by a controller: %s\n", tok);
+        return -1;
+    }
+    e->band.down = DEFAULT_CC_DOWN;
+    e->band.up = DEFAULT_CC_UP;
+    while ((tok = strtok_r(NULL, " \t\r\n", save))) {
+        if (strncmp(tok, "down=", 5) == 0 && !parse_num(tok + 5, 0, 127, &val)) {
+            e->band.down = (uint8_t) val;
+        } else if (strncmp(tok, "up=", 3) == 0 && !parse_num(tok + 3, 0, 127, &val)) {
+            e->band.up = (uint8_t) val;
+        } else {
+            fprintf(stderr, "invalid option: %s\n", tok);
+            return -1;
+        }
+    }
+    if (e->band.down == e->band.up) {
+        fprintf(stderr, "band without hysteresis: down=%d up=%d\n", e->band.down, e->band.up);
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_line(char *line, struct entry *e) {
+    char *save = NULL;
+    char *tok = strtok_r(line, " \t\r\n", &save);
+    long val;
+
+    memset(e, 0, sizeof(*e));
+    e->channel = -1;
+    e->action.minVelocity = DEFAULT_MIN_VELOCITY;
+
+    char *colon = strchr(tok, ':');
+    if (colon) {
+        *colon = 0;
+        if (strcmp(tok, "*") != 0) {
+            if (parse_num(tok, 1, KEYMAP_CHANNELS, &val)) {
+                fprintf(stderr, "invalid channel: %s\n", tok);
+                return -1;
+            }
+            e->channel = (int) val - 1;
+        }
+        tok = colon + 1;
+    }
+    e->controller = -1;
+    if (strncmp(tok, "cc", 2) == 0) {
+        if (parse_num(tok + 2, 0, KEYMAP_CONTROLLERS - 1, &val)) {
+            fprintf(stderr, "invalid controller: %s\n", tok);
+            return -1;
+        }
+        e->controller = (int) val;
+        return parse_band(e, &save);
+    }
+    if (parse_num(tok, 0, KEYMAP_NOTES - 1, &val)) {
+        fprintf(stderr, "invalid note: %s\n", tok);
+        return -1;
+    }
+    e->note = (uint8_t) val;
+
+    if (!(tok = strtok_r(NULL, " \t\r\n", &save))) {
+        fprintf(stderr, "missing key\n");
+        return -1;
+    }
+    if (tok[0] == '@') {
+        // resolved once all macros are known
+        if (!tok[1] || strlen(tok + 1) >= KEYMAP_MACRO_NAME) {
+            fprintf(stderr, "invalid macro name: %s\n", tok);
+            return -1;
+        }
+        strcpy(e->macro, tok + 1);
+        e->action.release = RELEASE_MACRO;
+    } else if (keymap_parse_key(tok, &e->action.key, &e->action.mods)) {
+        fprintf(stderr, "invalid key: %s\n", tok);
+        return -1;
+    }
+
+    while ((tok = strtok_r(NULL, " \t\r\n", &save))) {
+        if (strncmp(tok, "vel=", 4) == 0 && !parse_num(tok + 4, 1, 127, &val)) {
+            e->action.minVelocity = (uint8_t) val;
+        } else if (e->macro[0]) {
+            fprintf(stderr, "a macro only takes vel=: %s\n", tok);
+            return -1;
+        } else if (strncmp(tok, "hold=", 5) == 0 && !parse_num(tok + 5, 1, 0xffff, &val)) {
+            e->action.hold = (uint16_t) val;
+        } else if (strcmp(tok, "release=fixed") == 0) {
+            e->action.release = RELEASE_FIXED;
+        } else if (strcmp(tok, "release=velocity") == 0) {
+            e->action.release = RELEASE_VELOCITY;
+        } else if (strcmp(tok, "release=noteoff") == 0) {
+            e->action.release = RELEASE_NOTEOFF;
+        } else {
+            fprintf(stderr, "invalid option: %s\n", tok);
+            return -1;
+        }
+    }
+    // without a hold time, the key is held as short as the host allows
+    if (!e->action.hold && !e->macro[0] && e->action.release == RELEASE_NOTEOFF) {
+        e->action.hold = NOTEOFF_MAX_HOLD_MS;
+    }
+    return 0;
+}
+
+/**
+ * Appends a step to the macro program.
+ */
+static int add_step(struct keymap *km, uint8_t op, uint8_t key, uint16_t arg) {
+    if (km->numSteps == KEYMAP_MAX_STEPS) {
+        fprintf(stderr, "too many macro steps\n");
+        return -1;
+    }
+    km->steps[km->numSteps++] = (struct macro_step) {.op = op, .key = key, .arg = arg};
+    return 0;
+}
+
+/**
+ * Compiles a {@code macro name step...} line into a step program. A tapped key becomes press, wait and release.
+ */
+static int parse_macro(struct keymap *km, char *line) {
+    char *save = NULL;
+    char *tok;
+    long val;
+    uint8_t key, mods;
+    uint8_t pressed[256];
+
+    strtok_r(line, " \t\r\n", &save);
+    char *name = strtok_r(NULL, " \t\r\n", &save);
+    if (!name || strlen(name) >= KEYMAP_MACRO_NAME) {
+        fprintf(stderr, "invalid macro name: %s\n", name ? name : "");
+        return -1;
+    }
+    for (int i = 0; i < km->numMacros; i++) {
+        if (strcmp(km->macros[i].name, name) == 0) {
+            fprintf(stderr, "duplicate macro: %s\n", name);
+            return -1;
+        }
+    }
+    if (km->numMacros == KEYMAP_MAX_MACROS) {
+        fprintf(stderr, "too many macros\n");
+        return -1;
+    }
+    struct macro *m = &km->macros[km->numMacros++];
+    strcpy(m->name, name);
+    m->first = (uint16_t) km->numSteps;
+    memset(pressed, 0, sizeof(pressed));
+    int steps = 0;
+    while ((tok = strtok_r(NULL, " \t\r\n", &save))) {
+        int err;
+        steps++;
+        if (strncmp(tok, "wait=", 5) == 0) {
+            if (parse_num(tok + 5, 1, 0xffff, &val)) {
+                fprintf(stderr, "invalid wait: %s\n", tok);
+                return -1;
+            }
+            err = add_step(km, MACRO_WAIT, 0, (uint16_t) val);
+        } else if (keymap_parse_key(strchr(tok, '=') ? strchr(tok, '=') + 1 : tok, &key, &mods)) {
+            fprintf(stderr, "invalid key: %s\n", tok);
+            return -1;
+        } else if (report_is_axis(key)) {
+            fprintf(stderr, "an axis can't be part of a macro: %s\n", tok);
+            return -1;
+        } else if (strncmp(tok, "press=", 6) == 0) {
+            if (pressed[key]) {
+                fprintf(stderr, "key is pressed already: %s\n", tok);
+                return -1;
+            }
+            pressed[key] = 1;
+            err = add_step(km, MACRO_PRESS, key, mods);
+        } else if (strncmp(tok, "release=", 8) == 0) {
+            if (!pressed[key]) {
+                fprintf(stderr, "key is not pressed: %s\n", tok);
+                return -1;
+            }
+            pressed[key] = 0;
+            err = add_step(km, MACRO_RELEASE, key, 0);
+        } else if (strchr(tok, '=')) {
+            fprintf(stderr, "invalid step: %s\n", tok);
+            return -1;
+        } else if (pressed[key]) {
+            fprintf(stderr, "key is pressed already: %s\n", tok);
+            return -1;
+        } else {
+            err = add_step(km, MACRO_PRESS, key, mods)
+                    || add_step(km, MACRO_WAIT, 0, MACRO_TAP_MS)
+                    || add_step(km, MACRO_RELEASE, key, 0);
+        }
+        if (err) {
+            return -1;
+        }
+    }
+    if (!steps) {
+        fprintf(stderr, "empty macro: %s\n", name);
+        return -1;
+    }
+    for (int k = 0; k < 256; k++) {
+        if (pressed[k] && add_step(km, MACRO_RELEASE, (uint8_t) k, 0)) {
+            return -1;
+        }
+    }
+    return add_step(km, MACRO_END, 0, 0);
+}
+
+/**
+ * Parses a pad (a note or * for all notes) of a crosstalk rule.
+ * @return 0 on success
+ */
+static int parse_pad(const char *tok, long *lo, long *hi) {
+    if (strcmp(tok, "*") == 0) {
+        *lo = 0;
+        *hi = KEYMAP_NOTES - 1;
+        return 0;
+    }
+    if (parse_num(tok, 0, KEYMAP_NOTES - 1, lo)) {
+        return -1;
+    }
+    *hi = *lo;
+    return 0;
+}
+
+/**
+ * Parses a crosstalk rule: {@code crosstalk source victim [ratio=PCT] [window=MS]}. Either pad can be {@code *}
+ * for all pads. A later rule replaces an earlier one for the same pair.
+ */
+static int parse_crosstalk(struct keymap *km, char *line) {
+    char *save = NULL;
+    char *tok;
+    long val, srcLo, srcHi, vicLo, vicHi;
+
+    if (km->numCrosstalk == KEYMAP_MAX_CROSSTALK) {
+        fprintf(stderr, "too many crosstalk rules\n");
+        return -1;
+    }
+    struct crosstalk *c = &km->crosstalk[km->numCrosstalk];
+    c->ratio = DEFAULT_CROSSTALK_RATIO;
+    c->window = DEFAULT_CROSSTALK_WINDOW_MS;
+
+    strtok_r(line, " \t\r\n", &save);
+    char *source = strtok_r(NULL, " \t\r\n", &save);
+    char *victim = strtok_r(NULL, " \t\r\n", &save);
+    if (!source || !victim || parse_pad(source, &srcLo, &srcHi) || parse_pad(victim, &vicLo, &vicHi)) {
+        fprintf(stderr, "missing or invalid pads\n");
+        return -1;
+    }
+    while ((tok = strtok_r(NULL, " \t\r\n", &save))) {
+        if (strncmp(tok, "ratio=", 6) == 0 && !parse_num(tok + 6, 1, 100, &val)) {
+            c->ratio = (uint8_t) val;
+        } else if (strncmp(tok, "window=", 7) == 0 && !parse_num(tok + 7, 1, 1000, &val)) {
+            c->window = (uint16_t) val;
+        } else {
+            fprintf(stderr, "invalid option: %s\n", tok);
+            return -1;
+        }
+    }
+    km->numCrosstalk++;
+    for (long s = srcLo; s <= srcHi; s++) {
+        for (long v = vicLo; v <= vicHi; v++) {
+            // a pad doesn't ghost itself, a second hit on it is a repeat
+            if (s != v) {
+                km->crosstalkRule[s][v] = (uint8_t) km->numCrosstalk;
+                km->crosstalkSources[s / 64] |= 1ULL << (s % 64);
+                km->crosstalkVictims[v / 64] |= 1ULL << (v % 64);
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Compiles a {@code chord note+note... key [options]} line.
+ */
+static int parse_chord(struct keymap *km, char *line) {
+    char *save = NULL;
+    char *tok;
+    long val;
+
+    if (km->numChords == KEYMAP_MAX_CHORDS) {
+        fprintf(stderr, "too many chords\n");
+        return -1;
+    }
+    struct chord *c = &km->chords[km->numChords];
+    memset(c, 0, sizeof(*c));
+    c->window = DEFAULT_CHORD_WINDOW_MS;
+    c->minVelocity = DEFAULT_MIN_VELOCITY;
+    c->replace = 1;
+
+    strtok_r(line, " \t\r\n", &save);
+    char *notes = strtok_r(NULL, " \t\r\n", &save);
+    char *key = strtok_r(NULL, " \t\r\n", &save);
+    if (!notes || !key) {
+        fprintf(stderr, "missing notes or key\n");
+        return -1;
+    }
+    char *nsave = NULL;
+    for (tok = strtok_r(notes, "+", &nsave); tok; tok = strtok_r(NULL, "+", &nsave)) {
+        if (parse_num(tok, 0, KEYMAP_NOTES - 1, &val) || c->count == KEYMAP_CHORD_NOTES) {
+            fprintf(stderr, "invalid chord note: %s\n", tok);
+            return -1;
+        }
+        if (c->mask[val / 64] & (1ULL << (val % 64))) {
+            fprintf(stderr, "note twice in chord: %s\n", tok);
+            return -1;
+        }
+        c->mask[val / 64] |= 1ULL << (val % 64);
+        c->notes[c->count++] = (uint8_t) val;
+    }
+    if (c->count < 2) {
+        fprintf(stderr, "a chord needs at least two notes\n");
+        return -1;
+    }
+    if (keymap_parse_key(key, &c->key, &c->mods) || report_is_axis(c->key)) {
+        fprintf(stderr, "invalid key: %s\n", key);
+        return -1;
+    }
+    while ((tok = strtok_r(NULL, " \t\r\n", &save))) {
+        if (strncmp(tok, "window=", 7) == 0 && !parse_num(tok + 7, 1, 1000, &val)) {
+            c->window = (uint16_t) val;
+        } else if (strncmp(tok, "vel=", 4) == 0 && !parse_num(tok + 4, 1, 127, &val)) {
+            c->minVelocity = (uint8_t) val;
+        } else if (strncmp(tok, "hold=", 5) == 0 && !parse_num(tok + 5, 1, 0xffff, &val)) {
+            c->hold = (uint16_t) val;
+        } else if (strcmp(tok, "mode=replace") == 0) {
+            c->replace = 1;
+        } else if (strcmp(tok, "mode=add") == 0) {
+            c->replace = 0;
+        } else {
+            fprintf(stderr, "invalid option: %s\n", tok);
+            return -1;
+        }
+    }
+    if (c->window > km->chordWindow) {
+        km->chordWindow = c->window;
+    }
+    for (int i = 0; i < c->count; i++) {
+        km->noteChords[c->notes[i]] |= 1ULL << km->numChords;
+        if (c->replace && c->window > km->chordDelay[c->notes[i]]) {
+            km->chordDelay[c->notes[i]] = c->window;
+        }
+    }
+    km->numChords++;
+    return 0;
+}
+
+/**
+ * Resolves the macro names of the note entries.
+ */
+static int resolve_macros(struct keymap *km, struct entry *entries, int num, const char *name) {
+    for (int i = 0; i < num; i++) {
+        if (!entries[i].macro[0]) {
+            continue;
+        }
+        int m = 0;
+        while (m < km->numMacros && strcmp(km->macros[m].name, entries[i].macro) != 0) {
+            m++;
+        }
+        if (m == km->numMacros) {
+            fprintf(stderr, "%s: unknown macro: %s\n", name, entries[i].macro);
+            return -1;
+        }
+        entries[i].action.key = (uint8_t) (m + 1);
+    }
+    return 0;
+}
+
+static int compare_velocity(const void *a, const void *b) {
+    return (*(const struct entry **) a)->action.minVelocity - (*(const struct entry **) b)->action.minVelocity;
+}
+
+/**
+ * Builds the lookup table and the velocity layers from the parsed entries.
+ */
+static int compile(struct keymap *km, const struct entry *entries, int num, const char *name) {
+    const struct entry *cell[MAX_ENTRIES];
+    for (int ch = 0; ch < KEYMAP_CHANNELS; ch++) {
+        for (int note = 0; note < KEYMAP_NOTES; note++) {
+            // specific channel entries win over the wildcard ones
+            int n = 0;
+            for (int pass = 0; pass < 2 && n == 0; pass++) {
+                int want = pass == 0 ? ch : -1;
+                for (int i = 0; i < num; i++) {
+                    if (entries[i].controller < 0 && entries[i].note == note && entries[i].channel == want) {
+                        cell[n++] = &entries[i];
+                    }
+                }
+            }
+            if (n == 0) {
+                continue;
+            }
+            qsort(cell, (size_t) n, sizeof(cell[0]), compare_velocity);
+            km->table[ch][note] = cell[0]->action;
+            struct action *prev = &km->table[ch][note];
+            for (int i = 1; i < n; i++) {
+                if (cell[i]->action.minVelocity == cell[i - 1]->action.minVelocity) {
+                    fprintf(stderr, "%s: duplicate entry for note %02x vel=%d\n", name, note,
+                            cell[i]->action.minVelocity);
+                    return -1;
+                }
+                if (km->numLayers == KEYMAP_MAX_LAYERS) {
+                    fprintf(stderr, "%s: too many velocity layers\n", name);
+                    return -1;
+                }
+                km->layers[km->numLayers] = cell[i]->action;
+                prev->layer = (uint16_t) ++km->numLayers;
+                prev = &km->layers[km->numLayers - 1];
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Appends the bands of a controller for the given channel (-1 for the wildcard) to the profile.
+ * @return the bands, with count 0 if there are none, or first 0 on overflow.
+ */
+static struct controller append_bands(struct keymap *km, const struct entry *entries, int num, int controller,
+                                      int channel) {
+    struct controller c = {.first = (uint8_t) (km->numBands + 1), .count = 0};
+    for (int i = 0; i < num; i++) {
+        if (entries[i].controller == controller && entries[i].channel == channel) {
+            if (km->numBands == KEYMAP_MAX_BANDS) {
+                c.first = 0;
+                return c;
+            }
+            km->bands[km->numBands++] = entries[i].band;
+            c.count++;
+        }
+    }
+    return c;
+}
+
+/**
+ * Builds the controller bands. The bands of a channel replace the wildcard bands of the controller, which are
+ * shared by all other channels.
+ */
+static int compile_bands(struct keymap *km, const struct entry *entries, int num, const char *name) {
+    for (int cc = 0; cc < KEYMAP_CONTROLLERS; cc++) {
+        struct controller any = append_bands(km, entries, num, cc, -1);
+        for (int ch = 0; ch < KEYMAP_CHANNELS && any.first; ch++) {
+            struct controller c = append_bands(km, entries, num, cc, ch);
+            if (!c.first) {
+                any.first = 0;
+            }
+            km->controllers[ch][cc] = c.count ? c : any;
+        }
+        if (!any.first) {
+            fprintf(stderr, "%s: too many controller bands\n", name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int keymap_parse(struct keymap *km, FILE *in, const char *name) {
+    static struct entry entries[MAX_ENTRIES];
+    char line[256];
+    int lineNr = 0;
+    int num = 0;
+
+    memset(km, 0, sizeof(*km));
+    while (fgets(line, sizeof(line), in)) {
+        lineNr++;
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = 0;
+        }
+        char *p = line;
+        while (isspace((unsigned char) *p)) {
+            p++;
+        }
+        if (!*p) {
+            continue;
+        }
+        if (strncmp(p, "macro", 5) == 0 && isspace((unsigned char) p[5])) {
+            if (parse_macro(km, p)) {
+                fprintf(stderr, "%s:%d: invalid macro\n", name, lineNr);
+                return -1;
+            }
+            continue;
+        }
+        if (strncmp(p, "crosstalk", 9) == 0 && isspace((unsigned char) p[9])) {
+            if (parse_crosstalk(km, p)) {
+                fprintf(stderr, "%s:%d: invalid crosstalk\n", name, lineNr);
+                return -1;
+            }
+            continue;
+        }
+        if (strncmp(p, "chord", 5) == 0 && isspace((unsigned char) p[5])) {
+            if (parse_chord(km, p)) {
+                fprintf(stderr, "%s:%d: invalid chord\n", name, lineNr);
+                return -1;
+            }
+            continue;
+        }
+        if (num == MAX_ENTRIES) {
+            fprintf(stderr, "%s:%d: too many entries\n", name, lineNr);
+            return -1;
+        }
+        if (parse_line(p, &entries[num])) {
+            fprintf(stderr, "%s:%d: invalid mapping\n", name, lineNr);
+            return -1;
+        }
+        num++;
+    }
+    km->numEntries = num;
+    return resolve_macros(km, entries, num, name) || compile(km, entries, num, name)
+           || compile_bands(km, entries, num, name) ? -1 : 0;
+}
+
+int keymap_load(struct keymap *km, const char *path) {
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        perror(path);
+        return -1;
+    }
+    int ret = keymap_parse(km, in, path);
+    fclose(in);
+    return ret;
+}
+
+int keymap_load_default(struct keymap *km) {
+    FILE *in = fmemopen((void *) default_profile, strlen(default_profile), "r");
+    if (!in) {
+        perror("fmemopen");
+        return -1;
+    }
+    int ret = keymap_parse(km, in, "built-in");
+    fclose(in);
+    return ret;
+}
+
+/**
+ * Formats a hold time, "auto" if the host's shortest hold time applies.
+ */
+static const char *hold_name(uint16_t hold, char *buf, size_t len) {
+    if (!hold) {
+        return "auto";
+    }
+    snprintf(buf, len, "%dms", hold);
+    return buf;
+}
+
+static void dump_action(const struct keymap *km, const struct action *a, FILE *out) {
+    if (a->release == RELEASE_MACRO) {
+        fprintf(out, "│   ├── vel >= %02x: macro %s\n", a->minVelocity, km->macros[a->key - 1].name);
+        return;
+    }
+    char hold[16];
+    fprintf(out, "│   ├── vel >= %02x: key %02x mods %02x, release %s %s\n", a->minVelocity, a->key, a->mods,
+            release_names[a->release], hold_name(a->hold, hold, sizeof(hold)));
+}
+
+/**
+ * Checks if two layer chains define the same actions.
+ */
+static int same_chain(const struct keymap *km, const struct action *a, const struct action *b) {
+    while (a->key == b->key && a->mods == b->mods && a->minVelocity == b->minVelocity
+           && a->release == b->release && a->hold == b->hold) {
+        if (!a->layer || !b->layer) {
+            return a->layer == b->layer;
+        }
+        a = &km->layers[a->layer - 1];
+        b = &km->layers[b->layer - 1];
+    }
+    return 0;
+}
+
+void keymap_dump(const struct keymap *km, FILE *out) {
+    fprintf(out, "Mapping (%d entries)\n", km->numEntries);
+    for (int note = 0; note < KEYMAP_NOTES; note++) {
+        int all = 1;
+        for (int ch = 1; ch < KEYMAP_CHANNELS && all; ch++) {
+            all = same_chain(km, &km->table[0][note], &km->table[ch][note]);
+        }
+        for (int ch = 0; ch < KEYMAP_CHANNELS; ch++) {
+            const struct action *a = &km->table[ch][note];
+            if (!a->key) {
+                continue;
+            }
+            if (all) {
+                fprintf(out, "├── Note: %02x\n", note);
+            } else {
+                fprintf(out, "├── Channel %d, Note: %02x\n", ch + 1, note);
+            }
+            dump_action(km, a, out);
+            while (a->layer) {
+                a = &km->layers[a->layer - 1];
+                dump_action(km, a, out);
+            }
+            fprintf(out, "│\n");
+            if (all) {
+                break;
+            }
+        }
+    }
+    for (int cc = 0; cc < KEYMAP_CONTROLLERS; cc++) {
+        int all = 1;
+        for (int ch = 1; ch < KEYMAP_CHANNELS && all; ch++) {
+            all = km->controllers[ch][cc].first == km->controllers[0][cc].first
+                    && km->controllers[ch][cc].count == km->controllers[0][cc].count;
+        }
+        for (int ch = 0; ch < KEYMAP_CHANNELS; ch++) {
+            const struct controller *c = &km->controllers[ch][cc];
+            if (!c->count) {
+                continue;
+            }
+            if (all) {
+                fprintf(out, "├── Controller: %02x\n", cc);
+            } else {
+                fprintf(out, "├── Channel %d, Controller: %02x\n", ch + 1, cc);
+            }
+            for (int i = 0; i < c->count; i++) {
+                const struct band *b = &km->bands[c->first - 1 + i];
+                fprintf(out, "│   ├── down at %d, up at %d: key %02x mods %02x\n", b->down, b->up, b->key, b->mods);
+            }
+            fprintf(out, "│\n");
+            if (all) {
+                break;
+            }
+        }
+    }
+    for (int i = 0; i < km->numChords; i++) {
+        const struct chord *c = &km->chords[i];
+        fprintf(out, "├── Chord:");
+        for (int n = 0; n < c->count; n++) {
+            fprintf(out, " %02x", c->notes[n]);
+        }
+        char hold[16];
+        fprintf(out, "\n│   ├── vel >= %02x within %dms: key %02x mods %02x, %s, %s\n", c->minVelocity, c->window,
+                c->key, c->mods, c->replace ? "replace" : "add", hold_name(c->hold, hold, sizeof(hold)));
+        fprintf(out, "│\n");
+    }
+    for (int r = 0; r < km->numCrosstalk; r++) {
+        const struct crosstalk *c = &km->crosstalk[r];
+        fprintf(out, "├── Crosstalk: below %d%% within %dms\n", c->ratio, c->window);
+        for (int src = 0; src < KEYMAP_NOTES; src++) {
+            int victims = 0;
+            for (int v = 0; v < KEYMAP_NOTES; v++) {
+                victims += km->crosstalkRule[src][v] == r + 1;
+            }
+            if (!victims) {
+                continue;
+            }
+            fprintf(out, "│   ├── %02x ->", src);
+            for (int v = 0; v < KEYMAP_NOTES && victims < KEYMAP_NOTES - 1; v++) {
+                if (km->crosstalkRule[src][v] == r + 1) {
+                    fprintf(out, " %02x", v);
+                }
+            }
+            fprintf(out, victims == KEYMAP_NOTES - 1 ? " *\n" : "\n");
+        }
+        fprintf(out, "│\n");
+    }
+    for (int m = 0; m < km->numMacros; m++) {
+        fprintf(out, "├── Macro: %s\n", km->macros[m].name);
+        for (const struct macro_step *step = &km->steps[km->macros[m].first]; step->op != MACRO_END; step++) {
+            if (step->op == MACRO_PRESS) {
+                fprintf(out, "│   ├── press %02x mods %02x\n", step->key, step->arg);
+            } else if (step->op == MACRO_RELEASE) {
+                fprintf(out, "│   ├── release %02x\n", step->key);
+            } else {
+                fprintf(out, "│   ├── wait %dms\n", step->arg);
+            }
+        }
+        fprintf(out, "│\n");
+    }
+}
+
+unsigned int keymap_hold(const struct action *a, uint8_t velocity, unsigned int minHold) {
+    unsigned int ms = a->hold;
+    if (a->release == RELEASE_VELOCITY) {
+        ms = (ms ? ms : DEFAULT_HOLD_MS) * velocity / 127;
+        minHold = minHold ? minHold : MIN_HOLD_MS;
+    } else if (!ms) {
+        ms = minHold ? minHold : DEFAULT_HOLD_MS;
+    }
+    return ms < minHold ? minHold : ms;
+}
@@ -0,0 +1,416 @@
+#ifndef MIDI2HID_KEYMAP_H
+#define MIDI2HID_KEYMAP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "midi.h"
+
+/**
+ * Number of MIDI channels and notes covered by the dense lookup table.
+ */
+#define KEYMAP_CHANNELS 16
+#define KEYMAP_NOTES 128
+
+/**
+ * Number of MIDI controllers.
+ */
+#define KEYMAP_CONTROLLERS 128
+
+/**
+ * Maximum number of controller bands per profile. Wildcard channel bands are stored once.
+ */
+#define KEYMAP_MAX_BANDS 128
+
+/**
+ * Default thresholds of a controller band: down when the value reaches 96, up again at 64 and below.
+ */
+#define DEFAULT_CC_DOWN 96
+#define DEFAULT_CC_UP 64
+
+/**
+ * Maximum number of macros per profile, and of steps of all macros together.
+ */
+#define KEYMAP_MAX_MACROS 64
+#define KEYMAP_MAX_STEPS 1024
+
+/**
+ * Maximum length of a macro name, including the terminating 0.
+ */
+#define KEYMAP_MACRO_NAME 16
+
+/**
+ * Time a key of a macro stays pressed when it is tapped, long enough for the host to see it.
+ */
+#define MACRO_TAP_MS 10
+
+/**
+ * Maximum number of chords per profile, and of notes per chord.
+ */
+#define KEYMAP_MAX_CHORDS 64
+#define KEYMAP_CHORD_NOTES 4
+
+/**
+ * Default time within which all notes of a chord have to be hit.
+ */
+#define DEFAULT_CHORD_WINDOW_MS 30
+
+/**
+ * Maximum number of crosstalk rules per profile.
+ */
+#define KEYMAP_MAX_CROSSTALK 64
+
+/**
+ * Default time after a hit on the source pad, within which a hit on the victim pad may be crosstalk.
+ */
+#define DEFAULT_CROSSTALK_WINDOW_MS 20
+
+/**
+ * Default fraction of the source velocity in percent, below which a hit on the victim pad is crosstalk.
+ */
+#define DEFAULT_CROSSTALK_RATIO 50
+
+/**
+ * Maximum number of additional velocity layers per profile.
+ */
+#define KEYMAP_MAX_LAYERS 2048
+
+/**
+ * Default velocity threshold, if the profile entry doesn't specify one.
+ */
+#define DEFAULT_MIN_VELOCITY 0x28
+
+/**
+ * Default hold time of a key, if the mapping doesn't specify one and the poll interval of the host isn't known.
+ */
+#define DEFAULT_HOLD_MS 20
+
+/**
+ * Shortest hold time for velocity scaled releases, if the poll interval of the host isn't known. Anything shorter
+ * might fall between two host polls.
+ */
+#define MIN_HOLD_MS 8
+
+/**
+ * Safety release for keys that wait for a NOTEOFF which never arrives.
+ */
+#define NOTEOFF_MAX_HOLD_MS 2000
+
+/**
+ * Defines when a pressed key is released again.
+ */
+enum release_mode {
+    /**
+     * Release after {@code hold} milliseconds.
+     */
+    RELEASE_FIXED = 0,
+
+    /**
+     * Release after {@code hold * velocity / 127} milliseconds, but at least the shortest hold time the host
+     * registers.
+     */
+    RELEASE_VELOCITY,
+
+    /**
+     * Release when the NOTEOFF of the note is received, but at the latest after {@code hold} milliseconds.
+     */
+    RELEASE_NOTEOFF,
+
+    /**
+     * No key of its own: the hit runs the macro {@code key}, which presses and releases its keys by itself.
+     */
+    RELEASE_MACRO
+};
+
+/**
+ * Compiled action of a channel/note pair. Kept at 8 bytes so that the whole table stays small.
+ */
+struct action {
+    /**
+     * HID key, or the 1-based index in {@code keymap.macros} of a RELEASE_MACRO action. 0 if not mapped.
+     */
+    uint8_t key;
+
+    /**
+     * Keyboard modifier bits
+     */
+    uint8_t mods;
+
+    /**
+     * Minimum velocity that triggers this action.
+     */
+    uint8_t minVelocity;
+
+    /**
+     * Release policy (enum release_mode)
+     */
+    uint8_t release;
+
+    /**
+     * Hold time in milliseconds, 0 for the shortest hold time the host registers.
+     */
+    uint16_t hold;
+
+    /**
+     * 1-based index of the next higher velocity layer in {@code keymap.layers}, or 0.
+     */
+    uint16_t layer;
+};
+
+/**
+ * Controller band with hysteresis: the key goes down when the value reaches {@code down}, and up again when it
+ * gets back to {@code up}. With down > up the band is entered by rising values (eg. a closing hi-hat pedal),
+ * with down < up by falling ones.
+ */
+struct band {
+    uint8_t key;
+    uint8_t mods;
+    uint8_t down;
+    uint8_t up;
+};
+
+/**
+ * Bands of a channel/controller pair, {@code bands[first - 1]} and the following {@code count - 1}.
+ */
+struct controller {
+    uint8_t first;
+    uint8_t count;
+};
+
+/**
+ * Operation of a macro step.
+ */
+enum macro_op {
+    /**
+     * End of the macro. Every macro ends with all its keys released.
+     */
+    MACRO_END = 0,
+
+    /**
+     * Press {@code key} with the modifiers {@code arg}.
+     */
+    MACRO_PRESS,
+
+    /**
+     * Release {@code key}.
+     */
+    MACRO_RELEASE,
+
+    /**
+     * Continue after {@code arg} milliseconds.
+     */
+    MACRO_WAIT
+};
+
+/**
+ * Step of a compiled macro program.
+ */
+struct macro_step {
+    uint8_t op;
+    uint8_t key;
+    uint16_t arg;
+};
+
+/**
+ * Macro, the steps {@code keymap.steps[first]} up to the next MACRO_END.
+ */
+struct macro {
+    char name[KEYMAP_MACRO_NAME];
+    uint16_t first;
+};
+
+/**
+ * Notes that hit together within {@code window} milliseconds press a key of their own. A replacing chord holds
+ * the hits of its notes back for the window, and drops them if the chord completes. Otherwise the notes press
+ * their keys as usual and the chord key comes on top.
+ */
+struct chord {
+    /**
+     * Bitset of the notes of the chord.
+     */
+    uint64_t mask[2];
+    uint8_t notes[KEYMAP_CHORD_NOTES];
+    uint8_t count;
+
+    uint8_t key;
+    uint8_t mods;
+    uint8_t minVelocity;
+    uint8_t replace;
+    uint16_t window;
+    uint16_t hold;
+};
+
+/**
+ * A hit on a pad that shakes another one: a hit on the victim within {@code window} milliseconds after a hit on the
+ * source, that is softer than {@code ratio} percent of the source hit, is a ghost note and dropped.
+ */
+struct crosstalk {
+    uint8_t ratio;
+    uint16_t window;
+};
+
+/**
+ * Compiled mapping profile.
+ */
+struct keymap {
+    /**
+     * Lowest velocity layer of every channel/note pair.
+     */
+    struct action table[KEYMAP_CHANNELS][KEYMAP_NOTES];
+
+    /**
+     * Higher velocity layers, sorted ascending by velocity per chain.
+     */
+    struct action layers[KEYMAP_MAX_LAYERS];
+
+    /**
+     * Number of used layers.
+     */
+    int numLayers;
+
+    /**
+     * Bands of every channel/controller pair.
+     */
+    struct controller controllers[KEYMAP_CHANNELS][KEYMAP_CONTROLLERS];
+    struct band bands[KEYMAP_MAX_BANDS];
+    int numBands;
+
+    /**
+     * Macros and the steps of all macros.
+     */
+    struct macro macros[KEYMAP_MAX_MACROS];
+    int numMacros;
+    struct macro_step steps[KEYMAP_MAX_STEPS];
+    int numSteps;
+
+    /**
+     * Chords, and per note the bitset of the chords it is part of.
+     */
+    struct chord chords[KEYMAP_MAX_CHORDS];
+    int numChords;
+    uint64_t noteChords[KEYMAP_NOTES];
+
+    /**
+     * Longest window of all chords. Hits that are older can't take part in any chord.
+     */
+    uint16_t chordWindow;
+
+    /**
+     * Time in milliseconds the hits of a note are held back for the replacing chords it is part of, or 0.
+     */
+    uint16_t chordDelay[KEYMAP_NOTES];
+
+    /**
+     * Crosstalk rules, and the 1-based rule of every source/victim pair or 0. The bitsets of the notes that are
+     * the source and the victim of any rule keep the other notes out of the crosstalk check.
+     */
+    struct crosstalk crosstalk[KEYMAP_MAX_CROSSTALK];
+    int numCrosstalk;
+    uint8_t crosstalkRule[KEYMAP_NOTES][KEYMAP_NOTES];
+    uint64_t crosstalkSources[2];
+    uint64_t crosstalkVictims[2];
+
+    /**
+     * Number of profile entries.
+     */
+    int numEntries;
+};
+
+/**
+ * Map the given key symbol to a HID key code
+ * @param {key} the input key
+ * @return the mapped key or 0.
+ */
+uint8_t mapKey(const char *key);
+
+/**
+ * Parses a key specification of the form {@code [modifier+]...key}, eg. {@code --left-shift+s}.
+ * @param spec the key specification
+ * @param key receives the HID key
+ * @param mods receives the modifier bits
+ * @return 0 on success, -1 if the specification is invalid.
+ */
+int keymap_parse_key(const char *spec, uint8_t *key, uint8_t *mods);
+
+/**
+ * Compiles a mapping profile. Each non empty line has one of the forms:
+ * <pre>
+ * [channel:]note key [vel=N] [release=fixed|velocity|noteoff] [hold=MS]
+ * [channel:]note @macro [vel=N]
+ * [channel:]ccN key [down=V] [up=V]
+ * macro name step...
+ * chord note+note[+note...] key [window=MS] [vel=N] [hold=MS] [mode=replace|add]
+ * crosstalk source victim [ratio=PCT] [window=MS]
+ * </pre>
+ * A macro step is a key that is tapped, {@code press=key} or {@code release=key}, or {@code wait=MS}.
+ * Keys still pressed at the end of a macro are released. Chords match their notes on any channel.
+ * The source and victim of a crosstalk rule are notes, or {@code *} for any note; a pad is never crosstalk of
+ * itself. A hit on the victim within {@code window} ms (default 20) of a hit on the source of the same channel,
+ * and softer than {@code ratio} percent (default 50) of it, is dropped.
+ * The channel is 1-16 or {@code *} (default). Entries for a specific channel win over {@code *}.
+ * Several entries for the same channel and note define velocity layers, several entries for the same controller
+ * define bands. Everything after a {@code #} is a comment.
+ * @param km the keymap to fill
+ * @param in the profile
+ * @param name name of the profile for error messages
+ * @return 0 on success, -1 on error.
+ */
+int keymap_parse(struct keymap *km, FILE *in, const char *name);
+
+/**
+ * Compiles the given profile file.
+ * @param km the keymap to fill
+ * @param path profile file
+ * @return 0 on success, -1 on error.
+ */
+int keymap_load(struct keymap *km, const char *path);
+
+/**
+ * Compiles the built-in profile.
+ * @param km the keymap to fill
+ * @return 0 on success, -1 on error.
+ */
+int keymap_load_default(struct keymap *km);
+
+/**
+ * Returns the MIDI event types (MIDI_TYPE_BIT) the profile needs. Everything else can be filtered before it
+ * reaches the event loop.
+ */
+static inline unsigned keymap_event_types(const struct keymap *km) {
+    unsigned types = MIDI_TYPE_BIT(MIDI_NOTEON) | MIDI_TYPE_BIT(MIDI_NOTEOFF);
+    return km->numBands ? types | MIDI_TYPE_BIT(MIDI_CONTROLLER) : types;
+}
+
+/**
+ * Prints the compiled profile.
+ */
+void keymap_dump(const struct keymap *km, FILE *out);
+
+/**
+ * Calculates the hold time of a key for the given action and velocity. A mapping without a hold time is held for
+ * {@code minHold}, and no key is released before.
+ * @param a the action
+ * @param velocity note velocity
+ * @param minHold shortest hold time the host registers in milliseconds, or 0 if it isn't known: then a mapping
+ * without a hold time is held for DEFAULT_HOLD_MS, and velocity scaled holds for at least MIN_HOLD_MS.
+ * @return the hold time in milliseconds
+ */
+unsigned int keymap_hold(const struct action *a, uint8_t velocity, unsigned int minHold);
+
+/**
+ * Finds the action for the given note.
+ * @param km the keymap
+ * @param channel MIDI channel (0-15)
+ * @param note MIDI note
+ * @param velocity note velocity
+ * @return the action or NULL if the note is not mapped or the velocity is below the threshold.
+ */
+static inline const struct action *keymap_lookup(const struct keymap *km, uint8_t channel, uint8_t note,
+                                                 uint8_t velocity) {
+    const struct action *a = &km->table[channel & 0x0f][note & 0x7f];
+    while (a->layer && velocity >= km->layers[a->layer - 1].minVelocity) {
+        a = &km->layers[a->layer - 1];
+    }
+    return a->key && velocity >= a->minVelocity ? a : NULL;
+}
+
+#endif //MIDI2HID_KEYMAP_H
@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <string.h>
+#include "latency.h"
+
+static const char *stage_names[LAT_STAGES] = {"input", "map", "output", "total"};
+
+static struct lat_histogram histograms[LAT_STAGES];
+
+static struct lat_trace *ring;
+static size_t ringSize;
+static uint64_t ringPos;
+
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+
+/**
+ * Maps a value to its bucket: the first LAT_SUB_BUCKETS values are exact, above that each power of
+ * two is split into LAT_SUB_BUCKETS linear buckets.
+ */
+static int bucket_of(uint64_t ns) {
+    if (ns < LAT_SUB_BUCKETS) {
+        return (int) ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    int b = (msb - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS + (int) ((ns >> (msb - LAT_SUB_BITS)) & (LAT_SUB_BUCKETS - 1));
+    return b < LAT_BUCKETS ? b : LAT_BUCKETS - 1;
+}
+
+/**
+ * Returns the upper bound of the given bucket.
+ */
+static uint64_t bucket_value(int b) {
+    if (b < LAT_SUB_BUCKETS) {
+        return (uint64_t) b;
+    }
+    int msb = b / LAT_SUB_BUCKETS + LAT_SUB_BITS - 1;
+    uint64_t sub = (uint64_t) (b % LAT_SUB_BUCKETS);
+    return ((LAT_SUB_BUCKETS + sub + 1) << (msb - LAT_SUB_BITS)) - 1;
+}
+
+void lat_record(enum lat_stage stage, uint64_t ns) {
+    struct lat_histogram *h = &histograms[stage];
+    int b = bucket_of(ns);
+    STORE(&h->buckets[b], LOAD(&h->buckets[b]) + 1);
+    STORE(&h->count, LOAD(&h->count) + 1);
+    if (ns > LOAD(&h->max)) {
+        STORE(&h->max, ns);
+    }
+}
+
+void lat_hit(const struct lat_trace *t) {
+    if (t->kernel && t->kernel <= t->input) {
+        lat_record(LAT_INPUT, t->input - t->kernel);
+    }
+    lat_record(LAT_MAP, t->map - t->input);
+    lat_record(LAT_OUTPUT, t->output - t->map);
+    lat_record(LAT_TOTAL, t->output - t->input);
+    if (ring) {
+        ring[ringPos % ringSize] = *t;
+        STORE(&ringPos, ringPos + 1);
+    }
+}
+
+/**
+ * Returns the value below which the given fraction of the samples fall.
+ */
+static uint64_t percentile(const struct lat_histogram *h, uint64_t count, double p) {
+    uint64_t want = (uint64_t) (count * p + 0.5);
+    uint64_t seen = 0;
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        seen += LOAD(&h->buckets[b]);
+        if (seen >= want && seen > 0) {
+            uint64_t v = bucket_value(b);
+            uint64_t max = LOAD(&h->max);
+            return v < max ? v : max;
+        }
+    }
+    return LOAD(&h->max);
+}
+
+void lat_dump(FILE *out) {
+    fprintf(out, "Latency (us)      count      p50      p99      max\n");
+    for (int s = 0; s < LAT_STAGES; s++) {
+        const struct lat_histogram *h = &histograms[s];
+        uint64_t count = LOAD(&h->count);
+        if (!count) {
+            continue;
+        }
+        fprintf(out, "├── %-8s %10llu %8.1f %8.1f %8.1f\n", stage_names[s], (unsigned long long) count,
+                percentile(h, count, 0.5) / 1e3, percentile(h, count, 0.99) / 1e3, LOAD(&h->max) / 1e3);
+    }
+    fflush(out);
+}
+
+int lat_trace_enable(size_t capacity) {
+    if (!(ring = calloc(capacity, sizeof(struct lat_trace)))) {
+        return -1;
+    }
+    ringSize = capacity;
+    ringPos = 0;
+    return 0;
+}
+
+int lat_trace_export(const char *path) {
+    if (!ring) {
+        return 0;
+    }
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        perror(path);
+        return -1;
+    }
+    uint64_t end = LOAD(&ringPos);
+    uint64_t start = end > ringSize ? end - ringSize : 0;
+    fprintf(out, "# channel\tnote\tvelocity\tkey\tkernel_ns\tinput_ns\tmap_ns\toutput_ns\n");
+    for (uint64_t i = start; i < end; i++) {
+        const struct lat_trace *t = &ring[i % ringSize];
+        fprintf(out, "%d\t%d\t%d\t%d\t%llu\t%llu\t%llu\t%llu\n", t->channel, t->note, t->velocity, t->key,
+                (unsigned long long) t->kernel, (unsigned long long) t->input, (unsigned long long) t->map,
+                (unsigned long long) t->output);
+    }
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,100 @@
+#ifndef MIDI2HID_LATENCY_H
+#define MIDI2HID_LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Number of linear sub buckets per power of two. The histogram error is below 1/LAT_SUB_BUCKETS.
+ */
+#define LAT_SUB_BITS 4
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BITS)
+
+/**
+ * Number of buckets of a histogram, covering 0 to 2^40ns (~18min).
+ */
+#define LAT_BUCKETS ((40 - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS)
+
+/**
+ * Stages of a hit on its way from the MIDI device to the HID report.
+ */
+enum lat_stage {
+    /**
+     * Kernel timestamp of the sequencer to the read by midi2hid. Only available for the sequencer input.
+     */
+    LAT_INPUT = 0,
+
+    /**
+     * Read to mapped key.
+     */
+    LAT_MAP,
+
+    /**
+     * Mapped key until the report write() returned.
+     */
+    LAT_OUTPUT,
+
+    /**
+     * Read until the report write() returned.
+     */
+    LAT_TOTAL,
+
+    LAT_STAGES
+};
+
+/**
+ * Latency histogram. Only written by the event loop, so updates are plain relaxed stores and
+ * the histogram can be read from any thread without locking.
+ */
+struct lat_histogram {
+    uint32_t buckets[LAT_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+};
+
+/**
+ * Timestamps of one hit, in CLOCK_MONOTONIC nanoseconds.
+ */
+struct lat_trace {
+    uint64_t kernel;
+    uint64_t input;
+    uint64_t map;
+    uint64_t output;
+    uint8_t channel;
+    uint8_t note;
+    uint8_t velocity;
+    uint8_t key;
+};
+
+/**
+ * Records a latency sample.
+ * @param stage the stage
+ * @param ns latency in nanoseconds
+ */
+void lat_record(enum lat_stage stage, uint64_t ns);
+
+/**
+ * Records the stages of a hit and adds it to the trace ring, if enabled.
+ */
+void lat_hit(const struct lat_trace *t);
+
+/**
+ * Prints count, p50, p99 and max of every stage.
+ */
+void lat_dump(FILE *out);
+
+/**
+ * Enables the per-event trace ring.
+ * @param capacity number of hits to keep
+ * @return 0 on success
+ */
+int lat_trace_enable(size_t capacity);
+
+/**
+ * Writes the trace ring as tab separated text, oldest hit first.
+ * @param path trace file
+ * @return 0 on success
+ */
+int lat_trace_export(const char *path);
+
+#endif //MIDI2HID_LATENCY_H
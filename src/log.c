@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "log.h"
+
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define LOAD_ACQUIRE(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#define STORE_RELEASE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+int log_init(struct log *l, FILE *out, size_t capacity, uint64_t start) {
+    memset(l, 0, sizeof(*l));
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    // preallocated and touched here, so the hot path never faults a page in.
+    l->ring = malloc(size * sizeof(struct log_record));
+    if (!l->ring) {
+        perror("log");
+        return -1;
+    }
+    memset(l->ring, 0, size * sizeof(struct log_record));
+    if ((l->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        perror("eventfd");
+        free(l->ring);
+        return -1;
+    }
+    l->mask = size - 1;
+    l->out = out;
+    l->start = start;
+    return 0;
+}
+
+void log_write(struct log *l, enum log_type type, uint64_t time, uint8_t channel, uint8_t a, uint8_t b,
+               const uint8_t *data, size_t len) {
+    uint64_t head = l->head;
+    if (head - LOAD_ACQUIRE(&l->tail) > l->mask) {
+        STORE(&l->lost, l->lost + 1);
+        return;
+    }
+    struct log_record *rec = &l->ring[head & l->mask];
+    rec->time = time;
+    rec->type = (uint8_t) type;
+    rec->channel = channel;
+    rec->a = a;
+    rec->b = b;
+    if (len > sizeof(rec->data)) {
+        len = sizeof(rec->data);
+    }
+    rec->len = (uint8_t) len;
+    if (len) {
+        memcpy(rec->data, data, len);
+    }
+    STORE_RELEASE(&l->head, head + 1);
+}
+
+static void wake(struct log *l) {
+    uint64_t one = 1;
+    // a readable eventfd wakes up the formatter, the count doesn't matter
+    ssize_t ret = write(l->fd, &one, sizeof(one));
+    (void) ret;
+}
+
+void log_kick(struct log *l) {
+    if (l->head == l->kicked) {
+        return;
+    }
+    l->kicked = l->head;
+    wake(l);
+}
+
+static void print_data(FILE *out, const struct log_record *rec) {
+    for (int i = 0; i < rec->len; i++) {
+        fprintf(out, " %02x", rec->data[i]);
+    }
+    fprintf(out, "\n");
+}
+
+static void format(const struct log *l, const struct log_record *rec) {
+    FILE *out = l->out;
+    fprintf(out, "%10llu ", (unsigned long long) (rec->time - l->start) / 1000);
+    switch (rec->type) {
+        case LOG_NOTEON:
+            fprintf(out, "[%d] Note on: %2x vel(%2x)\n", rec->channel, rec->a, rec->b);
+            break;
+        case LOG_NOTEOFF:
+            fprintf(out, "[%d] Note off: %2x vel(%2x)\n", rec->channel, rec->a, rec->b);
+            break;
+        case LOG_CONTROL:
+            fprintf(out, "[%d] Control:  %2x val(%2x)\n", rec->channel, rec->a, rec->b);
+            break;
+        case LOG_UNKNOWN:
+            fprintf(out, "[%d] Unknown:  Unhandled Event Received\n", rec->channel);
+            break;
+        case LOG_UNMAPPED:
+            fprintf(out, "note %02x is not mapped\n", rec->a);
+            break;
+        case LOG_MAPPED:
+            fprintf(out, "note %02x maps to key %02x mods %02x\n", rec->a, rec->b, rec->data[0]);
+            break;
+        case LOG_REPEAT:
+            fprintf(out, "..fast repeat. %02x retriggered, %d queued.\n", rec->a, rec->b);
+            break;
+        case LOG_PRESSED:
+            fprintf(out, "..too fast. %02x already has too many queued repeats.\n", rec->a);
+            break;
+        case LOG_FULL:
+            fprintf(out, "..too fast. %02x current report already full.\n", rec->a);
+            break;
+        case LOG_CROSSTALK:
+            fprintf(out, "..ghost note. %02x is crosstalk of %02x.\n", rec->a, rec->b);
+            break;
+        case LOG_SEND:
+            fprintf(out, "sending report: ");
+            print_data(out, rec);
+            break;
+        case LOG_RECV:
+            fprintf(out, "recv report:");
+            print_data(out, rec);
+            break;
+        default:
+            fprintf(out, "unknown log record %d\n", rec->type);
+    }
+}
+
+size_t log_drain(struct log *l) {
+    uint64_t head = LOAD_ACQUIRE(&l->head);
+    uint64_t tail = l->tail;
+    size_t n = 0;
+    for (; tail != head; tail++, n++) {
+        format(l, &l->ring[tail & l->mask]);
+        // give the slot back right away, so a long burst doesn't wait for the whole batch.
+        STORE_RELEASE(&l->tail, tail + 1);
+    }
+    uint64_t lost = LOAD(&l->lost);
+    if (lost != l->lostReported) {
+        fprintf(l->out, "log: %llu records lost\n", (unsigned long long) (lost - l->lostReported));
+        l->lostReported = lost;
+    }
+    if (n) {
+        fflush(l->out);
+    }
+    return n;
+}
+
+static void *log_thread(void *arg) {
+    struct log *l = arg;
+#ifdef SCHED_IDLE
+    // only format when nothing else wants the CPU
+    struct sched_param sp = {.sched_priority = 0};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp);
+#endif
+    struct pollfd pfd = {.fd = l->fd, .events = POLLIN};
+    while (!LOAD_ACQUIRE(&l->stop)) {
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+            perror("log");
+            break;
+        }
+        uint64_t count;
+        // cleared before the drain, so that a kick during the drain wakes us up again
+        ssize_t ret = read(l->fd, &count, sizeof(count));
+        (void) ret;
+        log_drain(l);
+    }
+    log_drain(l);
+    return NULL;
+}
+
+int log_start(struct log *l) {
+    if (pthread_create(&l->thread, NULL, log_thread, l)) {
+        perror("log");
+        return -1;
+    }
+    l->running = 1;
+    return 0;
+}
+
+void log_close(struct log *l) {
+    if (l->running) {
+        STORE_RELEASE(&l->stop, 1);
+        wake(l);
+        pthread_join(l->thread, NULL);
+        l->running = 0;
+    } else {
+        log_drain(l);
+    }
+    close(l->fd);
+    free(l->ring);
+    l->ring = NULL;
+}
+
+void log_dump_stats(const struct log *l, FILE *out) {
+    fprintf(out, "Log\n");
+    fprintf(out, "├── records: %llu\n", (unsigned long long) LOAD(&l->head));
+    fprintf(out, "└── lost:    %llu\n", (unsigned long long) LOAD(&l->lost));
+    fflush(out);
+}
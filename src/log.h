@@ -0,0 +1,176 @@
+#ifndef MIDI2HID_LOG_H
+#define MIDI2HID_LOG_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "report.h"
+
+/**
+ * Default number of records in the ring, about 2s of a full speed drum roll.
+ */
+#define LOG_CAPACITY 4096
+
+enum log_type {
+    LOG_NOTEON = 0,
+    LOG_NOTEOFF,
+    LOG_CONTROL,
+    LOG_UNKNOWN,
+
+    /**
+     * Note without a mapping. a: note
+     */
+    LOG_UNMAPPED,
+
+    /**
+     * Note mapped to a key. a: note, b: key, data[0]: modifiers
+     */
+    LOG_MAPPED,
+
+    /**
+     * Hit on a pressed key queued for a retrigger. a: key, b: queued repeats
+     */
+    LOG_REPEAT,
+
+    /**
+     * Hit dropped because the key had too many queued repeats. a: key
+     */
+    LOG_PRESSED,
+
+    /**
+     * Hit dropped because the report was full. a: key
+     */
+    LOG_FULL,
+
+    /**
+     * Hit dropped as crosstalk of a hit on another pad. a: note, b: note of the source pad
+     */
+    LOG_CROSSTALK,
+
+    /**
+     * Report sent to the host. data: the report
+     */
+    LOG_SEND,
+
+    /**
+     * Output report received from the host. data: the report
+     */
+    LOG_RECV,
+};
+
+/**
+ * Fixed size binary log record. Formatting into text happens on the formatter thread.
+ */
+struct log_record {
+    uint64_t time;
+    uint8_t type;
+    uint8_t channel;
+    uint8_t a;
+    uint8_t b;
+    uint8_t len;
+    uint8_t data[REPORT_MAX_LEN];
+};
+
+/**
+ * Single producer, single consumer ring of log records. The event loop is the only producer, it never
+ * blocks or allocates: when the ring is full, the record is counted as lost and dropped. The formatter thread
+ * sleeps until the producer kicks it with log_kick(), so an idle log costs no wakeups.
+ */
+struct log {
+    struct log_record *ring;
+    uint64_t mask;
+
+    /**
+     * Next record to write. Only written by the producer.
+     */
+    uint64_t head __attribute__((aligned(64)));
+
+    /**
+     * Records lost because the ring was full. Only written by the producer.
+     */
+    uint64_t lost;
+
+    /**
+     * Head at the last log_kick(). Only used by the producer.
+     */
+    uint64_t kicked;
+
+    /**
+     * Next record to format. Only written by the consumer.
+     */
+    uint64_t tail __attribute__((aligned(64)));
+
+    /**
+     * Lost records already reported by the consumer.
+     */
+    uint64_t lostReported;
+
+    /**
+     * Time base of the printed timestamps.
+     */
+    uint64_t start;
+
+    FILE *out;
+
+    /**
+     * eventfd that wakes up the formatter thread.
+     */
+    int fd;
+    pthread_t thread;
+    int running;
+    int stop;
+};
+
+/**
+ * Allocates the ring.
+ * @param l the log
+ * @param out where the formatted records go
+ * @param capacity number of records, rounded up to a power of two
+ * @param start time base of the records, printed as 0
+ * @return 0 on success
+ */
+int log_init(struct log *l, FILE *out, size_t capacity, uint64_t start);
+
+/**
+ * Starts the low priority formatter thread. Without the thread, the owner calls log_drain() itself.
+ * @return 0 on success
+ */
+int log_start(struct log *l);
+
+/**
+ * Appends a record. Never blocks: if the ring is full the record is counted as lost.
+ * @param l the log
+ * @param type record type
+ * @param time event time
+ * @param channel MIDI channel
+ * @param a first argument, see log_type
+ * @param b second argument, see log_type
+ * @param data optional payload, truncated to REPORT_MAX_LEN
+ * @param len payload length
+ */
+void log_write(struct log *l, enum log_type type, uint64_t time, uint8_t channel, uint8_t a, uint8_t b,
+               const uint8_t *data, size_t len);
+
+/**
+ * Wakes up the formatter thread, if anything was written since the last kick. Called by the producer once per
+ * iteration of its loop, so a burst costs one syscall.
+ */
+void log_kick(struct log *l);
+
+/**
+ * Formats all pending records. Must only be called from one thread at a time.
+ * @return number of formatted records
+ */
+size_t log_drain(struct log *l);
+
+/**
+ * Stops the formatter thread, formats the remaining records and frees the ring.
+ */
+void log_close(struct log *l);
+
+/**
+ * Prints the number of written and lost records.
+ */
+void log_dump_stats(const struct log *l, FILE *out);
+
+#endif //MIDI2HID_LOG_H
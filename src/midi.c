@@ -0,0 +1,41 @@
+#include <string.h>
+#include "midi.h"
+
+void midi_parser_init(struct midi_parser *p) {
+    memset(p, 0, sizeof(*p));
+}
+
+int midi_parse(struct midi_parser *p, uint8_t b, struct midi_event *ev) {
+    if (b >= 0xf8) {
+        // real-time messages can appear anywhere and don't affect the running status.
+        return 0;
+    }
+    if (b & 0x80) {
+        p->count = 0;
+        if (b >= 0xf0) {
+            // system common messages cancel the running status. their data bytes are dropped.
+            p->status = 0;
+            p->sysex = b == 0xf0;
+            return 0;
+        }
+        p->sysex = 0;
+        p->status = b;
+        p->need = (uint8_t) ((b & 0xe0) == 0xc0 ? 1 : 2);
+        return 0;
+    }
+    if (p->sysex || !p->status) {
+        return 0;
+    }
+    p->data[p->count++] = b;
+    if (p->count < p->need) {
+        return 0;
+    }
+    p->count = 0;
+    ev->type = (uint8_t) (p->status & 0xf0);
+    ev->channel = (uint8_t) (p->status & 0x0f);
+    ev->note = p->data[0];
+    ev->value = p->need == 2 ? p->data[1] : 0;
+    ev->device = 0;
+    ev->stamp = 0;
+    return 1;
+}
@@ -0,0 +1,150 @@
+#ifndef MIDI2HID_MIDI_H
+#define MIDI2HID_MIDI_H
+
+#include <stdint.h>
+
+/**
+ * Event types. The values are the status bytes of the MIDI channel messages.
+ */
+enum midi_type {
+    MIDI_OTHER = 0x00,
+    MIDI_NOTEOFF = 0x80,
+    MIDI_NOTEON = 0x90,
+    MIDI_KEYPRESS = 0xa0,
+    MIDI_CONTROLLER = 0xb0,
+    MIDI_PGMCHANGE = 0xc0,
+    MIDI_CHANPRESS = 0xd0,
+    MIDI_PITCHBEND = 0xe0
+};
+
+/**
+ * Bit of an event type in a set of types.
+ */
+#define MIDI_TYPE_BIT(type) (1u << ((type) >> 4))
+
+/**
+ * Device index of events that don't come from a configured device.
+ */
+#define MIDI_NO_DEVICE 0xff
+
+/**
+ * Decoded MIDI event, independent of the input backend.
+ */
+struct midi_event {
+    /**
+     * Event type (enum midi_type)
+     */
+    uint8_t type;
+
+    /**
+     * MIDI channel (0-15)
+     */
+    uint8_t channel;
+
+    /**
+     * Note or controller number
+     */
+    uint8_t note;
+
+    /**
+     * Velocity or controller value
+     */
+    uint8_t value;
+
+    /**
+     * Index of the device that sent the event, or MIDI_NO_DEVICE. Inputs that read a single device always use 0.
+     */
+    uint8_t device;
+
+    /**
+     * Time the event arrived in the kernel in CLOCK_MONOTONIC nanoseconds, or 0 if the backend doesn't know.
+     */
+    uint64_t stamp;
+};
+
+/**
+ * Maximum number of events drained from the input in one go.
+ */
+#define MIDI_BATCH_LEN 256
+
+/**
+ * Events drained from the input in one wakeup, as a structure of arrays: a pass over one field (eg. the type of
+ * every event) touches only that field.
+ */
+struct midi_batch {
+    uint8_t type[MIDI_BATCH_LEN];
+    uint8_t channel[MIDI_BATCH_LEN];
+    uint8_t note[MIDI_BATCH_LEN];
+    uint8_t value[MIDI_BATCH_LEN];
+    uint8_t device[MIDI_BATCH_LEN];
+    uint64_t stamp[MIDI_BATCH_LEN];
+    int count;
+};
+
+/**
+ * Appends the event to the batch, which must not be full.
+ */
+static inline void midi_batch_add(struct midi_batch *b, const struct midi_event *ev) {
+    int i = b->count++;
+    b->type[i] = ev->type;
+    b->channel[i] = ev->channel;
+    b->note[i] = ev->note;
+    b->value[i] = ev->value;
+    b->device[i] = ev->device;
+    b->stamp[i] = ev->stamp;
+}
+
+/**
+ * Copies the i-th event of the batch.
+ */
+static inline void midi_batch_get(const struct midi_batch *b, int i, struct midi_event *ev) {
+    ev->type = b->type[i];
+    ev->channel = b->channel[i];
+    ev->note = b->note[i];
+    ev->value = b->value[i];
+    ev->device = b->device[i];
+    ev->stamp = b->stamp[i];
+}
+
+/**
+ * State of the streaming MIDI byte parser.
+ */
+struct midi_parser {
+    /**
+     * Current running status, or 0 if there is none.
+     */
+    uint8_t status;
+
+    /**
+     * Data bytes of the current message.
+     */
+    uint8_t data[2];
+
+    /**
+     * Number of received and expected data bytes.
+     */
+    uint8_t count;
+    uint8_t need;
+
+    /**
+     * Set while skipping a system exclusive message.
+     */
+    uint8_t sysex;
+};
+
+/**
+ * Resets the parser.
+ */
+void midi_parser_init(struct midi_parser *p);
+
+/**
+ * Feeds one byte to the parser. Handles running status, skips system exclusive messages and
+ * ignores real-time bytes, even in the middle of a message.
+ * @param p the parser
+ * @param b the byte
+ * @param ev receives the channel message once it is complete
+ * @return 1 if {@code ev} was filled, 0 otherwise.
+ */
+int midi_parse(struct midi_parser *p, uint8_t b, struct midi_event *ev);
+
+#endif //MIDI2HID_MIDI_H
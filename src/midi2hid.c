@@ -1,387 +1,860 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <memory.h>
 #include <ctype.h>
-#include <alsa/asoundlib.h>
-#include <pthread.h>
-#include <time.h>
+#include <poll.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "alloc.h"
+#include "backend.h"
+#include "boot.h"
+#include "engine.h"
+#include "hostpoll.h"
+#include "input.h"
+#include "keymap.h"
+#include "latency.h"
+#include "log.h"
+#include "output.h"
+#include "pipeline.h"
+#include "record.h"
+#include "reload.h"
+#include "rt.h"
 
-static snd_seq_t *seq_handle;
-static int in_port;
-static int in_client_id;
 static int verbose = 0;
 
-static __uint8_t BLANK_REPORT[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+/**
+ * Number of hits kept in the latency trace ring.
+ */
+#define TRACE_CAPACITY 65536
+
+/**
+ * Maximum number of poll descriptors of the MIDI input backend.
+ */
+#define MAX_MIDI_PFDS 8
+
+/**
+ * Maximum number of MIDI devices served at once.
+ */
+#define MAX_DEVICES 4
 
-#define CHK(stmt, msg) if((stmt) < 0) {puts("ERROR: "#msg); exit(1);}
+/**
+ * Fixed slots in the poll set. Each device adds its HID function and its profile reload eventfd,
+ * the descriptors of the MIDI input follow after them.
+ */
+enum {
+    POLL_TIMER = 0,
+    POLL_SIGNAL,
+    POLL_CONNECT,
+    POLL_DEVICES
+};
 
-struct mapping_t {
+#define POLL_HID(d) (POLL_DEVICES + 2 * (d))
+#define POLL_RELOAD(d) (POLL_DEVICES + 2 * (d) + 1)
+#define POLL_MIDI(n) (POLL_DEVICES + 2 * (n))
+
+/**
+ * A MIDI device with its own mapping profile and HID function.
+ */
+struct device {
     /**
-     * MIDI note to map from
+     * fnmatch() pattern of the sequencer client name.
      */
-    const __uint8_t note;
+    const char *pattern;
 
     /**
-     * Keyboard mapping
+     * Profile file or NULL for the built-in profile.
      */
-    const char *key;
+    const char *profile;
 
     /**
-     * HID key
+     * Output backend: the HID function, eg. /dev/hidg1, {@code uinput} or {@code file:path}
      */
-    __uint8_t hidKey;
+    const char *hid;
+    struct backend *backend;
+
+    /**
+     * Frame aligned, non-blocking report writer of the HID function. In pipeline mode it only measures the host's
+     * poll interval before the writer thread starts.
+     */
+    struct output out;
+
+    /**
+     * Writer thread of the HID function in pipeline mode, which owns the output stage then.
+     */
+    struct writer writer;
+
+    struct reload profiles;
+    struct engine engine;
 };
 
+static struct device devices[MAX_DEVICES];
+static int numDevices = 0;
+
 /**
- * Defines the note to keystroke mapping.
- * |----------------|--------|
- * | Pad            | Note   |
- * +----------------+--------+
- * | Kick           | `0x24` |
- * | Snare Head     | `0x26` |
- * | Snare Rim      | `0x28` |
- * | Tom 1          | `0x30` |
- * | Tom 2          | `0x2d` |
- * | Tom 3          | `0x2b` |
- * | HH Open Bow    | `0x2e` |
- * | HH Open Edge   | `0x1a` |
- * | HH Closed Bow  | `0x2a` |
- * | HH Closed Edge | `0x16` |
- * | HH foot closed | `0x2c` |
- * | Crash 1 (Bow)  | `0x31` |
- * | Crash 1 (Edge) | `0x37` |
- * | Crash 2 (Bow)  | `0x00` |
- * | Crash 2 (Edge) | `0x00` |
- * | Ride  2 (Bow)  | `0x33` |
- * | Ride  2 (Edge) | `0x3b` |
+ * Pipeline mode: the MIDI sources and the HID functions are served by threads of their own.
  */
-static struct mapping_t mapping[] = {
-        {.note = 0x24, .key = "--spacebar"}, // kick
-        {.note = 0x2e, .key = "w"}, // high hat (yellow)
-        {.note = 0x1a, .key = "w"}, // high hat (yellow)
-        {.note = 0x2a, .key = "w"}, // high hat (yellow)
-        {.note = 0x16, .key = "w"}, // high hat (yellow)
-        {.note = 0x30, .key = "y"}, // blue tom
-        {.note = 0x31, .key = "y"}, // crash (orange?)
-        {.note = 0x37, .key = "y"}, // crash (orange?)
-        {.note = 0x2d, .key = "h"}, // green tom
-        {.note = 0x2b, .key = "--return"}, // 3rd tom
-        {.note = 0x33, .key = "y"}, // ride (orange?)
-        {.note = 0x3b, .key = "y"}, // ride (orange?)
-        {.note = 0x26, .key = "s"}, // snare (red)
-        {.note = 0x28, .key = "s"}, // snare (red)
-        {.key = NULL}
-};
-
-struct options {
-    const char *opt;
-    __uint8_t val;
-};
+static int pipeline = 0;
+static struct source sources[MAX_DEVICES];
+static int numSources = 0;
 
-// keyboard modifiers. we don't need them here, since we only support
-// un-modified keys.
-static struct options kmod[] = {
-        {.opt = "--left-ctrl", .val = 0x01},
-        {.opt = "--right-ctrl", .val = 0x10},
-        {.opt = "--left-shift", .val = 0x02},
-        {.opt = "--right-shift", .val = 0x20},
-        {.opt = "--left-alt", .val = 0x04},
-        {.opt = "--right-alt", .val = 0x40},
-        {.opt = "--left-meta", .val = 0x08},
-        {.opt = "--right-meta", .val = 0x80},
-        {.opt = NULL}
-};
+/**
+ * Compiles the mapping profile of the device, or the built-in one if it has no profile, and starts watching it
+ * for changes.
+ * @param d the device
+ * @return 0 on success
+ */
+int initMap(struct device *d) {
+    if (reload_start(&d->profiles, d->profile)) {
+        return -1;
+    }
+    keymap_dump(d->profiles.active, stdout);
+    return 0;
+}
 
-static struct options kval[] = {
-        {.opt = "--return", .val = 0x28},
-        {.opt = "--esc", .val = 0x29},
-        {.opt = "--bckspc", .val = 0x2a},
-        {.opt = "--tab", .val = 0x2b},
-        {.opt = "--spacebar", .val = 0x2c},
-        {.opt = "--caps-lock", .val = 0x39},
-        {.opt = "--f1", .val = 0x3a},
-        {.opt = "--f2", .val = 0x3b},
-        {.opt = "--f3", .val = 0x3c},
-        {.opt = "--f4", .val = 0x3d},
-        {.opt = "--f5", .val = 0x3e},
-        {.opt = "--f6", .val = 0x3f},
-        {.opt = "--f7", .val = 0x40},
-        {.opt = "--f8", .val = 0x41},
-        {.opt = "--f9", .val = 0x42},
-        {.opt = "--f10", .val = 0x43},
-        {.opt = "--f11", .val = 0x44},
-        {.opt = "--f12", .val = 0x45},
-        {.opt = "--insert", .val = 0x49},
-        {.opt = "--home", .val = 0x4a},
-        {.opt = "--pageup", .val = 0x4b},
-        {.opt = "--del", .val = 0x4c},
-        {.opt = "--end", .val = 0x4d},
-        {.opt = "--pagedown", .val = 0x4e},
-        {.opt = "--right", .val = 0x4f},
-        {.opt = "--left", .val = 0x50},
-        {.opt = "--down", .val = 0x51},
-        {.opt = "--kp-enter", .val = 0x58},
-        {.opt = "--up", .val = 0x52},
-        {.opt = "--num-lock", .val = 0x53},
-        {.opt = NULL}
-};
+/**
+ * Parses a device given as {@code pattern[:profile[:hid]]}. Empty fields fall back to the profile given with -m
+ * and the HID device given as argument.
+ * @return 0 on success
+ */
+int parseDevice(char *spec, struct device *d) {
+    d->pattern = strsep(&spec, ":");
+    d->profile = spec ? strsep(&spec, ":") : NULL;
+    d->hid = spec;
+    if (!*d->pattern) {
+        return -1;
+    }
+    if (d->profile && !*d->profile) {
+        d->profile = NULL;
+    }
+    if (d->hid && !*d->hid) {
+        d->hid = NULL;
+    }
+    return 0;
+}
 
 /**
- * Finds the option in the given list.
- * @param opts Options list
- * @param tok Token to find
- * @return the value of the option or 0.
+ * Report sink of the engine, that hands the report to the output stage of the HID device.
  */
-__uint8_t findOption(const struct options *opts, const char *tok) {
-    for (int i = 0; opts[i].opt != NULL; i++) {
-        if (strcmp(tok, opts[i].opt) == 0) {
-            return opts[i].val;
-        }
+int send_report(void *ctx, const uint8_t *data, size_t len) {
+    if (output_submit(ctx, data, len, release_now())) {
+        return 5;
     }
     return 0;
 }
 
 /**
- * Map the given key symbol to a HID key code
- * @param {key} the input keu
- * @return the mapped key or 0.
+ * Report sink of the engine in pipeline mode, that hands the report to the writer thread of the HID device. A full
+ * ring drops the report, which the writer stats count.
  */
-__uint8_t mapKey(const char *key) {
-    unsigned char val = findOption(kval, key);
-    if (val) {
-        return val;
-    }
-    const char t = key[0];
-    if (t >= 'a' && t <= 'z') {
-        return (unsigned char) (t - ('a' - 0x04));
-    } else if (t >= '1' && t <= '9') {
-        return (unsigned char) (t - ('1' - 0x1e));
-    } else if (t == '0') {
-        return (unsigned char) (0x27);
-    }
-    fprintf(stderr, "unknown option: %s\n", key);
+int submit_report(void *ctx, const uint8_t *data, size_t len) {
+    writer_submit(ctx, data, len);
     return 0;
 }
 
-void initMap() {
-    printf("Mapping\n");
-    for (int i = 0; mapping[i].key; i++) {
-        struct mapping_t* map = &mapping[i];
-        map->hidKey = mapKey(map->key);
-        printf("├── Note: %02x\n", map->note);
-        printf("│   ├── Keys: %s\n", map->key);
-        printf("│   └── Mapped: %02x\n", map->hidKey);
-        printf("│\n");
+/**
+ * Prints the counters of the output stage of the device. In pipeline mode its writer thread owns the output stage
+ * and publishes them.
+ */
+void dumpOutput(struct device *d, FILE *out) {
+    if (!pipeline) {
+        output_dump_stats(&d->out, out);
+        return;
     }
+    struct output_stats stats;
+    struct hostpoll poll;
+    writer_stats(&d->writer, &stats, &poll);
+    output_print_stats(&stats, &poll, out);
 }
 
-struct mapping_t* findMap(__uint8_t note) {
-    for (int i = 0; mapping[i].key; i++) {
-        if (mapping[i].note == note) {
-            return &mapping[i];
+/**
+ * Writes what's left in the output queue, so no key is left stuck on the host.
+ */
+void drainOutput(struct output *o) {
+    for (int tries = 0; tries < 100 && o->count; tries++) {
+        if (output_blocked(o)) {
+            struct pollfd pfd = {.fd = o->backend->fd, .events = POLLOUT};
+            poll(&pfd, 1, 10);
+        } else {
+            usleep((useconds_t) (o->frame / 1000));
+        }
+        if (output_flush(o, release_now())) {
+            return;
         }
     }
-    return NULL;
 }
 
-int send_report(int fd, __uint8_t* report) {
-    if (verbose) {
-        printf("sending report: ");
-        for (int k = 0; k < 8; k++) {
-            printf(" %02x", report[k]);
+/**
+ * Reads and logs the output reports (eg. LED state) the host sent to the gadget.
+ * @param fd the HID device
+ * @param log the log
+ */
+void consumeHID(int fd, struct log *log) {
+    char buf[512];
+    ssize_t cmd_len = read(fd, buf, 512 - 1);
+    if (cmd_len < 0) {
+        if (errno != EAGAIN && errno != EINTR) {
+            perror("hid");
         }
-        printf("\n");
+        return;
     }
+    log_write(log, LOG_RECV, release_now(), 0, 0, 0, (const uint8_t *) buf, (size_t) cmd_len);
+}
 
-    if (write(fd, report, 8) != 8) {
-        perror("hid");
-        return 5;
+/**
+ * Lets only the event types through that one of the active profiles maps. A recording keeps every channel message,
+ * so that it can be replayed with other profiles.
+ */
+void updateFilter(struct input *in, int recording) {
+    if (!pipeline && !in->filter) {
+        return;
     }
-    return 0;
+    unsigned types = 0;
+    for (int d = 0; d < numDevices; d++) {
+        types |= keymap_event_types(devices[d].profiles.active);
+    }
+    if (recording) {
+        types = ~0u;
+    }
+    if (pipeline) {
+        // applied by the input threads
+        for (int s = 0; s < numSources; s++) {
+            source_filter(&sources[s], types);
+        }
+        return;
+    }
+    in->filter(in, types);
 }
 
+/**
+ * Prints what the rings of pipeline mode dropped.
+ */
+void dumpPipeline(FILE *out) {
+    uint64_t events = 0;
+    uint64_t reports = 0;
+    for (int s = 0; s < numSources; s++) {
+        events += __atomic_load_n(&sources[s].events.dropped, __ATOMIC_RELAXED);
+    }
+    for (int d = 0; d < numDevices; d++) {
+        reports += devices[d].writer.reports.dropped;
+    }
+    fprintf(out, "pipeline: %d sources, %d writers\n", numSources, numDevices);
+    fprintf(out, "├── dropped events: %llu\n", (unsigned long long) events);
+    fprintf(out, "└── dropped reports: %llu\n", (unsigned long long) reports);
+}
 
-void midi_open(void) {
-    CHK(snd_seq_open(&seq_handle, "default", SND_SEQ_OPEN_INPUT, 0), "Could not open sequencer");
-    CHK(snd_seq_set_client_name(seq_handle, "midi2hid"), "Could not set client name");
-    CHK(in_port = snd_seq_create_simple_port(seq_handle, "listen:in",
-                                             SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
-                                             SND_SEQ_PORT_TYPE_APPLICATION),
-        "Could not open port");
-    in_client_id = snd_seq_client_id(seq_handle);
-    printf("Started client on %d:%d\n", in_client_id, in_port);
+/**
+ * Returns the allocations of the input and writer threads, which count their own.
+ */
+uint64_t pipelineAllocs(void) {
+    uint64_t allocs = 0;
+    for (int s = 0; s < numSources; s++) {
+        allocs += __atomic_load_n(&sources[s].allocs, __ATOMIC_RELAXED);
+    }
+    for (int d = 0; d < numDevices && pipeline; d++) {
+        allocs += __atomic_load_n(&devices[d].writer.allocs, __ATOMIC_RELAXED);
+    }
+    return allocs;
 }
 
-void midi_capture(snd_seq_t *seq, int client, int port) {
-    snd_seq_addr_t sender, dest;
-    snd_seq_port_subscribe_t *subs;
-    sender.client = (__uint8_t) client;
-    sender.port = (__uint8_t) port;
-    dest.client = (__uint8_t) in_client_id;
-    dest.port = (__uint8_t) in_port;
-    snd_seq_port_subscribe_alloca(&subs);
-    snd_seq_port_subscribe_set_sender(subs, &sender);
-    snd_seq_port_subscribe_set_dest(subs, &dest);
-    snd_seq_port_subscribe_set_queue(subs, 1);
-    snd_seq_port_subscribe_set_time_update(subs, 1);
-    snd_seq_port_subscribe_set_time_real(subs, 1);
-    if (snd_seq_subscribe_port(seq, subs) < 0) {
-        fprintf(stderr, "Could not subscribe to %d:%d.\n", dest.client, dest.port);
-    } else {
-        printf("Subscribed to %d:%d\n", client, port);
+/**
+ * Returns the i-th CPU of a comma separated list, starting over at the end of the list.
+ * @return the CPU or -1 without a list
+ */
+int cpuOf(const char *list, int i) {
+    if (!list) {
+        return -1;
+    }
+    int n = 1;
+    for (const char *c = list; *c; c++) {
+        n += *c == ',';
+    }
+    const char *c = list;
+    for (i %= n; i > 0; i--) {
+        c = strchr(c, ',') + 1;
     }
+    return atoi(c);
 }
 
-snd_seq_event_t *midi_read(void) {
-    snd_seq_event_t *ev = NULL;
-    if (snd_seq_event_input_pending(seq_handle, 1)) {
-        snd_seq_event_input(seq_handle, &ev);
+/**
+ * Prints how often the event loop woke up since it started.
+ */
+void dumpWakeups(uint64_t wakeups, uint64_t started) {
+    double seconds = (double) (release_now() - started) / 1e9;
+    printf("event loop wakeups: %llu (%.1f/s)\n", (unsigned long long) wakeups, seconds > 0 ? wakeups / seconds : 0);
+}
+
+/**
+ * Arms the release timer for the given deadline, or disarms it if the deadline is 0.
+ * @param tfd the timer fd
+ * @param next absolute CLOCK_MONOTONIC deadline
+ */
+void arm_timer(int tfd, uint64_t next) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = (time_t) (next / 1000000000ULL);
+    its.it_value.tv_nsec = (long) (next % 1000000000ULL);
+    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("timerfd_settime");
     }
-    return ev;
 }
 
-__uint8_t midi_process(const snd_seq_event_t *ev, __uint8_t minVelocity) {
-    if (!ev) {
+/**
+ * @return 1 if the reports go to a HID gadget function, which appears once the gadget is set up
+ */
+int isGadget(const char *hid) {
+    return strcmp(hid, "uinput") != 0 && strncmp(hid, "file:", 5) != 0;
+}
+
+/**
+ * Returns the device node of a raw MIDI input, eg. /dev/snd/midiC1D0 for hw:1,0.
+ * @return the node, or NULL for an ALSA name that doesn't map to a node
+ */
+const char *rawNode(const char *dev, char *buf, size_t len) {
+    int card, device = 0;
+    if (strncmp(dev, "hw:", 3) != 0) {
+        return dev;
+    }
+    if (sscanf(dev, "hw:%d,%d", &card, &device) < 1) {
+        return NULL;
+    }
+    snprintf(buf, len, "/dev/snd/midiC%dD%d", card, device);
+    return buf;
+}
+
+/**
+ * Measures the poll interval of the host on the HID function of the device, and holds the keys for at least
+ * {@code polls} polls. The default hold times stay if the host doesn't poll. Runs before the writer thread of the
+ * device is started, which takes the intervals over.
+ * @return 0 on success, HOSTPOLL_CANCELLED if the probe was aborted, -1 if it failed
+ */
+int probeHost(int d, int polls, int cancelFd) {
+    struct device *dev = &devices[d];
+    struct output *o = &dev->out;
+    int ret = hostpoll_probe(&o->poll, dev->backend, o->mode, HOSTPOLL_PROBES, cancelFd);
+    struct hostpoll_estimate est;
+    if (ret < 0) {
+        return ret;
+    }
+    if (!hostpoll_estimate(&o->poll, &est)) {
+        printf("device %d: the host doesn't poll, keeping the default hold times\n", d);
         return 0;
     }
-    if (ev->type == SND_SEQ_EVENT_NOTEON) {
-        if (verbose) {
-            printf("[%d] Note on: %2x vel(%2x)\n", ev->time.tick, ev->data.note.note, ev->data.note.velocity);
-        }
-        if (ev->data.note.velocity >= minVelocity) {
-            return ev->data.note.note;
-        }
-    } else if (ev->type == SND_SEQ_EVENT_NOTEOFF) {
-        if (verbose) {
-            printf("[%d] Note off: %2x vel(%2x)\n", ev->time.tick, ev->data.note.note, ev->data.note.velocity);
-        }
-    } else if (ev->type == SND_SEQ_EVENT_CONTROLLER) {
-        if (verbose) {
-            printf("[%d] Control:  %2x val(%2x)\n", ev->time.tick, ev->data.control.param, ev->data.control.value);
-        }
-    } else {
-        if (verbose) {
-            printf("[%d] Unknown:  Unhandled Event Received\n", ev->time.tick);
-        }
+    struct engine *engine = &dev->engine;
+    engine->minHold = hostpoll_hold(&est, polls);
+    // the gap of a retrigger has to span a poll as well
+    if (est.interval + est.jitter > engine->repeatGap) {
+        engine->repeatGap = est.interval + est.jitter;
     }
+    printf("device %d: host polls every %.3fms ±%.3fms, keys are held for %ums at least\n", d,
+           est.interval / 1e6, est.jitter / 1e6, engine->minHold);
     return 0;
 }
 
-void *consumeHID(void *vargp) {
-    int fd = *(int*) vargp;
-    fd_set rfds;
-    char buf[512];
-
-    printf("starting HID consumer with fd = %d\n", fd);
-    while (fd) {
-        FD_ZERO(&rfds);
-        FD_SET(fd, &rfds);
-        int retval = select(fd + 1, &rfds, NULL, NULL, NULL);
-        if (retval == -1 && errno == EINTR)
-            continue;
-        if (retval < 0) {
-            perror("select()");
-            fd = 0;
-            continue;
-        }
-        if (FD_ISSET(fd, &rfds)) {
-            ssize_t cmd_len = read(fd, buf, 512 - 1);
-            printf("recv report:");
-            for (int i = 0; i < cmd_len; i++) {
-                printf(" %02x", buf[i]);
-            }
-            printf("\n");
+/**
+ * Records when the first MIDI device was connected to any input.
+ */
+void markMidi(struct boot *boot, struct input *in) {
+    uint64_t connected = in ? __atomic_load_n(&in->connected, __ATOMIC_ACQUIRE) : 0;
+    for (int s = 0; s < numSources; s++) {
+        uint64_t c = __atomic_load_n(&sources[s].in->connected, __ATOMIC_ACQUIRE);
+        if (c && (!connected || c < connected)) {
+            connected = c;
         }
     }
-    printf("Stopping HID consumer\n");
-    return 0;
+    if (connected) {
+        boot_mark(boot, BOOT_MIDI, connected);
+    }
 }
 
 int printUsage(char *bin) {
-    fprintf(stderr, "Usage: %s [-v] device\n", bin);
+    fprintf(stderr, "Usage: %s [-v] [-n|-g] [-F frame-us] [-q repeats] [-p priority] [-c cpu] "
+                    "[-H polls] [-P [-I cpu,...] [-O cpu,...]] [-m profile] [-D pattern[:profile[:hid]]]... [-i midi-device]"
+                    " [-U udc] [-t tracefile] [-r recording] [hidg-device|uinput|file:path]\n",
+            bin);
     return -1;
 }
 
 int main(int argc, char *argv[]) {
+    static struct boot boot;
+    boot_init(&boot);
     char *dhid = 0;
     int opt;
-    while ((opt = getopt(argc, argv, "v")) != -1) {
+    char *profile = NULL;
+    char *midiDev = NULL;
+    char *udc = NULL;
+    char *traceFile = NULL;
+    char *recordFile = NULL;
+    enum report_mode mode = REPORT_BOOT;
+    int priority = 0;
+    int cpu = -1;
+    const char *inputCpus = NULL;
+    const char *writerCpus = NULL;
+    uint64_t frame = OUTPUT_FRAME_NS;
+    int repeats = ENGINE_MAX_REPEATS;
+    int holdPolls = HOSTPOLL_HOLD_POLLS;
+    while ((opt = getopt(argc, argv, "vngPF:q:H:p:c:I:O:m:D:i:U:t:r:")) != -1) {
         switch (opt) {
             case 'v':
                 verbose = 1;
                 break;
+            case 'p':
+                priority = atoi(optarg);
+                break;
+            case 'c':
+                cpu = atoi(optarg);
+                break;
+            case 'P':
+                pipeline = 1;
+                break;
+            case 'I':
+                inputCpus = optarg;
+                break;
+            case 'O':
+                writerCpus = optarg;
+                break;
+            case 'F':
+                frame = (uint64_t) atoi(optarg) * 1000;
+                break;
+            case 'q':
+                repeats = atoi(optarg);
+                break;
+            case 'H':
+                holdPolls = atoi(optarg);
+                break;
+            case 'n':
+                mode = REPORT_NKRO;
+                break;
+            case 'g':
+                mode = REPORT_COMPOSITE;
+                break;
+            case 'r':
+                recordFile = optarg;
+                break;
+            case 't':
+                traceFile = optarg;
+                break;
+            case 'i':
+                midiDev = optarg;
+                break;
+            case 'U':
+                udc = optarg;
+                break;
+            case 'm':
+                profile = optarg;
+                break;
+            case 'D':
+                if (numDevices == MAX_DEVICES || parseDevice(optarg, &devices[numDevices])) {
+                    return printUsage(argv[0]);
+                }
+                numDevices++;
+                break;
             default:
                 return printUsage(argv[0]);
         }
     }
-    if (optind >= argc) {
+    dhid = optind < argc ? argv[optind] : NULL;
+    if (!numDevices) {
+        // any MIDI device
+        devices[numDevices++].pattern = "*";
+    }
+    if (midiDev && numDevices > 1) {
+        fprintf(stderr, "a raw MIDI input serves a single device\n");
         return printUsage(argv[0]);
     }
-    dhid = argv[optind];
-    __uint8_t minVelocity = 0x28;
+    for (int d = 0; d < numDevices; d++) {
+        struct device *dev = &devices[d];
+        dev->profile = dev->profile ? dev->profile : profile;
+        dev->hid = dev->hid ? dev->hid : dhid;
+        if (!dev->hid) {
+            return printUsage(argv[0]);
+        }
+        for (int o = 0; o < d; o++) {
+            // several uinput devices are fine, every open creates a new one
+            if (strcmp(devices[o].hid, dev->hid) == 0 && strcmp(dev->hid, "uinput") != 0) {
+                fprintf(stderr, "%s: every device needs its own HID function\n", dev->hid);
+                return 3;
+            }
+        }
+    }
 
-    int fd;
-    if ((fd = open(dhid, O_RDWR, 0666)) == -1) {
-        perror(dhid);
+    int tfd;
+    if ((tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+        perror("timerfd");
+        return 3;
+    }
+    // signaled by the sequencer's discovery thread when the first MIDI device is connected
+    int cfd;
+    if ((cfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        perror("eventfd");
         return 3;
     }
 
-    pthread_t thread_id;
-    pthread_create(&thread_id, NULL, consumeHID, &fd);
+    // SIGUSR1 dumps the latency statistics, SIGINT and SIGTERM stop the loop. they are handled via
+    // signalfd and must be blocked before any thread is started.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    int sfd;
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0 || (sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+        perror("signalfd");
+        return 3;
+    }
+    if (traceFile && lat_trace_enable(TRACE_CAPACITY)) {
+        perror("trace");
+        return 3;
+    }
+    struct record rec;
+    if (recordFile && record_create(&rec, recordFile, release_now())) {
+        return 3;
+    }
 
     printf("MIDI-2-HiD Adapter\n");
     printf("------------------\n\n");
-    initMap();
-    midi_open();
-    midi_capture(seq_handle, 20, 0);
+    const char *patterns[MAX_DEVICES];
+    for (int d = 0; d < numDevices; d++) {
+        printf("device %d: %s -> %s\n", d, devices[d].pattern, devices[d].hid);
+        if (initMap(&devices[d])) {
+            return 4;
+        }
+        patterns[d] = devices[d].pattern;
+    }
+    boot_mark(&boot, BOOT_PROFILES, release_now());
+    char node[64];
+    const char *midiNode = midiDev ? rawNode(midiDev, node, sizeof(node)) : NULL;
+    if (midiNode && boot_wait_path(midiNode, sfd)) {
+        return 0;
+    }
+
+    // without a device, use the sequencer, which connects the devices whenever they show up. otherwise parse the
+    // raw byte stream of the device.
+    struct input *in = NULL;
+    if (pipeline) {
+        // every device is a source of its own, read by its own thread
+        for (int d = 0; d < (midiDev ? 1 : numDevices); d++) {
+            struct input *src = midiDev ? input_raw_open(midiDev) : input_seq_open(&patterns[d], 1);
+            if (!src || source_start(&sources[d], src, (uint8_t) d, priority, cpuOf(inputCpus, d))) {
+                return 2;
+            }
+            numSources++;
+        }
+    } else if (!(in = midiDev ? input_raw_open(midiDev) : input_seq_open(patterns, numDevices))) {
+        return 2;
+    }
+    updateFilter(in, recordFile != NULL);
     printf("listening to midi\n");
+    boot_mark(&boot, BOOT_INPUT, release_now());
+
+    // everything printed per event goes through the log ring, formatted by a low priority thread that only wakes
+    // up when the loop wrote something.
+    static struct log log;
+    if (log_init(&log, stdout, LOG_CAPACITY, release_now()) || log_start(&log)) {
+        return 1;
+    }
+    for (int d = 0; d < numDevices; d++) {
+        struct engine *engine = &devices[d].engine;
+        if (pipeline) {
+            engine_init(engine, mode, devices[d].profiles.active, submit_report, &devices[d].writer, release_now());
+        } else {
+            engine_init(engine, mode, devices[d].profiles.active, send_report, &devices[d].out, release_now());
+        }
+        engine->log = verbose ? &log : NULL;
+        engine->trace = 1;
+        engine->maxRepeats = (uint8_t) repeats;
+        // a retrigger has to be visible for at least one frame
+        if (frame > engine->repeatGap) {
+            engine->repeatGap = frame;
+        }
+    }
+
+    // the mapping is ready. on power-up the gadget may not be set up yet: wait for its HID functions and for the
+    // host to configure it, instead of failing. SIGINT and SIGTERM abort the wait.
+    int gadget = 0;
+    for (int d = 0; d < numDevices; d++) {
+        struct device *dev = &devices[d];
+        if (isGadget(dev->hid)) {
+            gadget = 1;
+            if (boot_wait_path(dev->hid, sfd)) {
+                return 0;
+            }
+        }
+        if (!(dev->backend = backend_open(dev->hid, mode))) {
+            return 3;
+        }
+        printf("device %d: %s (%s)\n", d, dev->hid, dev->backend->name);
+        output_init(&dev->out, dev->backend, mode, frame);
+    }
+    boot_mark(&boot, BOOT_HID, release_now());
+    char udcName[256];
+    if (gadget && !udc) {
+        udc = (char *) boot_find_udc(udcName, sizeof(udcName));
+    }
+    if (gadget && udc && boot_wait_udc(udc, sfd)) {
+        return 0;
+    }
+    boot_mark(&boot, BOOT_UDC, release_now());
+    // hold the keys just long enough for the host, instead of a fixed guess. -H 0 keeps the fixed hold times.
+    for (int d = 0; d < numDevices && holdPolls > 0; d++) {
+        int ret = isGadget(devices[d].hid) ? probeHost(d, holdPolls, sfd) : 0;
+        if (ret == HOSTPOLL_CANCELLED) {
+            return 0;
+        }
+        if (ret < 0) {
+            fprintf(stderr, "device %d: could not probe the host on %s\n", d, devices[d].hid);
+            return 2;
+        }
+    }
+    // in pipeline mode the writer threads take over the output stages
+    for (int d = 0; d < numDevices && pipeline; d++) {
+        struct device *dev = &devices[d];
+        if (writer_start(&dev->writer, dev->backend, mode, frame, &dev->out.poll, priority, cpuOf(writerCpus, d))) {
+            return 2;
+        }
+    }
+    // the MIDI input is open since the mapping was loaded. whatever was played while waiting for the gadget and the
+    // host is stale: drop it, instead of replaying it as late presses.
+    if (pipeline) {
+        for (int s = 0; s < numSources; s++) {
+            source_live(&sources[s]);
+        }
+    } else if (in->drop) {
+        in->drop(in);
+    }
+
+    // one poll set for everything: the release timer, the HID functions and profiles of the devices and the
+    // MIDI input descriptors, or the event rings of the sources in pipeline mode.
+    struct pollfd pfds[POLL_MIDI(MAX_DEVICES) + MAX_MIDI_PFDS];
+    memset(pfds, 0, sizeof(pfds));
+    pfds[POLL_TIMER].fd = tfd;
+    pfds[POLL_TIMER].events = POLLIN;
+    pfds[POLL_SIGNAL].fd = sfd;
+    pfds[POLL_SIGNAL].events = POLLIN;
+    pfds[POLL_CONNECT].fd = cfd;
+    pfds[POLL_CONNECT].events = POLLIN;
+    if (in) {
+        __atomic_store_n(&in->connectFd, cfd, __ATOMIC_RELEASE);
+    }
+    for (int s = 0; s < numSources; s++) {
+        __atomic_store_n(&sources[s].in->connectFd, cfd, __ATOMIC_RELEASE);
+    }
+    for (int d = 0; d < numDevices; d++) {
+        pfds[POLL_HID(d)].fd = devices[d].backend->fd;
+        pfds[POLL_RELOAD(d)].fd = devices[d].profiles.readyFd;
+        pfds[POLL_RELOAD(d)].events = POLLIN;
+    }
+    int nmidi = numSources;
+    for (int s = 0; s < numSources; s++) {
+        pfds[POLL_MIDI(numDevices) + s].fd = sources[s].events.fd;
+        pfds[POLL_MIDI(numDevices) + s].events = POLLIN;
+    }
+    if (!pipeline) {
+        nmidi = in->poll_descriptors(in, &pfds[POLL_MIDI(numDevices)], MAX_MIDI_PFDS);
+    }
+    nfds_t npfds = (nfds_t) (POLL_MIDI(numDevices) + nmidi);
+
     int running = 1;
+    uint64_t armed = 0;
+    static struct midi_batch batch;
 
-    clock_t now = clock();
-    clock_t delay = CLOCKS_PER_SEC / 50; // delay for 20ms
-    __uint8_t report[8];
-    memset(report, 0, 8);
-    __uint8_t pressed[256];
-    memset(pressed,0, 256);
-    int k = 0;
-    int releaseKeys = 0;
+    // real-time mode: the helper threads are running by now and keep their normal (or idle) scheduling, the
+    // threads of the pipeline have entered it on their own.
+    if (priority > 0 && (rt_lock_memory(RT_STACK_PREFAULT) || rt_enter(priority, cpu))) {
+        return 6;
+    }
+    // everything the event loop needs is allocated at this point
+    uint64_t allocs = alloc_count();
+    uint64_t wakeups = 0;
+    uint64_t started = release_now();
     while(running) {
-        __uint8_t note = midi_process(midi_read(), minVelocity);
-        if (note) {
-            struct mapping_t *map = findMap(note);
-            if (map) {
-                if (verbose) {
-                    printf("note %02x maps to %s\n", note, map->key);
-                }
-                if (pressed[map->hidKey]++) {
-                    if (verbose) {
-                        printf("..too fast. %s already included in current report.\n", map->key);
+        for (int d = 0; d < numDevices; d++) {
+            struct backend *backend = devices[d].backend;
+            pfds[POLL_HID(d)].events = (short) ((backend->readable ? POLLIN : 0) |
+                                                (!pipeline && output_blocked(&devices[d].out) ? POLLOUT : 0));
+        }
+        if (!boot.done[BOOT_MIDI]) {
+            markMidi(&boot, in);
+            if (boot.done[BOOT_MIDI]) {
+                // later devices don't change the boot times
+                pfds[POLL_CONNECT].fd = -1;
+            }
+            if (boot_ready(&boot)) {
+                printf("ready\n");
+                boot_dump(&boot, stdout);
+            }
+        }
+        if (poll(pfds, npfds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+        wakeups++;
+        if (pfds[POLL_CONNECT].revents & POLLIN) {
+            uint64_t count;
+            // the next iteration marks the connection
+            if (read(cfd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                perror("eventfd");
+            }
+        }
+        for (int d = 0; d < numDevices; d++) {
+            if (pfds[POLL_HID(d)].revents & POLLIN) {
+                consumeHID(devices[d].backend->fd, &log);
+            }
+            if ((pfds[POLL_HID(d)].revents & POLLOUT) && output_flush(&devices[d].out, release_now())) {
+                exit(-1);
+            }
+        }
+        if (pfds[POLL_SIGNAL].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            while (read(sfd, &si, sizeof(si)) == sizeof(si)) {
+                if (si.ssi_signo == SIGUSR1) {
+                    for (int d = 0; d < numDevices; d++) {
+                        printf("device %d: %s\n", d, devices[d].pattern);
+                        engine_dump_stats(&devices[d].engine, stdout);
+                        dumpOutput(&devices[d], stdout);
+                    }
+                    if (pipeline) {
+                        dumpPipeline(stdout);
+                    }
+                    log_dump_stats(&log, stdout);
+                    printf("allocations in the event loop: %llu\n",
+                           (unsigned long long) (alloc_count() - allocs + pipelineAllocs()));
+                    dumpWakeups(wakeups, started);
+                    boot_dump(&boot, stdout);
+                    lat_dump(stdout);
+                    if (traceFile) {
+                        // the export opens a file, which allocates. that's on request, not in the event path.
+                        uint64_t before = alloc_count();
+                        lat_trace_export(traceFile);
+                        allocs += alloc_count() - before;
                     }
                 } else {
-                    if (k == 8) {
-                        printf("..too fast. %s current report already full.\n", map->key);
-                    } else {
-                        report[2+k++] = map->hidKey;
-                        if (send_report(fd, report)) {
-                            exit(-1);
+                    running = 0;
+                }
+            }
+        }
+        // drain everything that is pending, and map it batch by batch
+        int ret = 0;
+        for (int s = 0; s < (pipeline ? numSources : 1) && ret >= 0; s++) {
+            if (pipeline && (pfds[POLL_MIDI(numDevices) + s].revents & POLLIN)) {
+                ring_clear(&sources[s].events);
+            }
+            while ((ret = pipeline ? source_drain(&sources[s], &batch) : input_drain(in, &batch)) > 0) {
+                uint64_t now = release_now();
+                if (recordFile) {
+                    struct midi_event ev;
+                    for (int i = 0; i < batch.count; i++) {
+                        midi_batch_get(&batch, i, &ev);
+                        // events of devices that are gone, or of clients that don't match any device
+                        if (ev.device < numDevices) {
+                            record_write(&rec, &ev, now);
                         }
-                        now = clock();
                     }
                 }
-            } else {
-                if (verbose) {
-                    printf("note %02x is not mapped\n", note);
+                for (int d = 0; d < numDevices; d++) {
+                    if (engine_batch(&devices[d].engine, &batch, (uint8_t) d, now)) {
+                        exit(-1);
+                    }
+                }
+                if (ret < MIDI_BATCH_LEN) {
+                    break;
                 }
             }
         }
-        if (clock() - now >= delay) {
-            if (k > 0) {
-                send_report(fd, BLANK_REPORT);
-                k = 0;
-                releaseKeys = 1;
-                memset(report, 0, 8);
-                memset(pressed, 0, 256);
+        if (ret < 0) {
+            running = 0;
+        }
+        if (pfds[POLL_TIMER].revents & POLLIN) {
+            uint64_t expirations;
+            if (read(tfd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                uint64_t now = release_now();
+                for (int d = 0; d < numDevices; d++) {
+                    if (engine_expire(&devices[d].engine, now) || (!pipeline && output_flush(&devices[d].out, now))) {
+                        exit(-1);
+                    }
+                }
+                armed = 0;
+            }
+        }
+        uint64_t next = 0;
+        for (int d = 0; d < numDevices; d++) {
+            struct device *dev = &devices[d];
+            const struct keymap *swapped;
+            if ((pfds[POLL_RELOAD(d)].revents & POLLIN) && (swapped = reload_swap(&dev->profiles)) != NULL) {
+                if (engine_set_keymap(&dev->engine, swapped)) {
+                    exit(-1);
+                }
+                printf("device %d: profile reloaded\n", d);
+                updateFilter(in, recordFile != NULL);
+                if (verbose) {
+                    keymap_dump(swapped, stdout);
+                }
             }
-            now = clock();
+            uint64_t due = engine_next(&dev->engine);
+            if (due && (!next || due < next)) {
+                next = due;
+            }
+            if (pipeline) {
+                // one wakeup of the writer per iteration, however many reports the batch produced
+                ring_kick(&dev->writer.reports);
+                continue;
+            }
+            due = output_next(&dev->out);
+            if (due && (!next || due < next)) {
+                next = due;
+            }
+        }
+        if (next != armed) {
+            arm_timer(tfd, next);
+            armed = next;
         }
+        log_kick(&log);
+    }
+    // don't leave keys stuck on the host
+    int failed = 0;
+    for (int d = 0; d < numDevices; d++) {
+        engine_release_all(&devices[d].engine);
+        if (pipeline) {
+            writer_stop(&devices[d].writer);
+            failed |= devices[d].writer.failed;
+        } else {
+            drainOutput(&devices[d].out);
+        }
+        devices[d].backend->close(devices[d].backend);
+    }
+    allocs = alloc_count() - allocs;
+    log_close(&log);
+    for (int s = 0; s < numSources; s++) {
+        source_stop(&sources[s]);
     }
-}
\ No newline at end of file
+    if (in) {
+        in->close(in);
+    }
+    if (recordFile) {
+        record_close(&rec);
+    }
+    for (int d = 0; d < numDevices; d++) {
+        printf("device %d: %s\n", d, devices[d].pattern);
+        engine_dump_stats(&devices[d].engine, stdout);
+        dumpOutput(&devices[d], stdout);
+    }
+    if (pipeline) {
+        dumpPipeline(stdout);
+    }
+    log_dump_stats(&log, stdout);
+    printf("allocations in the event loop: %llu\n", (unsigned long long) (allocs + pipelineAllocs()));
+    dumpWakeups(wakeups, started);
+    lat_dump(stdout);
+    if (traceFile) {
+        lat_trace_export(traceFile);
+    }
+    return failed ? -1 : 0;
+}
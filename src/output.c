@@ -0,0 +1,132 @@
+#include <errno.h>
+#include <string.h>
+#include "output.h"
+
+void output_init(struct output *o, struct backend *backend, enum report_mode mode, uint64_t frame) {
+    memset(o, 0, sizeof(*o));
+    o->backend = backend;
+    o->mode = mode;
+    o->frame = frame;
+    hostpoll_init(&o->poll);
+    // the host starts with all keys released
+    if (mode == REPORT_COMPOSITE) {
+        for (int id = 1; id <= REPORT_IDS; id++) {
+            o->last[id][0] = (uint8_t) id;
+        }
+    }
+}
+
+static int slot_index(const struct output *o, int i) {
+    return (o->head + i) % OUTPUT_QUEUE_LEN;
+}
+
+static uint8_t *slot(struct output *o, int i) {
+    return o->queue[slot_index(o, i)];
+}
+
+/**
+ * Finds the newest waiting report with the given ID, before position i of the queue.
+ * @return the position or -1
+ */
+static int find_report(struct output *o, uint8_t id, int i) {
+    while (--i >= 0) {
+        if (report_id(o->mode, slot(o, i)) == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Checks if replacing the pending report with the new one would hide a change from the host: a key the pending
+ * report presses and the new one releases again, or a key the pending report releases and the new one presses
+ * again (a retrigger).
+ */
+static int hides_change(const struct output *o, const uint8_t *previous, const uint8_t *pending, const uint8_t *next) {
+    uint8_t before[32], between[32], after[32];
+    report_keys(o->mode, previous, before);
+    report_keys(o->mode, pending, between);
+    report_keys(o->mode, next, after);
+    for (int i = 0; i < 32; i++) {
+        if ((between[i] & ~before[i] & ~after[i]) || (~between[i] & before[i] & after[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int output_submit(struct output *o, const uint8_t *data, size_t len, uint64_t now) {
+    uint8_t id = report_id(o->mode, data);
+    int pending = find_report(o, id, o->count);
+    if (pending >= 0) {
+        int before = find_report(o, id, pending);
+        const uint8_t *previous = before >= 0 ? slot(o, before) : o->last[id];
+        if (!hides_change(o, previous, slot(o, pending), data)) {
+            memcpy(slot(o, pending), data, len);
+            o->stats.coalesced++;
+            return output_flush(o, now);
+        }
+    }
+    if (o->count == OUTPUT_QUEUE_LEN) {
+        // the newest state always gets through, the oldest transition is lost.
+        o->head = (o->head + 1) % OUTPUT_QUEUE_LEN;
+        o->count--;
+        o->stats.dropped++;
+    }
+    memcpy(slot(o, o->count), data, len);
+    o->queueLen[slot_index(o, o->count)] = len;
+    o->count++;
+    return output_flush(o, now);
+}
+
+int output_flush(struct output *o, uint64_t now) {
+    while (o->count && now >= o->nextWrite) {
+        const uint8_t *data = slot(o, 0);
+        size_t len = o->queueLen[o->head];
+        uint8_t *last = o->last[report_id(o->mode, data)];
+        if (memcmp(data, last, len) == 0) {
+            o->stats.duplicates++;
+        } else {
+            ssize_t ret = o->backend->write(o->backend, data, len);
+            if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                if (!o->blocked) {
+                    o->stats.deferred++;
+                    o->blocked = 1;
+                }
+                return 0;
+            }
+            if (ret != (ssize_t) len) {
+                perror(o->backend->name);
+                return -1;
+            }
+            o->stats.written++;
+            hostpoll_written(&o->poll, now, o->blocked);
+            memcpy(last, data, len);
+            o->nextWrite = now + o->frame;
+        }
+        o->blocked = 0;
+        o->head = (o->head + 1) % OUTPUT_QUEUE_LEN;
+        o->count--;
+    }
+    return 0;
+}
+
+void output_dump_stats(const struct output *o, FILE *out) {
+    output_print_stats(&o->stats, &o->poll, out);
+}
+
+void output_print_stats(const struct output_stats *stats, const struct hostpoll *poll, FILE *out) {
+    fprintf(out, "Output\n");
+    fprintf(out, "├── written:    %llu\n", (unsigned long long) stats->written);
+    fprintf(out, "├── coalesced:  %llu\n", (unsigned long long) stats->coalesced);
+    fprintf(out, "├── deferred:   %llu\n", (unsigned long long) stats->deferred);
+    fprintf(out, "├── dropped:    %llu\n", (unsigned long long) stats->dropped);
+    struct hostpoll_estimate est;
+    int polled = hostpoll_estimate(poll, &est);
+    fprintf(out, "%s duplicates: %llu\n", polled ? "├──" : "└──", (unsigned long long) stats->duplicates);
+    if (polled) {
+        fprintf(out, "└── host poll:  %.3fms ±%.3fms (%d intervals, %d missed)\n", est.interval / 1e6,
+                est.jitter / 1e6, est.samples, est.missed);
+    }
+    fflush(out);
+}
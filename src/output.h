@@ -0,0 +1,137 @@
+#ifndef MIDI2HID_OUTPUT_H
+#define MIDI2HID_OUTPUT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "backend.h"
+#include "hostpoll.h"
+#include "report.h"
+
+/**
+ * USB full speed frame. The host polls an interrupt endpoint with bInterval 1 at most once per frame.
+ */
+#define OUTPUT_FRAME_NS 1000000ULL
+
+/**
+ * Reports that can wait for the HID device before the oldest is dropped.
+ */
+#define OUTPUT_QUEUE_LEN 16
+
+struct output_stats {
+    uint64_t written;
+
+    /**
+     * Reports replaced by a newer one within the same frame.
+     */
+    uint64_t coalesced;
+
+    /**
+     * Writes that returned EAGAIN and were retried once the device was writable.
+     */
+    uint64_t deferred;
+
+    /**
+     * Reports dropped because the queue was full.
+     */
+    uint64_t dropped;
+
+    /**
+     * Reports not written because they were identical to the last one.
+     */
+    uint64_t duplicates;
+};
+
+/**
+ * Output stage between the engine and the non-blocking HID device. It writes at most one report per frame
+ * and merges all changes within a frame into the next report, unless that would hide a key press or release from
+ * the host.
+ * Reports that can't be merged or written right away wait in a bounded queue.
+ */
+struct output {
+    struct backend *backend;
+    enum report_mode mode;
+    uint64_t frame;
+
+    /**
+     * Reports waiting to be written, oldest first. The newest report of each report ID is the pending report that
+     * newer changes to that report merge into.
+     */
+    uint8_t queue[OUTPUT_QUEUE_LEN][REPORT_MAX_LEN];
+    size_t queueLen[OUTPUT_QUEUE_LEN];
+    int head;
+    int count;
+
+    /**
+     * Last report written to the device, per report ID.
+     */
+    uint8_t last[REPORT_IDS + 1][REPORT_MAX_LEN];
+
+    /**
+     * Earliest time of the next write.
+     */
+    uint64_t nextWrite;
+
+    /**
+     * The last write returned EAGAIN, wait until the device is writable.
+     */
+    int blocked;
+
+    /**
+     * Poll interval of the host, from the reports that waited for the device.
+     */
+    struct hostpoll poll;
+
+    struct output_stats stats;
+};
+
+/**
+ * Initializes the output stage.
+ * @param o the output
+ * @param backend the backend the reports are written to
+ * @param mode report layout
+ * @param frame minimum time between two writes, 0 to write every report right away
+ */
+void output_init(struct output *o, struct backend *backend, enum report_mode mode, uint64_t frame);
+
+/**
+ * Submits a new report and writes it, if the current frame has no report yet.
+ * @param o the output
+ * @param data the report
+ * @param len length of the report
+ * @param now current time
+ * @return 0 on success, or -1 if the write failed
+ */
+int output_submit(struct output *o, const uint8_t *data, size_t len, uint64_t now);
+
+/**
+ * Writes the next waiting report, if its frame has come and the device is writable.
+ * Call it at output_next() and when the device becomes writable.
+ * @return 0 on success, or -1 if the write failed
+ */
+int output_flush(struct output *o, uint64_t now);
+
+/**
+ * Returns the time when output_flush() should be called next, or 0 if nothing is waiting for a frame.
+ */
+static inline uint64_t output_next(const struct output *o) {
+    return o->count && !o->blocked ? o->nextWrite : 0;
+}
+
+/**
+ * Checks if the output waits for the device to become writable (POLLOUT).
+ */
+static inline int output_blocked(const struct output *o) {
+    return o->count && o->blocked;
+}
+
+/**
+ * Prints the counters of the output, and the poll interval of the host once it is known.
+ */
+void output_dump_stats(const struct output *o, FILE *out);
+
+/**
+ * Prints counters and host poll intervals taken from an output stage, eg. the ones a writer thread published.
+ */
+void output_print_stats(const struct output_stats *stats, const struct hostpoll *poll, FILE *out);
+
+#endif //MIDI2HID_OUTPUT_H
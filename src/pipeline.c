@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "alloc.h"
+#include "pipeline.h"
+#include "release.h"
+#include "rt.h"
+
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+/**
+ * Longest time a stopping writer waits for the HID function, in 10ms steps.
+ */
+#define WRITER_STOP_TRIES 100
+
+/**
+ * Applies the scheduling of a stage to the calling thread. A failure is reported, the thread runs on anyway.
+ */
+static void enter(int priority, int cpu) {
+    if (priority > 0) {
+        rt_enter(priority, cpu);
+    } else if (cpu >= 0) {
+        rt_pin(cpu);
+    }
+}
+
+static void *source_run(void *arg) {
+    struct source *s = arg;
+    struct pollfd pfds[1 + SOURCE_MAX_PFDS];
+    struct midi_event ev;
+    enter(s->priority, s->cpu);
+    uint64_t allocs = alloc_count();
+    pfds[0].fd = s->ctlFd;
+    pfds[0].events = POLLIN;
+    int n = 1 + s->in->poll_descriptors(s->in, &pfds[1], SOURCE_MAX_PFDS);
+    int live = 0;
+    for (;;) {
+        if (poll(pfds, (nfds_t) n, -1) < 0 && errno != EINTR) {
+            perror("source");
+            break;
+        }
+        if (pfds[0].revents & POLLIN) {
+            uint64_t count;
+            if (read(s->ctlFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                perror("source");
+            }
+            if (LOAD(&s->stop)) {
+                return NULL;
+            }
+            if (__atomic_exchange_n(&s->filterPending, 0, __ATOMIC_ACQ_REL) && s->in->filter) {
+                s->in->filter(s->in, LOAD(&s->types));
+            }
+            if (!live && LOAD(&s->live)) {
+                live = 1;
+                if (s->in->drop) {
+                    s->in->drop(s->in);
+                }
+            }
+        }
+        int ret;
+        while ((ret = s->in->read(s->in, &ev)) > 0) {
+            if (!live) {
+                continue;
+            }
+            if (ev.device == 0) {
+                ev.device = s->device;
+            }
+            ring_push(&s->events, &ev);
+        }
+        __atomic_store_n(&s->allocs, alloc_count() - allocs, __ATOMIC_RELAXED);
+        ring_kick(&s->events);
+        if (ret < 0) {
+            break;
+        }
+    }
+    STORE(&s->failed, 1);
+    ring_wake(&s->events);
+    return NULL;
+}
+
+int source_start(struct source *s, struct input *in, uint8_t device, int priority, int cpu) {
+    memset(s, 0, sizeof(*s));
+    s->in = in;
+    s->device = device;
+    s->priority = priority;
+    s->cpu = cpu;
+    if (ring_init(&s->events, sizeof(struct midi_event), PIPELINE_RING_LEN)) {
+        return -1;
+    }
+    if ((s->ctlFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        perror("eventfd");
+        ring_free(&s->events);
+        return -1;
+    }
+    int err = pthread_create(&s->thread, NULL, source_run, s);
+    if (err) {
+        fprintf(stderr, "source: %s\n", strerror(err));
+        close(s->ctlFd);
+        ring_free(&s->events);
+        return -1;
+    }
+    return 0;
+}
+
+static void wake(int fd) {
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0) {
+        perror("eventfd");
+    }
+}
+
+void source_filter(struct source *s, unsigned types) {
+    STORE(&s->types, types);
+    STORE(&s->filterPending, 1);
+    wake(s->ctlFd);
+}
+
+void source_live(struct source *s) {
+    STORE(&s->live, 1);
+    wake(s->ctlFd);
+}
+
+void source_stop(struct source *s) {
+    STORE(&s->stop, 1);
+    wake(s->ctlFd);
+    pthread_join(s->thread, NULL);
+    s->in->close(s->in);
+    close(s->ctlFd);
+    ring_free(&s->events);
+}
+
+/**
+ * Publishes the counters and host poll intervals of the output stage. The intervals are only copied when there
+ * are new ones.
+ */
+static void publish(struct writer *w) {
+    const struct output_stats *stats = &w->out.stats;
+    __atomic_store_n(&w->stats.written, stats->written, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->stats.coalesced, stats->coalesced, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->stats.deferred, stats->deferred, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->stats.dropped, stats->dropped, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->stats.duplicates, stats->duplicates, __ATOMIC_RELAXED);
+    const struct hostpoll *poll = &w->out.poll;
+    if (poll->count == w->poll.count) {
+        return;
+    }
+    for (int i = 0; i < HOSTPOLL_SAMPLES; i++) {
+        __atomic_store_n(&w->poll.samples[i], poll->samples[i], __ATOMIC_RELAXED);
+    }
+    STORE(&w->poll.count, poll->count);
+}
+
+void writer_stats(const struct writer *w, struct output_stats *stats, struct hostpoll *poll) {
+    stats->written = __atomic_load_n(&w->stats.written, __ATOMIC_RELAXED);
+    stats->coalesced = __atomic_load_n(&w->stats.coalesced, __ATOMIC_RELAXED);
+    stats->deferred = __atomic_load_n(&w->stats.deferred, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&w->stats.dropped, __ATOMIC_RELAXED);
+    stats->duplicates = __atomic_load_n(&w->stats.duplicates, __ATOMIC_RELAXED);
+    hostpoll_init(poll);
+    poll->count = LOAD(&w->poll.count);
+    for (int i = 0; i < HOSTPOLL_SAMPLES; i++) {
+        poll->samples[i] = __atomic_load_n(&w->poll.samples[i], __ATOMIC_RELAXED);
+    }
+}
+
+static void *writer_run(void *arg) {
+    struct writer *w = arg;
+    struct backend *backend = w->out.backend;
+    struct writer_report r;
+    enter(w->priority, w->cpu);
+    uint64_t allocs = alloc_count();
+    struct pollfd pfds[2] = {{.fd = w->reports.fd, .events = POLLIN}, {.fd = backend->fd}};
+    int tries = 0;
+    for (;;) {
+        int stop = LOAD(&w->stop);
+        ring_clear(&w->reports);
+        uint64_t now = release_now();
+        int err = 0;
+        while (ring_pop(&w->reports, &r)) {
+            err |= output_submit(&w->out, r.data, r.len, now);
+        }
+        err |= output_flush(&w->out, now);
+        publish(w);
+        __atomic_store_n(&w->allocs, alloc_count() - allocs, __ATOMIC_RELAXED);
+        if (err) {
+            STORE(&w->failed, 1);
+            kill(getpid(), SIGTERM);
+            return NULL;
+        }
+        if (stop && (!w->out.count || ++tries > WRITER_STOP_TRIES)) {
+            return NULL;
+        }
+        // sleep until the next frame, the function is writable again, or the event loop has new reports
+        pfds[1].events = output_blocked(&w->out) ? POLLOUT : 0;
+        uint64_t next = output_next(&w->out);
+        struct timespec ts;
+        struct timespec *timeout = NULL;
+        if (stop) {
+            next = now + 10000000ULL;
+        }
+        if (next) {
+            uint64_t wait = next > now ? next - now : 0;
+            ts.tv_sec = (time_t) (wait / 1000000000ULL);
+            ts.tv_nsec = (long) (wait % 1000000000ULL);
+            timeout = &ts;
+        }
+        if (ppoll(pfds, 2, timeout, NULL) < 0 && errno != EINTR) {
+            perror("writer");
+        }
+    }
+}
+
+int writer_start(struct writer *w, struct backend *backend, enum report_mode mode, uint64_t frame,
+                 const struct hostpoll *poll, int priority, int cpu) {
+    memset(w, 0, sizeof(*w));
+    output_init(&w->out, backend, mode, frame);
+    if (poll) {
+        w->out.poll = *poll;
+        w->poll = *poll;
+    }
+    w->priority = priority;
+    w->cpu = cpu;
+    if (ring_init(&w->reports, sizeof(struct writer_report), PIPELINE_RING_LEN)) {
+        return -1;
+    }
+    int err = pthread_create(&w->thread, NULL, writer_run, w);
+    if (err) {
+        fprintf(stderr, "writer: %s\n", strerror(err));
+        ring_free(&w->reports);
+        return -1;
+    }
+    return 0;
+}
+
+void writer_stop(struct writer *w) {
+    ring_kick(&w->reports);
+    STORE(&w->stop, 1);
+    ring_wake(&w->reports);
+    pthread_join(w->thread, NULL);
+    ring_free(&w->reports);
+}
@@ -0,0 +1,198 @@
+#ifndef MIDI2HID_PIPELINE_H
+#define MIDI2HID_PIPELINE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "backend.h"
+#include "input.h"
+#include "midi.h"
+#include "output.h"
+#include "report.h"
+#include "ring.h"
+
+/**
+ * Pipeline mode: every MIDI source is read by an input thread, the event loop maps what the sources deliver, and
+ * every HID function is written by a writer thread. The stages are connected by SPSC rings, so a slow write to one
+ * HID function doesn't hold up the other kits.
+ */
+
+/**
+ * Capacity of the rings between the stages.
+ */
+#define PIPELINE_RING_LEN 1024
+
+/**
+ * Maximum number of poll descriptors of the input of a source.
+ */
+#define SOURCE_MAX_PFDS 8
+
+/**
+ * Input thread of a MIDI source.
+ */
+struct source {
+    struct input *in;
+
+    /**
+     * Device index stamped on the events of the input, which always delivers device 0 for its only device.
+     */
+    uint8_t device;
+
+    /**
+     * Events read from the input, consumed by the event loop.
+     */
+    struct ring events;
+
+    /**
+     * eventfd that wakes up the thread for a new filter or to stop.
+     */
+    int ctlFd;
+    unsigned types;
+    int filterPending;
+    int stop;
+
+    /**
+     * Set by source_live(). Until then the thread discards what it reads, so that nothing received before the
+     * outputs were ready reaches the ring.
+     */
+    int live;
+
+    /**
+     * The input failed, the source delivers no more events.
+     */
+    int failed;
+
+    /**
+     * Allocations of the thread since it started, see alloc_count().
+     */
+    uint64_t allocs;
+
+    int priority;
+    int cpu;
+    pthread_t thread;
+};
+
+/**
+ * Starts the input thread of a source. It delivers no events before source_live().
+ * @param s the source
+ * @param in the input, owned by the source from now on
+ * @param device device index of the events
+ * @param priority SCHED_FIFO priority or 0 to keep the normal scheduling
+ * @param cpu CPU to pin the thread to, or -1
+ * @return 0 on success
+ */
+int source_start(struct source *s, struct input *in, uint8_t device, int priority, int cpu);
+
+/**
+ * Restricts the events of the input to the given types (see input.filter). The input thread applies the filter,
+ * so the input is never used by two threads.
+ */
+void source_filter(struct source *s, unsigned types);
+
+/**
+ * Lets the events through: the input thread drops the events that are still pending in the input (see input.drop)
+ * and delivers the ones received from then on.
+ */
+void source_live(struct source *s);
+
+/**
+ * Drains the events the source delivered into the batch.
+ * @return the number of events, or -1 if the source failed and has nothing left. A full batch means that more
+ * events may be pending.
+ */
+static inline int source_drain(struct source *s, struct midi_batch *b) {
+    struct midi_event ev;
+    b->count = 0;
+    while (b->count < MIDI_BATCH_LEN && ring_pop(&s->events, &ev)) {
+        midi_batch_add(b, &ev);
+    }
+    return !b->count && __atomic_load_n(&s->failed, __ATOMIC_ACQUIRE) ? -1 : b->count;
+}
+
+/**
+ * Stops the input thread and closes the input.
+ */
+void source_stop(struct source *s);
+
+/**
+ * Report passed from the event loop to a writer.
+ */
+struct writer_report {
+    uint8_t len;
+    uint8_t data[REPORT_MAX_LEN];
+};
+
+/**
+ * Writer thread of a HID function. It owns the output stage of the function.
+ */
+struct writer {
+    struct output out;
+
+    /**
+     * Reports built by the event loop.
+     */
+    struct ring reports;
+
+    int stop;
+
+    /**
+     * Writing to the backend failed.
+     */
+    int failed;
+
+    /**
+     * Allocations of the thread since it started, see alloc_count().
+     */
+    uint64_t allocs;
+
+    int priority;
+    int cpu;
+    pthread_t thread;
+
+    /**
+     * Counters and host poll intervals of the output stage, published by the writer thread after every round.
+     * Other threads read them with writer_stats(), never the output stage itself.
+     */
+    struct output_stats stats;
+    struct hostpoll poll;
+};
+
+/**
+ * Starts the writer thread of a backend.
+ * @param w the writer
+ * @param backend the backend, stays owned by the caller
+ * @param mode report layout
+ * @param frame minimum time between two writes, see output_init()
+ * @param poll host poll intervals measured before the start, eg. by hostpoll_probe(), or NULL
+ * @param priority SCHED_FIFO priority or 0 to keep the normal scheduling
+ * @param cpu CPU to pin the thread to, or -1
+ * @return 0 on success. If a write fails later, the writer sends SIGTERM to the process, so that the event loop
+ * stops.
+ */
+int writer_start(struct writer *w, struct backend *backend, enum report_mode mode, uint64_t frame,
+                 const struct hostpoll *poll, int priority, int cpu);
+
+/**
+ * Takes a snapshot of what the writer thread published last.
+ * @param w the writer
+ * @param stats receives the counters of the output stage
+ * @param poll receives the host poll intervals
+ */
+void writer_stats(const struct writer *w, struct output_stats *stats, struct hostpoll *poll);
+
+/**
+ * Hands a report to the writer. The writer wakes up on the next ring_kick() of its reports.
+ * @return 0 on success, -1 if the ring is full
+ */
+static inline int writer_submit(struct writer *w, const uint8_t *data, size_t len) {
+    struct writer_report r;
+    r.len = (uint8_t) len;
+    memcpy(r.data, data, len);
+    return ring_push(&w->reports, &r);
+}
+
+/**
+ * Stops the writer once the reports it has are written, or after 1s at the latest.
+ */
+void writer_stop(struct writer *w);
+
+#endif //MIDI2HID_PIPELINE_H
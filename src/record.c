@@ -0,0 +1,75 @@
+#include <string.h>
+#include "record.h"
+
+int record_create(struct record *r, const char *path, uint64_t now) {
+    memset(r, 0, sizeof(*r));
+    if (!(r->file = fopen(path, "wb"))) {
+        perror(path);
+        return -1;
+    }
+    r->start = r->last = now;
+    fwrite(RECORD_MAGIC, 1, 4, r->file);
+    fputc(RECORD_VERSION, r->file);
+    return 0;
+}
+
+int record_write(struct record *r, const struct midi_event *ev, uint64_t now) {
+    uint64_t delta = now > r->last ? (now - r->last) / 1000 : 0;
+    if (delta > UINT32_MAX) {
+        delta = UINT32_MAX;
+    }
+    // only advance by what was written, so the rounding errors don't add up.
+    r->last += delta * 1000;
+    uint8_t buf[RECORD_EVENT_LEN] = {
+            (uint8_t) delta, (uint8_t) (delta >> 8), (uint8_t) (delta >> 16), (uint8_t) (delta >> 24),
+            ev->type, ev->channel, ev->note, ev->value
+    };
+    r->count++;
+    return fwrite(buf, 1, RECORD_EVENT_LEN, r->file) == RECORD_EVENT_LEN ? 0 : -1;
+}
+
+int record_open(struct record *r, const char *path) {
+    char magic[5];
+    memset(r, 0, sizeof(*r));
+    if (!(r->file = fopen(path, "rb"))) {
+        perror(path);
+        return -1;
+    }
+    if (fread(magic, 1, 5, r->file) != 5 || memcmp(magic, RECORD_MAGIC, 4) != 0 || magic[4] != RECORD_VERSION) {
+        fprintf(stderr, "%s: not a midi2hid recording\n", path);
+        fclose(r->file);
+        r->file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int record_read(struct record *r, struct midi_event *ev, uint64_t *time) {
+    uint8_t buf[RECORD_EVENT_LEN];
+    size_t n = fread(buf, 1, RECORD_EVENT_LEN, r->file);
+    if (n == 0 && feof(r->file)) {
+        return 0;
+    }
+    if (n != RECORD_EVENT_LEN) {
+        fprintf(stderr, "truncated recording after %llu events\n", (unsigned long long) r->count);
+        return -1;
+    }
+    uint64_t delta = buf[0] | (uint32_t) buf[1] << 8 | (uint32_t) buf[2] << 16 | (uint32_t) buf[3] << 24;
+    r->last += delta * 1000;
+    *time = r->last;
+    ev->type = buf[4];
+    ev->channel = buf[5];
+    ev->note = buf[6];
+    ev->value = buf[7];
+    ev->device = 0;
+    ev->stamp = 0;
+    r->count++;
+    return 1;
+}
+
+void record_close(struct record *r) {
+    if (r->file) {
+        fclose(r->file);
+        r->file = NULL;
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef MIDI2HID_RECORD_H
+#define MIDI2HID_RECORD_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "midi.h"
+
+/**
+ * Magic at the start of a session recording, followed by a format version byte.
+ */
+#define RECORD_MAGIC "M2HR"
+#define RECORD_VERSION 1
+
+/**
+ * Size of an event record: delta time in microseconds (32 bit little endian), type, channel, note and value.
+ */
+#define RECORD_EVENT_LEN 8
+
+/**
+ * Session recording, written or read sequentially.
+ */
+struct record {
+    FILE *file;
+
+    /**
+     * Time of the previous event in nanoseconds.
+     */
+    uint64_t last;
+
+    /**
+     * Time of the first event. Replayed times are relative to it.
+     */
+    uint64_t start;
+
+    /**
+     * Number of events written or read.
+     */
+    uint64_t count;
+};
+
+/**
+ * Creates a new recording.
+ * @param r the recording
+ * @param path file to write
+ * @param now start time of the session
+ * @return 0 on success
+ */
+int record_create(struct record *r, const char *path, uint64_t now);
+
+/**
+ * Appends an event.
+ * @param r the recording
+ * @param ev the event
+ * @param now time the event was read
+ * @return 0 on success
+ */
+int record_write(struct record *r, const struct midi_event *ev, uint64_t now);
+
+/**
+ * Opens a recording for replay.
+ * @return 0 on success
+ */
+int record_open(struct record *r, const char *path);
+
+/**
+ * Reads the next event.
+ * @param r the recording
+ * @param ev receives the event
+ * @param time receives the time of the event, relative to the session start
+ * @return 1 if an event was read, 0 at the end of the recording, -1 on error.
+ */
+int record_read(struct record *r, struct midi_event *ev, uint64_t *time);
+
+/**
+ * Flushes and closes the recording.
+ */
+void record_close(struct record *r);
+
+#endif //MIDI2HID_RECORD_H
@@ -0,0 +1,100 @@
+#include <string.h>
+#include <time.h>
+#include "release.h"
+
+#define SLOT(tick) ((tick) & (RELEASE_WHEEL_SLOTS - 1))
+
+uint64_t release_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+void release_init(struct release_wheel *w, uint64_t now) {
+    memset(w, 0, sizeof(*w));
+    memset(w->head, 0xff, sizeof(w->head));
+    w->cursor = now / RELEASE_TICK_NS;
+}
+
+static void unlink_key(struct release_wheel *w, uint8_t key) {
+    int16_t n = w->next[key];
+    int16_t p = w->prev[key];
+    if (p < 0) {
+        w->head[SLOT(w->deadline[key])] = n;
+    } else {
+        w->next[p] = n;
+    }
+    if (n >= 0) {
+        w->prev[n] = p;
+    }
+    w->deadline[key] = 0;
+    w->count--;
+}
+
+void release_schedule(struct release_wheel *w, uint8_t key, uint64_t deadline) {
+    if (w->deadline[key]) {
+        unlink_key(w, key);
+    }
+    // round up, so that a key is never released before its deadline. also never schedule into
+    // a tick that was already processed, otherwise the key would wait for a full revolution.
+    uint64_t tick = (deadline + RELEASE_TICK_NS - 1) / RELEASE_TICK_NS;
+    if (tick <= w->cursor) {
+        tick = w->cursor + 1;
+    }
+    int16_t *head = &w->head[SLOT(tick)];
+    w->deadline[key] = tick;
+    w->prev[key] = -1;
+    w->next[key] = *head;
+    if (*head >= 0) {
+        w->prev[*head] = key;
+    }
+    *head = key;
+    w->count++;
+}
+
+void release_cancel(struct release_wheel *w, uint8_t key) {
+    if (w->deadline[key]) {
+        unlink_key(w, key);
+    }
+}
+
+int release_expire(struct release_wheel *w, uint64_t now, uint8_t *keys, int max) {
+    uint64_t tick = now / RELEASE_TICK_NS;
+    int n = 0;
+    if (tick <= w->cursor) {
+        return 0;
+    }
+    // after a long sleep, visiting every slot once is enough.
+    uint64_t from = w->cursor + 1;
+    if (tick - w->cursor > RELEASE_WHEEL_SLOTS) {
+        from = tick - RELEASE_WHEEL_SLOTS + 1;
+    }
+    for (uint64_t t = from; t <= tick && w->count > 0; t++) {
+        int16_t key = w->head[SLOT(t)];
+        while (key >= 0 && n < max) {
+            int16_t next = w->next[key];
+            if (w->deadline[key] <= tick) {
+                unlink_key(w, (uint8_t) key);
+                keys[n++] = (uint8_t) key;
+            }
+            key = next;
+        }
+    }
+    // only advance the cursor when everything due was collected.
+    if (n < max) {
+        w->cursor = tick;
+    }
+    return n;
+}
+
+uint64_t release_next(const struct release_wheel *w) {
+    if (w->count == 0) {
+        return 0;
+    }
+    for (uint64_t t = w->cursor + 1; t <= w->cursor + RELEASE_WHEEL_SLOTS; t++) {
+        if (w->head[SLOT(t)] >= 0) {
+            return t * RELEASE_TICK_NS;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+#ifndef MIDI2HID_RELEASE_H
+#define MIDI2HID_RELEASE_H
+
+#include <stdint.h>
+
+/**
+ * Number of slots in the release wheel. Each slot covers one tick, so the wheel spans 256ms.
+ * Deadlines further away simply stay in their slot for more than one revolution.
+ */
+#define RELEASE_WHEEL_SLOTS 256
+
+/**
+ * Resolution of the release wheel in nanoseconds (1ms).
+ */
+#define RELEASE_TICK_NS 1000000ULL
+
+/**
+ * Number of keys that can be scheduled. Indexed by the HID key code.
+ */
+#define RELEASE_KEYS 256
+
+/**
+ * Timer wheel that tracks the release deadline of every pressed HID key.
+ * All times are absolute CLOCK_MONOTONIC nanoseconds.
+ */
+struct release_wheel {
+    /**
+     * First key in each slot or -1.
+     */
+    int16_t head[RELEASE_WHEEL_SLOTS];
+
+    /**
+     * Doubly linked slot lists, indexed by key.
+     */
+    int16_t next[RELEASE_KEYS];
+    int16_t prev[RELEASE_KEYS];
+
+    /**
+     * Deadline of each key in ticks, or 0 if the key is not scheduled.
+     */
+    uint64_t deadline[RELEASE_KEYS];
+
+    /**
+     * Last tick that was processed by release_expire().
+     */
+    uint64_t cursor;
+
+    /**
+     * Number of scheduled keys.
+     */
+    int count;
+};
+
+/**
+ * Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t release_now(void);
+
+/**
+ * Initializes an empty wheel.
+ * @param w the wheel
+ * @param now current time
+ */
+void release_init(struct release_wheel *w, uint64_t now);
+
+/**
+ * Schedules (or re-schedules) the release of the given key.
+ * @param w the wheel
+ * @param key HID key
+ * @param deadline absolute release time
+ */
+void release_schedule(struct release_wheel *w, uint8_t key, uint64_t deadline);
+
+/**
+ * Removes the given key from the wheel, if it is scheduled.
+ * @param w the wheel
+ * @param key HID key
+ */
+void release_cancel(struct release_wheel *w, uint8_t key);
+
+/**
+ * Collects all keys that are due at the given time and removes them from the wheel.
+ * @param w the wheel
+ * @param now current time
+ * @param keys receives the due keys
+ * @param max capacity of {@code keys}
+ * @return the number of due keys
+ */
+int release_expire(struct release_wheel *w, uint64_t now, uint8_t *keys, int max);
+
+/**
+ * Returns the time of the next tick that has keys in its slot, or 0 if the wheel is empty.
+ * The result can be used to arm a one-shot timer.
+ * @param w the wheel
+ */
+uint64_t release_next(const struct release_wheel *w);
+
+#endif //MIDI2HID_RELEASE_H
@@ -0,0 +1,201 @@
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include "reload.h"
+
+/**
+ * Serializes the profile parser, which isn't reentrant: the loader thread may recompile a profile while the
+ * main thread still compiles the initial profile of the next device.
+ */
+static pthread_mutex_t parser = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Compiles the profile into the given buffer.
+ */
+static int load(const struct reload *r, struct keymap *km) {
+    pthread_mutex_lock(&parser);
+    int ret = r->path ? keymap_load(km, r->path) : keymap_load_default(km);
+    pthread_mutex_unlock(&parser);
+    return ret;
+}
+
+/**
+ * The loader thread and the profiles it serves.
+ */
+static struct {
+    pthread_mutex_t lock;
+    struct reload *profiles[RELOAD_MAX_PROFILES];
+    int count;
+    int signalFd;
+    int inotifyFd;
+    int started;
+    pthread_t thread;
+} loader = {.lock = PTHREAD_MUTEX_INITIALIZER, .signalFd = -1, .inotifyFd = -1};
+
+/**
+ * Checks if the inotify events in the buffer refer to the profile file.
+ */
+static int profile_changed(const struct reload *r, const char *buf, ssize_t len) {
+    char tmp[PATH_MAX];
+    strncpy(tmp, r->path, sizeof(tmp) - 1);
+    tmp[sizeof(tmp) - 1] = 0;
+    const char *name = basename(tmp);
+    int changed = 0;
+    for (const char *p = buf; p < buf + len;) {
+        const struct inotify_event *ev = (const struct inotify_event *) p;
+        if (ev->wd == r->watch && ev->len && strcmp(ev->name, name) == 0) {
+            changed = 1;
+        }
+        p += sizeof(struct inotify_event) + ev->len;
+    }
+    return changed;
+}
+
+/**
+ * Recompiles the profile into the spare buffer and hands it to the event loop.
+ */
+static void reload(struct reload *r) {
+    // the spare buffer is ours until we signal the event loop.
+    if (load(r, r->spare)) {
+        fprintf(stderr, "keeping current profile\n");
+        return;
+    }
+    uint64_t val = 1;
+    if (write(r->readyFd, &val, sizeof(val)) != sizeof(val)) {
+        perror("reload");
+        return;
+    }
+    // wait until the event loop swapped the buffers before touching the spare buffer again.
+    while (read(r->ackFd, &val, sizeof(val)) < 0 && errno == EINTR) {
+    }
+}
+
+static void *reload_thread(void *arg) {
+    (void) arg;
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfds[2] = {
+            {.fd = loader.signalFd, .events = POLLIN},
+            {.fd = loader.inotifyFd, .events = POLLIN},
+    };
+
+    while (1) {
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("reload");
+            return NULL;
+        }
+        int all = 0;
+        ssize_t len = 0;
+        if (pfds[0].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            if (read(loader.signalFd, &si, sizeof(si)) == sizeof(si)) {
+                printf("SIGHUP received, reloading profiles\n");
+                all = 1;
+            }
+        }
+        if (pfds[1].revents & POLLIN) {
+            len = read(loader.inotifyFd, buf, sizeof(buf));
+        }
+        pthread_mutex_lock(&loader.lock);
+        int count = loader.count;
+        pthread_mutex_unlock(&loader.lock);
+        for (int i = 0; i < count; i++) {
+            struct reload *r = loader.profiles[i];
+            if (r->path && len > 0 && profile_changed(r, buf, len)) {
+                printf("%s changed, reloading profile\n", r->path);
+            } else if (!all) {
+                continue;
+            }
+            reload(r);
+        }
+    }
+}
+
+/**
+ * Adds the profile to the loader, starting the loader with the first one. Called with the loader lock held.
+ */
+static int add_profile(struct reload *r) {
+    if (loader.count == RELOAD_MAX_PROFILES) {
+        fprintf(stderr, "reload: too many profiles\n");
+        return -1;
+    }
+    if (loader.signalFd < 0) {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGHUP);
+        if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0 || (loader.signalFd = signalfd(-1, &mask, SFD_CLOEXEC)) < 0) {
+            perror("signalfd");
+            return -1;
+        }
+        if ((loader.inotifyFd = inotify_init1(IN_CLOEXEC)) < 0) {
+            perror("inotify");
+            return -1;
+        }
+    }
+    if (r->path) {
+        // watch the directory, since editors usually replace the file instead of writing it.
+        // profiles in the same directory share the watch.
+        char tmp[PATH_MAX];
+        strncpy(tmp, r->path, sizeof(tmp) - 1);
+        tmp[sizeof(tmp) - 1] = 0;
+        if ((r->watch = inotify_add_watch(loader.inotifyFd, dirname(tmp), IN_CLOSE_WRITE | IN_MOVED_TO)) < 0) {
+            perror("inotify");
+            return -1;
+        }
+    }
+    loader.profiles[loader.count++] = r;
+    if (!loader.started) {
+        if (pthread_create(&loader.thread, NULL, reload_thread, NULL) != 0) {
+            perror("pthread_create");
+            loader.count--;
+            return -1;
+        }
+        loader.started = 1;
+    }
+    return 0;
+}
+
+int reload_start(struct reload *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+    r->path = path;
+    r->active = &r->maps[0];
+    r->spare = &r->maps[1];
+    r->watch = -1;
+    if (load(r, r->active)) {
+        return -1;
+    }
+    if ((r->readyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 || (r->ackFd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        perror("eventfd");
+        return -1;
+    }
+    pthread_mutex_lock(&loader.lock);
+    int ret = add_profile(r);
+    pthread_mutex_unlock(&loader.lock);
+    return ret;
+}
+
+const struct keymap *reload_swap(struct reload *r) {
+    uint64_t val;
+    if (read(r->readyFd, &val, sizeof(val)) != sizeof(val)) {
+        return NULL;
+    }
+    struct keymap *km = r->spare;
+    r->spare = r->active;
+    r->active = km;
+    val = 1;
+    if (write(r->ackFd, &val, sizeof(val)) != sizeof(val)) {
+        perror("reload");
+    }
+    return km;
+}
@@ -0,0 +1,68 @@
+#ifndef MIDI2HID_RELOAD_H
+#define MIDI2HID_RELOAD_H
+
+#include "keymap.h"
+
+/**
+ * Maximum number of profiles served by the loader thread.
+ */
+#define RELOAD_MAX_PROFILES 8
+
+/**
+ * Double buffered mapping profile. A loader thread recompiles the profile into the spare buffer
+ * whenever SIGHUP is received or the profile file changes, and the event loop swaps the buffers
+ * between two events. One loader thread serves all profiles. The profile parser isn't reentrant, so every
+ * compile, the initial ones on the calling thread included, holds the parser lock.
+ */
+struct reload {
+    /**
+     * Profile file or NULL for the built-in profile.
+     */
+    const char *path;
+
+    struct keymap maps[2];
+
+    /**
+     * Profile used by the event loop.
+     */
+    struct keymap *active;
+
+    /**
+     * Buffer owned by the loader thread until it signals {@code readyFd}.
+     */
+    struct keymap *spare;
+
+    /**
+     * eventfd that becomes readable when the spare buffer holds a new profile.
+     */
+    int readyFd;
+
+    /**
+     * eventfd the event loop signals after the swap, handing the spare buffer back to the loader.
+     */
+    int ackFd;
+
+    /**
+     * inotify watch of the profile's directory, or -1.
+     */
+    int watch;
+};
+
+/**
+ * Compiles the initial profile and registers it with the loader thread, which is started with the first
+ * profile. SIGHUP is blocked in the calling thread, so the first call must happen before any other thread
+ * is created.
+ * @param r the reload state
+ * @param path profile file or NULL for the built-in profile
+ * @return 0 on success, -1 on error
+ */
+int reload_start(struct reload *r, const char *path);
+
+/**
+ * Swaps in the new profile. Must be called from the event loop once {@code readyFd} is readable.
+ * @param r the reload state
+ * @return the new active profile, or NULL if there was nothing to swap.
+ */
+const struct keymap *reload_swap(struct reload *r);
+
+#endif //MIDI2HID_RELOAD_H
@@ -0,0 +1,227 @@
+/*
+ * Replays a session recorded with `midi2hid -r` through the same engine the daemon uses and writes the
+ * reports to a file or pipe instead of /dev/hidg0. Needs neither MIDI nor gadget hardware.
+ *
+ *   midi2hid_replay [-v] [-n|-g] [-R] [-q repeats] [-m profile] [-l log] recording output
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "engine.h"
+#include "keymap.h"
+#include "log.h"
+#include "record.h"
+
+/**
+ * Virtual time of the session start. Anything above 0 works, the release wheel only needs a non zero tick.
+ */
+#define REPLAY_BASE 1000000000ULL
+
+struct replay {
+    /**
+     * Receives the raw reports, exactly as they would be written to the HID device.
+     */
+    FILE *out;
+
+    /**
+     * Optional text log: session time in microseconds and the report bytes, one report per line.
+     */
+    FILE *log;
+
+    /**
+     * Pace the replay with the recorded timing.
+     */
+    int realtime;
+
+    /**
+     * CLOCK_MONOTONIC time the replay started.
+     */
+    uint64_t wallStart;
+
+    /**
+     * Current virtual time.
+     */
+    uint64_t now;
+
+    uint64_t reports;
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static int write_report(void *ctx, const uint8_t *data, size_t len) {
+    struct replay *r = ctx;
+    r->reports++;
+    if (fwrite(data, 1, len, r->out) != len) {
+        perror("output");
+        return 5;
+    }
+    if (r->log) {
+        fprintf(r->log, "%10llu", (unsigned long long) (r->now - REPLAY_BASE) / 1000);
+        for (size_t i = 0; i < len; i++) {
+            fprintf(r->log, " %02x", data[i]);
+        }
+        fprintf(r->log, "\n");
+    }
+    return 0;
+}
+
+/**
+ * Advances the virtual clock, sleeping until then in real-time mode.
+ */
+static void pace(struct replay *r, uint64_t t) {
+    r->now = t;
+    if (r->realtime) {
+        // flush, so that a reader on the other end of a pipe sees the reports on time.
+        fflush(r->out);
+        uint64_t wall = r->wallStart + (t - REPLAY_BASE);
+        struct timespec ts = {.tv_sec = (time_t) (wall / 1000000000ULL), .tv_nsec = (long) (wall % 1000000000ULL)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+        }
+    }
+}
+
+/**
+ * Releases every key that is due until the given time, each at its own deadline.
+ */
+static int advance(struct engine *e, struct replay *r, uint64_t until) {
+    uint64_t next;
+    while ((next = engine_next(e)) != 0 && next <= until) {
+        pace(r, next);
+        if (engine_expire(e, next)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int printUsage(char *bin) {
+    fprintf(stderr, "Usage: %s [-v] [-n|-g] [-R] [-q repeats] [-m profile] [-l log] recording output\n", bin);
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    static struct keymap keymap;
+    struct replay r;
+    struct record rec;
+    struct engine engine;
+    char *profile = NULL;
+    char *logFile = NULL;
+    enum report_mode mode = REPORT_BOOT;
+    int verbose = 0;
+    int repeats = ENGINE_MAX_REPEATS;
+    int opt;
+
+    memset(&r, 0, sizeof(r));
+    while ((opt = getopt(argc, argv, "vngRq:m:l:")) != -1) {
+        switch (opt) {
+            case 'v':
+                verbose = 1;
+                break;
+            case 'n':
+                mode = REPORT_NKRO;
+                break;
+            case 'g':
+                mode = REPORT_COMPOSITE;
+                break;
+            case 'R':
+                r.realtime = 1;
+                break;
+            case 'q':
+                repeats = atoi(optarg);
+                break;
+            case 'm':
+                profile = optarg;
+                break;
+            case 'l':
+                logFile = optarg;
+                break;
+            default:
+                return printUsage(argv[0]);
+        }
+    }
+    if (optind + 2 > argc) {
+        return printUsage(argv[0]);
+    }
+    if (profile ? keymap_load(&keymap, profile) : keymap_load_default(&keymap)) {
+        return 4;
+    }
+    if (record_open(&rec, argv[optind])) {
+        return 2;
+    }
+    if (!(r.out = fopen(argv[optind + 1], "wb"))) {
+        perror(argv[optind + 1]);
+        return 3;
+    }
+    if (logFile && !(r.log = fopen(logFile, "w"))) {
+        perror(logFile);
+        return 3;
+    }
+
+    engine_init(&engine, mode, &keymap, write_report, &r, REPLAY_BASE);
+    engine.maxRepeats = (uint8_t) repeats;
+    // no formatter thread: the log is drained after every event, so nothing is lost at full speed.
+    struct log log;
+    if (verbose) {
+        if (log_init(&log, stdout, LOG_CAPACITY, REPLAY_BASE)) {
+            return 1;
+        }
+        engine.log = &log;
+    }
+    r.wallStart = monotonic_ns();
+    r.now = REPLAY_BASE;
+
+    struct midi_event ev;
+    uint64_t t;
+    int ret;
+    double t0 = monotonic_ns() / 1e9;
+    while ((ret = record_read(&rec, &ev, &t)) > 0) {
+        uint64_t now = REPLAY_BASE + t;
+        if (advance(&engine, &r, now)) {
+            return 5;
+        }
+        pace(&r, now);
+        if (engine_event(&engine, &ev, now)) {
+            return 5;
+        }
+        if (engine.log) {
+            log_drain(engine.log);
+        }
+    }
+    // let the last keys go
+    if (advance(&engine, &r, UINT64_MAX)) {
+        return 5;
+    }
+    double elapsed = monotonic_ns() / 1e9 - t0;
+    if (engine.log) {
+        log_close(engine.log);
+    }
+
+    fprintf(stderr, "replayed %llu events, %llu reports, session %.3fs, replay %.3fs\n",
+            (unsigned long long) rec.count, (unsigned long long) r.reports,
+            (r.now - REPLAY_BASE) / 1e9, elapsed);
+    fprintf(stderr, "%llu hits, %llu repeats, %llu lost\n", (unsigned long long) engine.stats.hits,
+            (unsigned long long) engine.stats.repeats,
+            (unsigned long long) (engine.stats.droppedPressed + engine.stats.droppedFull));
+    if (keymap.numCrosstalk) {
+        fprintf(stderr, "%llu ghost notes dropped, %llu kept above the noise floor\n",
+                (unsigned long long) engine.stats.crosstalk, (unsigned long long) engine.stats.aboveFloor);
+        for (int n = 0; n < KEYMAP_NOTES; n++) {
+            if (engine.floors[n].count) {
+                fprintf(stderr, "  pad %02x: %u crosstalk candidates, noise floor %d\n", n, engine.floors[n].count,
+                        engine_floor(&engine, (uint8_t) n));
+            }
+        }
+    }
+    record_close(&rec);
+    fclose(r.out);
+    if (r.log) {
+        fclose(r.log);
+    }
+    return ret < 0 ? 1 : 0;
+}
@@ -0,0 +1,395 @@
+#include <string.h>
+#include "hid.h"
+#include "report.h"
+
+/**
+ * Fields shared by the keyboard layouts. The modifiers are the first field and the keys the last.
+ */
+#define FIELD_MODIFIERS {.main = HID_INPUT, .flags = HID_DATA | HID_VARIABLE, .page = HID_PAGE_KEYBOARD, \
+        .usageMin = 0xe0, .usageMax = 0xe7, .logicalMin = 0, .logicalMax = 1, .size = 1, .count = 8}
+#define FIELD_LEDS {.main = HID_OUTPUT, .flags = HID_DATA | HID_VARIABLE, .page = HID_PAGE_LED, \
+        .usageMin = 0x01, .usageMax = 0x05, .logicalMin = 0, .logicalMax = 1, .size = 1, .count = 5}
+#define FIELD_LED_PADDING {.main = HID_OUTPUT, .flags = HID_CONSTANT | HID_VARIABLE, .size = 3, .count = 1}
+
+static const struct hid_field boot_fields[] = {
+        FIELD_MODIFIERS,
+        {.main = HID_INPUT, .flags = HID_CONSTANT | HID_VARIABLE, .size = 8, .count = 1},
+        FIELD_LEDS,
+        FIELD_LED_PADDING,
+        {.main = HID_INPUT, .flags = HID_DATA | HID_ARRAY, .page = HID_PAGE_KEYBOARD,
+                .usageMin = 0x00, .usageMax = 0x65, .logicalMin = 0, .logicalMax = 0x65, .size = 8, .count = BOOT_KEYS},
+};
+
+static const struct hid_field nkro_fields[] = {
+        FIELD_MODIFIERS,
+        FIELD_LEDS,
+        FIELD_LED_PADDING,
+        {.main = HID_INPUT, .flags = HID_DATA | HID_VARIABLE, .page = HID_PAGE_KEYBOARD,
+                .usageMin = 0x00, .usageMax = NKRO_KEYS - 1, .logicalMin = 0, .logicalMax = 1, .size = 1,
+                .count = NKRO_KEYS},
+};
+
+/**
+ * Consumer controls of the key IDs REPORT_KEY_CONSUMER and up, in the order of their names in the profile.
+ */
+static const uint16_t consumer_usages[] = {
+        0xe2,   // Mute
+        0xe9,   // Volume Increment
+        0xea,   // Volume Decrement
+        0xcd,   // Play/Pause
+        0xb7,   // Stop
+        0xb5,   // Scan Next Track
+        0xb6,   // Scan Previous Track
+        0xb8,   // Eject
+        0xb3,   // Fast Forward
+        0xb4,   // Rewind
+        0xb2,   // Record
+        0x223,  // AC Home
+        0x224,  // AC Back
+        0x225,  // AC Forward
+        0x192,  // AL Calculator
+        0x194,  // AL Local Machine Browser
+};
+
+#define CONSUMER_MAX_USAGE 0x3ff
+
+static const struct hid_field consumer_fields[] = {
+        {.main = HID_INPUT, .flags = HID_DATA | HID_ARRAY, .page = HID_PAGE_CONSUMER,
+                .usageMin = 0, .usageMax = CONSUMER_MAX_USAGE, .logicalMin = 0, .logicalMax = CONSUMER_MAX_USAGE,
+                .size = 16, .count = CONSUMER_KEYS},
+};
+
+/**
+ * Gamepad like the joystick of test_gadget, but with absolute axes that take the velocity (0-127) of the hit.
+ */
+static const struct hid_field gamepad_fields[] = {
+        {.main = HID_INPUT, .flags = HID_DATA | HID_VARIABLE, .page = HID_PAGE_BUTTON,
+                .usageMin = 1, .usageMax = GAMEPAD_BUTTONS, .logicalMin = 0, .logicalMax = 1, .size = 1,
+                .count = GAMEPAD_BUTTONS},
+        {.main = HID_INPUT, .flags = HID_DATA | HID_VARIABLE, .page = HID_PAGE_DESKTOP,
+                .usages = {0x30, 0x31, 0x32, 0x35}, .logicalMin = 0, .logicalMax = 127, .size = 8,
+                .count = GAMEPAD_AXES},
+};
+
+#define COUNT(a) ((int) (sizeof(a) / sizeof((a)[0])))
+
+static const struct hid_report_def boot_def[] = {
+        {.id = 0, .page = HID_PAGE_DESKTOP, .usage = 0x06, .fields = boot_fields, .count = COUNT(boot_fields)},
+};
+
+static const struct hid_report_def nkro_def[] = {
+        {.id = 0, .page = HID_PAGE_DESKTOP, .usage = 0x06, .fields = nkro_fields, .count = COUNT(nkro_fields)},
+};
+
+/**
+ * The reports of the composite layout, in the order of their IDs.
+ */
+static const struct hid_report_def composite_def[] = {
+        {.id = REPORT_ID_KEYBOARD, .page = HID_PAGE_DESKTOP, .usage = 0x06,
+                .fields = nkro_fields, .count = COUNT(nkro_fields)},
+        {.id = REPORT_ID_CONSUMER, .page = HID_PAGE_CONSUMER, .usage = 0x01,
+                .fields = consumer_fields, .count = COUNT(consumer_fields)},
+        {.id = REPORT_ID_GAMEPAD, .page = HID_PAGE_DESKTOP, .usage = 0x05,
+                .fields = gamepad_fields, .count = COUNT(gamepad_fields)},
+};
+
+static const struct hid_report_def *layout(enum report_mode mode, int *count) {
+    switch (mode) {
+        case REPORT_NKRO:
+            *count = COUNT(nkro_def);
+            return nkro_def;
+        case REPORT_COMPOSITE:
+            *count = COUNT(composite_def);
+            return composite_def;
+        default:
+            *count = COUNT(boot_def);
+            return boot_def;
+    }
+}
+
+/**
+ * Returns the byte offset of a field of the report.
+ */
+static uint8_t field_at(const struct hid_report_def *def, int field) {
+    return (uint8_t) (hid_field_offset(def, field, HID_INPUT) / 8);
+}
+
+#define GAMEPAD_BUTTONS_AT field_at(&composite_def[REPORT_ID_GAMEPAD - 1], 0)
+#define GAMEPAD_AXES_AT field_at(&composite_def[REPORT_ID_GAMEPAD - 1], 1)
+
+/**
+ * Report a key ID belongs to.
+ */
+enum target {
+    TARGET_KEYBOARD = 0,
+    TARGET_BUTTON,
+    TARGET_AXIS,
+    TARGET_CONSUMER,
+    TARGET_NONE
+};
+
+static enum target target(uint8_t key) {
+    if (key < REPORT_KEY_BUTTON || key >= REPORT_KEY_CONSUMER + REPORT_CONSUMER_USAGES) {
+        return TARGET_KEYBOARD;
+    }
+    if (key < REPORT_KEY_BUTTON + GAMEPAD_BUTTONS) {
+        return TARGET_BUTTON;
+    }
+    if (report_is_axis(key)) {
+        return TARGET_AXIS;
+    }
+    if (report_consumer_usage(key)) {
+        return TARGET_CONSUMER;
+    }
+    return TARGET_NONE;
+}
+
+void report_init(struct report *r, enum report_mode mode) {
+    memset(r, 0, sizeof(*r));
+    r->mode = mode;
+    int count;
+    const struct hid_report_def *def = layout(mode, &count);
+    r->len = hid_report_len(def, HID_INPUT);
+    r->modsAt = field_at(def, 0);
+    r->keysAt = field_at(def, def->count - 1);
+    if (mode == REPORT_COMPOSITE) {
+        r->data[0] = REPORT_ID_KEYBOARD;
+        r->consumer[0] = REPORT_ID_CONSUMER;
+        r->gamepad[0] = REPORT_ID_GAMEPAD;
+    }
+}
+
+uint16_t report_consumer_usage(uint8_t key) {
+    unsigned i = (unsigned) (key - REPORT_KEY_CONSUMER);
+    return key >= REPORT_KEY_CONSUMER && i < sizeof(consumer_usages) / sizeof(consumer_usages[0])
+           ? consumer_usages[i] : 0;
+}
+
+/**
+ * Recalculates the modifier byte of the report from the pressed keys.
+ */
+static void update_mods(struct report *r) {
+    uint8_t mods = 0;
+    for (int i = 0; i < 256; i++) {
+        if (r->down[i] && target((uint8_t) i) == TARGET_KEYBOARD) {
+            mods |= r->mods[i];
+        }
+    }
+    r->data[r->modsAt] = mods;
+}
+
+/**
+ * Sets or clears a key in the keyboard report.
+ * @return 0 if the report is full or cannot represent the key.
+ */
+static int set_keyboard(struct report *r, uint8_t key, int down) {
+    uint8_t *keys = r->data + r->keysAt;
+    if (r->mode != REPORT_BOOT) {
+        if (key >= NKRO_KEYS) {
+            return 0;
+        }
+        if (down) {
+            keys[key / 8] |= (uint8_t) (1 << (key % 8));
+        } else {
+            keys[key / 8] &= (uint8_t) ~(1 << (key % 8));
+        }
+        return 1;
+    }
+    if (!down) {
+        for (int i = 0; i < BOOT_KEYS; i++) {
+            if (keys[i] == key) {
+                keys[i] = 0;
+            }
+        }
+        return 1;
+    }
+    int i = 0;
+    while (i < BOOT_KEYS && keys[i]) {
+        i++;
+    }
+    if (i == BOOT_KEYS) {
+        return 0;
+    }
+    keys[i] = key;
+    return 1;
+}
+
+/**
+ * Sets or clears a consumer control in a free slot of the consumer report.
+ */
+static int set_consumer(struct report *r, uint16_t usage, int down) {
+    uint8_t *slots = r->consumer + 1;
+    for (int i = 0; i < CONSUMER_KEYS; i++) {
+        uint16_t slot = (uint16_t) (slots[2 * i] | slots[2 * i + 1] << 8);
+        if (down ? slot == 0 : slot == usage) {
+            slots[2 * i] = down ? (uint8_t) usage : 0;
+            slots[2 * i + 1] = down ? (uint8_t) (usage >> 8) : 0;
+            return 1;
+        }
+    }
+    return !down;
+}
+
+/**
+ * Updates the report that holds the key.
+ * @param value axis value or 0 to release the key
+ * @return 0 if the report is full or cannot represent the key.
+ */
+static int set_key(struct report *r, uint8_t key, int down, uint8_t value) {
+    enum target t = target(key);
+    if (t != TARGET_KEYBOARD && r->mode != REPORT_COMPOSITE) {
+        return 0;
+    }
+    switch (t) {
+        case TARGET_KEYBOARD:
+            if (!set_keyboard(r, key, down)) {
+                return 0;
+            }
+            r->changed |= (uint8_t) (1 << (r->mode == REPORT_COMPOSITE ? REPORT_ID_KEYBOARD : 0));
+            return 1;
+        case TARGET_BUTTON: {
+            unsigned b = key - REPORT_KEY_BUTTON;
+            if (down) {
+                r->gamepad[GAMEPAD_BUTTONS_AT + b / 8] |= (uint8_t) (1 << (b % 8));
+            } else {
+                r->gamepad[GAMEPAD_BUTTONS_AT + b / 8] &= (uint8_t) ~(1 << (b % 8));
+            }
+            break;
+        }
+        case TARGET_AXIS:
+            r->gamepad[GAMEPAD_AXES_AT + key - REPORT_KEY_AXIS] = down ? (uint8_t) (value & 0x7f) : 0;
+            break;
+        case TARGET_CONSUMER:
+            if (!set_consumer(r, report_consumer_usage(key), down)) {
+                return 0;
+            }
+            r->changed |= 1 << REPORT_ID_CONSUMER;
+            return 1;
+        default:
+            return 0;
+    }
+    r->changed |= 1 << REPORT_ID_GAMEPAD;
+    return 1;
+}
+
+int report_press(struct report *r, uint8_t key, uint8_t mods) {
+    if (r->down[key] || !key) {
+        return 0;
+    }
+    if (!set_key(r, key, 1, mods)) {
+        return 0;
+    }
+    r->down[key] = 1;
+    r->mods[key] = mods;
+    if (mods && target(key) == TARGET_KEYBOARD) {
+        r->data[r->modsAt] |= mods;
+    }
+    return 1;
+}
+
+int report_release(struct report *r, uint8_t key) {
+    if (!r->down[key]) {
+        return 0;
+    }
+    set_key(r, key, 0, 0);
+    r->down[key] = 0;
+    if (r->mods[key]) {
+        r->mods[key] = 0;
+        if (target(key) == TARGET_KEYBOARD) {
+            update_mods(r);
+        }
+    }
+    return 1;
+}
+
+const uint8_t *report_next(struct report *r, size_t *len) {
+    if (!r->changed) {
+        return NULL;
+    }
+    int id = __builtin_ctz(r->changed);
+    r->changed &= (uint8_t) ~(1 << id);
+    switch (id) {
+        case REPORT_ID_CONSUMER:
+            *len = CONSUMER_REPORT_LEN;
+            return r->consumer;
+        case REPORT_ID_GAMEPAD:
+            *len = GAMEPAD_REPORT_LEN;
+            return r->gamepad;
+        default:
+            *len = r->len;
+            return r->data;
+    }
+}
+
+static void set_bit(uint8_t keys[32], unsigned key) {
+    keys[key / 8] |= (uint8_t) (1 << (key % 8));
+}
+
+void report_keys(enum report_mode mode, const uint8_t *data, uint8_t keys[32]) {
+    memset(keys, 0, 32);
+    switch (report_id(mode, data)) {
+        case REPORT_ID_CONSUMER:
+            for (int i = 0; i < CONSUMER_KEYS; i++) {
+                uint16_t usage = (uint16_t) (data[1 + 2 * i] | data[2 + 2 * i] << 8);
+                for (unsigned k = 0; usage && k < sizeof(consumer_usages) / sizeof(consumer_usages[0]); k++) {
+                    if (consumer_usages[k] == usage) {
+                        set_bit(keys, REPORT_KEY_CONSUMER + k);
+                    }
+                }
+            }
+            return;
+        case REPORT_ID_GAMEPAD:
+            for (unsigned b = 0; b < GAMEPAD_BUTTONS; b++) {
+                if (data[GAMEPAD_BUTTONS_AT + b / 8] & (1 << (b % 8))) {
+                    set_bit(keys, REPORT_KEY_BUTTON + b);
+                }
+            }
+            for (unsigned a = 0; a < GAMEPAD_AXES; a++) {
+                if (data[GAMEPAD_AXES_AT + a]) {
+                    set_bit(keys, REPORT_KEY_AXIS + a);
+                }
+            }
+            return;
+        default:
+            break;
+    }
+    int count;
+    const struct hid_report_def *def = layout(mode, &count);
+    uint8_t modsAt = field_at(def, 0);
+    const uint8_t *k = data + field_at(def, def->count - 1);
+    if (mode == REPORT_BOOT) {
+        for (int i = 0; i < BOOT_KEYS; i++) {
+            set_bit(keys, k[i]);
+        }
+        // slot value 0 means empty
+        keys[0] &= 0xfe;
+    } else {
+        memcpy(keys, k, NKRO_KEYS / 8);
+    }
+    keys[0xe0 / 8] |= data[modsAt];
+}
+
+int report_axes(enum report_mode mode, const uint8_t *data, uint8_t axes[GAMEPAD_AXES]) {
+    if (report_id(mode, data) != REPORT_ID_GAMEPAD) {
+        return 0;
+    }
+    memcpy(axes, data + GAMEPAD_AXES_AT, GAMEPAD_AXES);
+    return 1;
+}
+
+size_t report_max_len(enum report_mode mode) {
+    int count;
+    const struct hid_report_def *def = layout(mode, &count);
+    size_t max = 0;
+    for (int i = 0; i < count; i++) {
+        size_t len = hid_report_len(&def[i], HID_INPUT);
+        max = len > max ? len : max;
+    }
+    return max;
+}
+
+size_t report_descriptor(enum report_mode mode, uint8_t *desc) {
+    int count;
+    const struct hid_report_def *def = layout(mode, &count);
+    return hid_descriptor(def, count, desc, REPORT_DESC_MAX_LEN);
+}
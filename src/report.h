@@ -0,0 +1,221 @@
+#ifndef MIDI2HID_REPORT_H
+#define MIDI2HID_REPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Number of key slots in the boot protocol keyboard report.
+ */
+#define BOOT_KEYS 6
+
+/**
+ * Length of the boot protocol keyboard report: modifiers, reserved byte and the key slots.
+ */
+#define BOOT_REPORT_LEN (2 + BOOT_KEYS)
+
+/**
+ * Number of keys in the NKRO bitmap. Covers the usages 0x00-0x7f of the keyboard page.
+ */
+#define NKRO_KEYS 128
+
+/**
+ * Length of the NKRO report: modifiers followed by the key bitmap.
+ */
+#define NKRO_REPORT_LEN (1 + NKRO_KEYS / 8)
+
+/**
+ * Report IDs of the composite layout.
+ */
+#define REPORT_ID_KEYBOARD 1
+#define REPORT_ID_CONSUMER 2
+#define REPORT_ID_GAMEPAD 3
+#define REPORT_IDS 3
+
+/**
+ * Consumer controls that can be pressed at the same time.
+ */
+#define CONSUMER_KEYS 2
+
+/**
+ * Length of the consumer control report: report ID and one 16 bit usage per slot.
+ */
+#define CONSUMER_REPORT_LEN (1 + 2 * CONSUMER_KEYS)
+
+#define GAMEPAD_BUTTONS 16
+#define GAMEPAD_AXES 4
+
+/**
+ * Length of the gamepad report: report ID, the button bits and one byte per axis.
+ */
+#define GAMEPAD_REPORT_LEN (1 + GAMEPAD_BUTTONS / 8 + GAMEPAD_AXES)
+
+/**
+ * The NKRO keyboard report with its report ID is the longest report.
+ */
+#define REPORT_MAX_LEN (1 + NKRO_REPORT_LEN)
+
+/**
+ * Key IDs above the keyboard usages that address the other reports of the composite layout:
+ * gamepad buttons 1-16, the axes X, Y, Z and Rz, and the consumer controls of report_consumer_usage().
+ * An axis is set to the velocity of the hit while it is pressed.
+ */
+#define REPORT_KEY_BUTTON 0x80
+#define REPORT_KEY_AXIS 0x90
+#define REPORT_KEY_CONSUMER 0xa0
+#define REPORT_CONSUMER_USAGES 0x20
+
+/**
+ * Maximum length of a generated report descriptor.
+ */
+#define REPORT_DESC_MAX_LEN 256
+
+/**
+ * Keyboard report layout.
+ */
+enum report_mode {
+    /**
+     * Boot protocol keyboard with 6 key slots (6KRO).
+     */
+    REPORT_BOOT = 0,
+
+    /**
+     * N-key rollover keyboard with a key bitmap.
+     */
+    REPORT_NKRO,
+
+    /**
+     * NKRO keyboard, consumer control and gamepad on one device, told apart by the report ID.
+     */
+    REPORT_COMPOSITE
+};
+
+/**
+ * Keyboard state and the report that represents it.
+ */
+struct report {
+    enum report_mode mode;
+
+    /**
+     * Keyboard report as it is sent to the host.
+     */
+    uint8_t data[REPORT_MAX_LEN];
+
+    /**
+     * Length of the keyboard report.
+     */
+    size_t len;
+
+    /**
+     * Byte offsets of the modifiers and the keys in the keyboard report, taken from the report definition.
+     */
+    uint8_t modsAt;
+    uint8_t keysAt;
+
+    uint8_t consumer[CONSUMER_REPORT_LEN];
+    uint8_t gamepad[GAMEPAD_REPORT_LEN];
+
+    /**
+     * Reports that changed since they were last taken with report_next(), one bit per report ID.
+     */
+    uint8_t changed;
+
+    /**
+     * Pressed keys.
+     */
+    uint8_t down[256];
+
+    /**
+     * Modifier bits of every pressed key.
+     */
+    uint8_t mods[256];
+};
+
+/**
+ * Initializes an empty report.
+ * @param r the report
+ * @param mode report layout
+ */
+void report_init(struct report *r, enum report_mode mode);
+
+/**
+ * Adds the key to the report.
+ * @param r the report
+ * @param key HID key
+ * @param mods modifier bits to hold together with the key
+ * @return 1 if the key was added, 0 if the report is full or cannot represent the key.
+ */
+int report_press(struct report *r, uint8_t key, uint8_t mods);
+
+/**
+ * Removes the key from the report.
+ * @return 1 if the key was in the report.
+ */
+int report_release(struct report *r, uint8_t key);
+
+/**
+ * Returns the next report that changed and marks it as taken.
+ * @param r the report
+ * @param len receives the length of the report
+ * @return the report, or NULL if no report changed.
+ */
+const uint8_t *report_next(struct report *r, size_t *len);
+
+/**
+ * Checks if the key addresses a gamepad axis, which takes the velocity instead of modifier bits.
+ */
+static inline int report_is_axis(uint8_t key) {
+    return key >= REPORT_KEY_AXIS && key < REPORT_KEY_AXIS + GAMEPAD_AXES;
+}
+
+/**
+ * Returns the usage of a consumer control key, or 0 if the key is not assigned.
+ */
+uint16_t report_consumer_usage(uint8_t key);
+
+/**
+ * Returns the report ID of the report, or 0 for the layouts without report IDs.
+ */
+static inline uint8_t report_id(enum report_mode mode, const uint8_t *data) {
+    return mode == REPORT_COMPOSITE ? data[0] : 0;
+}
+
+/**
+ * Checks if the key is currently pressed.
+ */
+static inline int report_contains(const struct report *r, uint8_t key) {
+    return r->down[key];
+}
+
+/**
+ * Decodes a report into the set of pressed keys. The modifier bits become the usages 0xe0-0xe7, the consumer
+ * controls and the gamepad buttons and axes (if not 0) become their key IDs.
+ * @param mode report layout
+ * @param data the report
+ * @param keys receives one bit per key usage
+ */
+void report_keys(enum report_mode mode, const uint8_t *data, uint8_t keys[32]);
+
+/**
+ * Decodes the axis values of a gamepad report.
+ * @param mode report layout
+ * @param data the report
+ * @param axes receives the values of the axes X, Y, Z and Rz
+ * @return 1 if the report is a gamepad report, 0 otherwise.
+ */
+int report_axes(enum report_mode mode, const uint8_t *data, uint8_t axes[GAMEPAD_AXES]);
+
+/**
+ * Returns the length of the longest report of the layout, which is the report_length of the gadget.
+ */
+size_t report_max_len(enum report_mode mode);
+
+/**
+ * Generates the HID report descriptor from the same definition as the report layout.
+ * @param mode report layout
+ * @param desc receives the descriptor, at least REPORT_DESC_MAX_LEN bytes
+ * @return the length of the descriptor
+ */
+size_t report_descriptor(enum report_mode mode, uint8_t *desc);
+
+#endif //MIDI2HID_REPORT_H
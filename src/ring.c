@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "ring.h"
+
+int ring_init(struct ring *r, size_t size, size_t capacity) {
+    memset(r, 0, sizeof(*r));
+    size_t n = 1;
+    while (n < capacity) {
+        n <<= 1;
+    }
+    // touched here, so that the threads never fault a page in
+    r->buf = calloc(n, size);
+    if (!r->buf) {
+        perror("ring");
+        return -1;
+    }
+    if ((r->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        perror("eventfd");
+        free(r->buf);
+        return -1;
+    }
+    r->size = size;
+    r->mask = n - 1;
+    return 0;
+}
+
+void ring_free(struct ring *r) {
+    close(r->fd);
+    free(r->buf);
+    r->buf = NULL;
+}
+
+void ring_kick(struct ring *r) {
+    if (r->head == r->kicked) {
+        return;
+    }
+    r->kicked = r->head;
+    ring_wake(r);
+}
+
+void ring_wake(struct ring *r) {
+    uint64_t one = 1;
+    // a readable eventfd wakes up the consumer, the count doesn't matter
+    ssize_t ret = write(r->fd, &one, sizeof(one));
+    (void) ret;
+}
+
+void ring_clear(struct ring *r) {
+    uint64_t count;
+    // EAGAIN if there was no kick
+    ssize_t ret = read(r->fd, &count, sizeof(count));
+    (void) ret;
+}
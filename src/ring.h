@@ -0,0 +1,104 @@
+#ifndef MIDI2HID_RING_H
+#define MIDI2HID_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Single producer, single consumer ring of fixed size elements between two threads, lock-free like the log ring.
+ * The consumer sleeps in poll() on {@code fd}, an eventfd the producer signals with ring_kick() after it pushed
+ * a batch.
+ */
+struct ring {
+    uint8_t *buf;
+    size_t size;
+    uint64_t mask;
+
+    /**
+     * eventfd that is readable while the consumer has something to pop.
+     */
+    int fd;
+
+    /**
+     * Next element to push. Only written by the producer.
+     */
+    uint64_t head __attribute__((aligned(64)));
+
+    /**
+     * Elements dropped because the ring was full. Only written by the producer.
+     */
+    uint64_t dropped;
+
+    /**
+     * Head at the last ring_kick(). Only used by the producer.
+     */
+    uint64_t kicked;
+
+    /**
+     * Next element to pop. Only written by the consumer.
+     */
+    uint64_t tail __attribute__((aligned(64)));
+};
+
+/**
+ * Allocates the ring.
+ * @param r the ring
+ * @param size size of an element
+ * @param capacity number of elements, rounded up to a power of two
+ * @return 0 on success
+ */
+int ring_init(struct ring *r, size_t size, size_t capacity);
+
+/**
+ * Frees the ring.
+ */
+void ring_free(struct ring *r);
+
+/**
+ * Appends an element. Never blocks: if the ring is full, the element is counted as dropped.
+ * @return 0 on success, -1 if the ring is full
+ */
+static inline int ring_push(struct ring *r, const void *elem) {
+    uint64_t head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > r->mask) {
+        __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    memcpy(r->buf + (head & r->mask) * r->size, elem, r->size);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Removes the oldest element.
+ * @return 1 if {@code elem} was filled, 0 if the ring is empty
+ */
+static inline int ring_pop(struct ring *r, void *elem) {
+    uint64_t tail = r->tail;
+    if (tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    memcpy(elem, r->buf + (tail & r->mask) * r->size, r->size);
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/**
+ * Wakes up the consumer, if anything was pushed since the last kick. Called by the producer once per batch, so
+ * a burst costs one syscall.
+ */
+void ring_kick(struct ring *r);
+
+/**
+ * Wakes up the consumer, even if nothing was pushed, eg. to stop it.
+ */
+void ring_wake(struct ring *r);
+
+/**
+ * Resets the wakeup of the consumer. Called by the consumer before it pops, so that a push after the last pop
+ * wakes it up again.
+ */
+void ring_clear(struct ring *r);
+
+#endif //MIDI2HID_RING_H
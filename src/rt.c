@@ -0,0 +1,65 @@
+#define _GNU_SOURCE
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "rt.h"
+
+/**
+ * Touches every page of a stack buffer, so the kernel maps (and with mlockall locks) them now and not on the first
+ * deep call in the event loop.
+ */
+static void __attribute__((noinline)) prefault_stack(size_t size) {
+    unsigned char buf[size];
+    // the stores go through a volatile pointer, so the compiler keeps them
+    volatile unsigned char *p = buf;
+    for (size_t i = 0; i < size; i += 4096) {
+        p[i] = 0;
+    }
+}
+
+int rt_lock_memory(size_t stack) {
+#ifdef __GLIBC__
+    // freed memory stays in the (locked) heap instead of being trimmed or unmapped and faulted in again.
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+#endif
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        perror("mlockall");
+        return -1;
+    }
+    prefault_stack(stack);
+    return 0;
+}
+
+int rt_pin(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err) {
+        fprintf(stderr, "affinity: %s\n", strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+int rt_enter(int priority, int cpu) {
+    if (cpu >= 0 && rt_pin(cpu)) {
+        return -1;
+    }
+    struct sched_param sp = {.sched_priority = priority};
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+    if (err) {
+        fprintf(stderr, "SCHED_FIFO: %s\n", strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+int rt_idle(void) {
+    struct sched_param sp = {.sched_priority = 0};
+    return pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp) ? -1 : 0;
+}
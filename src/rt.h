@@ -0,0 +1,47 @@
+#ifndef MIDI2HID_RT_H
+#define MIDI2HID_RT_H
+
+#include <stddef.h>
+
+/**
+ * Stack prefaulted by rt_lock_memory(). The event loop uses a few KB, the rest is headroom for libc and ALSA.
+ */
+#define RT_STACK_PREFAULT (256 * 1024)
+
+/**
+ * Default SCHED_FIFO priority. Above the USB and network IRQ threads (50) of a PREEMPT_RT kernel, below the
+ * watchdogs (99).
+ */
+#define RT_DEFAULT_PRIORITY 70
+
+/**
+ * Locks all current and future pages into memory, keeps malloc from returning memory to the system and
+ * prefaults the stack of the calling thread.
+ * @param stack number of stack bytes to prefault
+ * @return 0 on success
+ */
+int rt_lock_memory(size_t stack);
+
+/**
+ * Switches the calling thread to SCHED_FIFO and pins it to a CPU.
+ * Threads started before keep their scheduling, so call this after all helper threads are running.
+ * @param priority SCHED_FIFO priority, 1-99
+ * @param cpu CPU to pin the thread to, or -1 to keep the affinity
+ * @return 0 on success
+ */
+int rt_enter(int priority, int cpu);
+
+/**
+ * Pins the calling thread to a CPU, without changing its scheduling.
+ * @param cpu the CPU
+ * @return 0 on success
+ */
+int rt_pin(int cpu);
+
+/**
+ * Moves the calling thread to SCHED_IDLE, so it only runs when no other thread wants the CPU.
+ * @return 0 on success
+ */
+int rt_idle(void);
+
+#endif //MIDI2HID_RT_H
@@ -0,0 +1,74 @@
+/*
+ * Sets up the HID function of the USB gadget for the report layout of midi2hid, or removes it again. Running it
+ * again is harmless: it only changes what differs. eg:
+ *
+ *   setup_gadget -n up                 # own gadget with the NKRO layout, bound to the only UDC
+ *   setup_gadget -G g_multi -x up      # add the function to the board's gadget, which its script binds
+ *   setup_gadget down
+ *
+ *   setup_gadget [-n|-g] [-r configfs] [-c udc-class] [-G gadget] [-f function] [-u udc] [-x] up|down|node
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "gadget.h"
+
+int printUsage(char *bin) {
+    fprintf(stderr, "Usage: %s [-n|-g] [-r configfs] [-c udc-class] [-G gadget] [-f function] [-u udc] [-x] "
+                    "up|down|node\n", bin);
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    struct gadget g;
+    gadget_init(&g, REPORT_BOOT);
+    int opt;
+    while ((opt = getopt(argc, argv, "ngr:c:G:f:u:x")) != -1) {
+        switch (opt) {
+            case 'n':
+                g.mode = REPORT_NKRO;
+                break;
+            case 'g':
+                g.mode = REPORT_COMPOSITE;
+                break;
+            case 'r':
+                g.root = optarg;
+                break;
+            case 'c':
+                g.udcClass = optarg;
+                break;
+            case 'G':
+                g.name = optarg;
+                break;
+            case 'f':
+                g.function = optarg;
+                break;
+            case 'u':
+                g.udc = optarg;
+                break;
+            case 'x':
+                g.bind = 0;
+                break;
+            default:
+                return printUsage(argv[0]);
+        }
+    }
+    if (optind >= argc) {
+        return printUsage(argv[0]);
+    }
+    const char *what = argv[optind];
+    if (strcmp(what, "up") == 0) {
+        return gadget_setup(&g) ? 1 : 0;
+    } else if (strcmp(what, "down") == 0) {
+        return gadget_teardown(&g) ? 1 : 0;
+    } else if (strcmp(what, "node") == 0) {
+        char node[64];
+        if (gadget_node(&g, node, sizeof(node))) {
+            fprintf(stderr, "%s: no device\n", g.function);
+            return 1;
+        }
+        printf("%s\n", node);
+        return 0;
+    }
+    return printUsage(argv[0]);
+}
@@ -0,0 +1,50 @@
+#!/bin/sh
+# Runs setup_gadget against a scratch directory instead of configfs: sets the gadget up with boot protocol
+# reports, switches it to N-key rollover, takes it down again and checks the tree after every step. The HID
+# attributes have to match what hid_desc prints for the layout.
+#
+#   gadget.sh path/to/setup_gadget path/to/hid_desc
+
+setup_gadget=$1
+hid_desc=$2
+root=$(mktemp -d) || exit 1
+trap 'rm -rf "$root"' EXIT
+
+gadget=$root/usb_gadget/midi2hid
+hid=$gadget/functions/hid.usb0
+mkdir -p "$root/udc/musb"
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+# expect file value
+expect() {
+    [ "$(cat "$1" 2>/dev/null)" = "$2" ] || fail "${1#$root/} is '$(cat "$1" 2>/dev/null)', expected '$2'"
+}
+
+# check_hid [-n|-g]
+check_hid() {
+    expect "$hid/report_length" "$("$hid_desc" $1 length)"
+    expect "$hid/protocol" "$("$hid_desc" $1 protocol)"
+    expect "$hid/subclass" "$("$hid_desc" $1 subclass)"
+    "$hid_desc" $1 desc | cmp -s - "$hid/report_desc" || fail "report_desc differs from hid_desc $1 desc"
+    expect "$hid/interval" 1
+    [ "$(readlink "$gadget/configs/c.1/hid.usb0")" = "$hid" ] || fail "hid.usb0 is not linked into c.1"
+    expect "$gadget/UDC" musb
+}
+
+"$setup_gadget" -r "$root" -c "$root/udc" up || fail "up"
+check_hid
+expect "$gadget/idVendor" 0x0525
+expect "$gadget/strings/0x409/product" MIDIKeyboard
+
+"$setup_gadget" -n -r "$root" -c "$root/udc" up || fail "up -n"
+check_hid -n
+
+"$setup_gadget" -r "$root" -c "$root/udc" down || fail "down"
+[ ! -e "$gadget" ] || fail "midi2hid is left after down"
+[ -d "$root/usb_gadget" ] || fail "usb_gadget is gone"
+[ -z "$(ls -A "$root/usb_gadget")" ] || fail "usb_gadget is not empty: $(ls -A "$root/usb_gadget")"
+echo "gadget: ok"